@@ -0,0 +1,48 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace lc32sim {
+    class Simulator;
+}
+
+namespace lc32sim::bench {
+    //! Accumulates time across the timed parts of a benchmark run
+    class Timer {
+        private:
+            std::chrono::steady_clock::time_point started;
+        public:
+            double seconds = 0;
+            void start() {
+                this->started = std::chrono::steady_clock::now();
+            }
+            void stop() {
+                this->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - this->started).count();
+            }
+    };
+
+    /*!
+     * \brief A single benchmark
+     *
+     * `setup` runs once, untimed, and returns the body. The body is asked to
+     * do about `iterations` operations, times them with the `Timer`, and
+     * returns how many operations it actually did. Results are reported as
+     * nanoseconds per operation.
+     */
+    struct Benchmark {
+        using Body = std::function<uint64_t(uint64_t iterations, Timer &timer)>;
+        std::string name;
+        // What one operation is, like "instruction" or "byte"
+        std::string op;
+        std::function<Body()> setup;
+    };
+
+    //! Loads an image from `Encoder::elf` and points the PC at its entry
+    void load_program(Simulator &sim, const std::vector<uint8_t> &elf);
+
+    std::vector<Benchmark> micro_benchmarks();
+    std::vector<Benchmark> workload_benchmarks();
+}
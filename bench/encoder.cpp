@@ -0,0 +1,190 @@
+#include <utility>
+
+#include "elf_file.hpp"
+#include "encoder.hpp"
+#include "exceptions.hpp"
+
+namespace lc32sim::bench {
+    Encoder::Encoder(uint32_t base) : base(base) {}
+
+    uint32_t Encoder::here() const {
+        return this->base + this->image.size();
+    }
+
+    void Encoder::label(const std::string &name) {
+        if (!this->labels.emplace(name, this->here()).second) {
+            throw SimulatorException("Duplicate label " + name);
+        }
+    }
+
+    void Encoder::align(uint32_t alignment) {
+        while (this->here() % alignment != 0) {
+            this->image.push_back(0);
+        }
+    }
+
+    void Encoder::emit(uint16_t bits) {
+        this->image.push_back(bits & 0xff);
+        this->image.push_back(bits >> 8);
+    }
+
+    void Encoder::emit_fixup(uint16_t bits, Fixup kind, const std::string &label) {
+        this->fixups.push_back({this->image.size(), kind, label});
+        this->emit(bits);
+    }
+
+    void Encoder::arithmetic(uint16_t opcode, int dr, int sr1, int sr2) {
+        this->emit(opcode << 12 | dr << 9 | sr1 << 6 | sr2);
+    }
+
+    void Encoder::arithmetic_imm(uint16_t opcode, int dr, int sr1, int imm5) {
+        if (imm5 < -16 || imm5 > 15) {
+            throw SimulatorException("imm5 out of range: " + std::to_string(imm5));
+        }
+        this->emit(opcode << 12 | dr << 9 | sr1 << 6 | 0x20 | (imm5 & 0x1f));
+    }
+
+    void Encoder::memory(uint16_t opcode, int reg, int base_reg, int offset6) {
+        if (offset6 < -32 || offset6 > 31) {
+            throw SimulatorException("offset6 out of range: " + std::to_string(offset6));
+        }
+        this->emit(opcode << 12 | reg << 9 | base_reg << 6 | (offset6 & 0x3f));
+    }
+
+    void Encoder::shift(int dr, int sr, int amount, bool right, bool arithmetic) {
+        if (amount < 1 || amount > 8) {
+            throw SimulatorException("Shift amount out of range: " + std::to_string(amount));
+        }
+        this->emit(0b1101 << 12 | dr << 9 | sr << 6 | 0x20 | arithmetic << 4 | right << 3 | (amount - 1));
+    }
+
+    void Encoder::add(int dr, int sr1, int sr2) { this->arithmetic(0b0001, dr, sr1, sr2); }
+    void Encoder::add_imm(int dr, int sr1, int imm5) { this->arithmetic_imm(0b0001, dr, sr1, imm5); }
+    void Encoder::and_(int dr, int sr1, int sr2) { this->arithmetic(0b0101, dr, sr1, sr2); }
+    void Encoder::and_imm(int dr, int sr1, int imm5) { this->arithmetic_imm(0b0101, dr, sr1, imm5); }
+    void Encoder::xor_(int dr, int sr1, int sr2) { this->arithmetic(0b1001, dr, sr1, sr2); }
+    void Encoder::xor_imm(int dr, int sr1, int imm5) { this->arithmetic_imm(0b1001, dr, sr1, imm5); }
+
+    void Encoder::br(bool n, bool z, bool p, const std::string &target) {
+        this->emit_fixup(n << 11 | z << 10 | p << 9, Fixup::BR, target);
+    }
+    void Encoder::jmp(int base_reg) { this->emit(0b1100 << 12 | base_reg << 6); }
+    void Encoder::jsr(const std::string &target) { this->emit_fixup(0b0100 << 12 | 0x0800, Fixup::JSR, target); }
+    void Encoder::jsrr(int base_reg) { this->emit(0b0100 << 12 | base_reg << 6); }
+    void Encoder::lea(int dr, const std::string &target) { this->emit_fixup(0b1110 << 12 | dr << 9, Fixup::LEA, target); }
+
+    void Encoder::ldb(int dr, int base_reg, int offset6) { this->memory(0b0010, dr, base_reg, offset6); }
+    void Encoder::ldh(int dr, int base_reg, int offset6) { this->memory(0b0110, dr, base_reg, offset6); }
+    void Encoder::ldw(int dr, int base_reg, int offset6) { this->memory(0b1010, dr, base_reg, offset6); }
+    void Encoder::stb(int sr, int base_reg, int offset6) { this->memory(0b0011, sr, base_reg, offset6); }
+    void Encoder::sth(int sr, int base_reg, int offset6) { this->memory(0b0111, sr, base_reg, offset6); }
+    void Encoder::stw(int sr, int base_reg, int offset6) { this->memory(0b1011, sr, base_reg, offset6); }
+
+    void Encoder::lshf(int dr, int sr, int amount) { this->shift(dr, sr, amount, false, false); }
+    void Encoder::rshfl(int dr, int sr, int amount) { this->shift(dr, sr, amount, true, false); }
+    void Encoder::rshfa(int dr, int sr, int amount) { this->shift(dr, sr, amount, true, true); }
+
+    void Encoder::trap(uint8_t vector) { this->emit(0b1111 << 12 | vector); }
+    void Encoder::halt() { this->trap(0x25); }
+
+    void Encoder::word(uint32_t value) {
+        this->align(4);
+        for (int i = 0; i < 4; i++) {
+            this->image.push_back((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    void Encoder::load_constant(int dr, const std::string &target) {
+        this->lea(dr, target);
+        this->ldw(dr, dr, 0);
+    }
+
+    void Encoder::set(int dr, uint32_t value) {
+        std::string id = std::to_string(this->image.size());
+        this->load_constant(dr, ".const" + id);
+        this->br(true, true, true, ".skip" + id);
+        this->align(4);
+        this->label(".const" + id);
+        this->word(value);
+        this->label(".skip" + id);
+    }
+
+    std::vector<uint8_t> Encoder::elf(const std::string &entry) const {
+        std::vector<uint8_t> body = this->image;
+        for (const PendingFixup &fixup : this->fixups) {
+            auto it = this->labels.find(fixup.label);
+            if (it == this->labels.end()) {
+                throw SimulatorException("Undefined label " + fixup.label);
+            }
+            // Offsets are relative to the incremented PC
+            int64_t delta = static_cast<int64_t>(it->second) - (this->base + fixup.offset + 2);
+            uint16_t field = 0;
+            switch (fixup.kind) {
+                case Fixup::BR:
+                    if (delta / 2 < -256 || delta / 2 > 255) {
+                        throw SimulatorException("Branch to " + fixup.label + " out of range");
+                    }
+                    field = (delta / 2) & 0x1ff;
+                    break;
+                case Fixup::JSR:
+                    if (delta / 2 < -1024 || delta / 2 > 1023) {
+                        throw SimulatorException("JSR to " + fixup.label + " out of range");
+                    }
+                    field = (delta / 2) & 0x7ff;
+                    break;
+                case Fixup::LEA:
+                    if (delta < -256 || delta > 255) {
+                        throw SimulatorException("LEA of " + fixup.label + " out of range");
+                    }
+                    field = delta & 0x1ff;
+                    break;
+            }
+            body[fixup.offset] |= field & 0xff;
+            body[fixup.offset + 1] |= field >> 8;
+        }
+
+        uint32_t entry_addr = this->base;
+        if (!entry.empty()) {
+            entry_addr = this->labels.at(entry);
+        }
+
+        // Little-endian, 32-bit ELF identification
+        std::vector<uint8_t> out = {0x7f, 'E', 'L', 'F', 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        auto put16 = [&out](uint16_t val) {
+            out.push_back(val & 0xff);
+            out.push_back(val >> 8);
+        };
+        auto put32 = [&put16](uint32_t val) {
+            put16(val & 0xffff);
+            put16(val >> 16);
+        };
+        uint32_t phoff = 16 + sizeof(elf32_header);
+        uint32_t body_offset = phoff + sizeof(elf32_program_header);
+
+        put16(2); // ET_EXEC
+        put16(0x32); // machine
+        put32(1); // version
+        put32(entry_addr);
+        put32(phoff);
+        put32(0); // no section headers
+        put32(0); // flags
+        put16(phoff); // header size
+        put16(sizeof(elf32_program_header));
+        put16(1); // one program header
+        put16(0);
+        put16(0);
+        put16(0);
+
+        put32(std::to_underlying(segment_type::LOADABLE));
+        put32(body_offset);
+        put32(this->base); // vaddr
+        put32(this->base); // paddr
+        put32(body.size()); // filesz
+        put32(body.size()); // memsz
+        put32(7); // RWX
+        put32(4); // align
+
+        out.insert(out.end(), body.begin(), body.end());
+        return out;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lc32sim::bench {
+    /*!
+     * \brief Minimal LC-3.2 assembler for generating benchmark workloads
+     *
+     * Instructions are appended in order. Labels can be used before they are
+     * defined and are resolved when the image is built. Registers are plain
+     * numbers, and offsets are given in the units the instruction scales by.
+     */
+    class Encoder {
+        private:
+            enum class Fixup { BR, JSR, LEA };
+            struct PendingFixup {
+                size_t offset;
+                Fixup kind;
+                std::string label;
+            };
+
+            uint32_t base;
+            std::vector<uint8_t> image;
+            std::unordered_map<std::string, uint32_t> labels;
+            std::vector<PendingFixup> fixups;
+
+            void emit(uint16_t bits);
+            void emit_fixup(uint16_t bits, Fixup kind, const std::string &label);
+            void arithmetic(uint16_t opcode, int dr, int sr1, int sr2);
+            void arithmetic_imm(uint16_t opcode, int dr, int sr1, int imm5);
+            void memory(uint16_t opcode, int reg, int base_reg, int offset6);
+            void shift(int dr, int sr, int amount, bool right, bool arithmetic);
+
+        public:
+            Encoder(uint32_t base = 0x30000000);
+
+            uint32_t here() const;
+            void label(const std::string &name);
+            void align(uint32_t alignment);
+
+            void add(int dr, int sr1, int sr2);
+            void add_imm(int dr, int sr1, int imm5);
+            void and_(int dr, int sr1, int sr2);
+            void and_imm(int dr, int sr1, int imm5);
+            void xor_(int dr, int sr1, int sr2);
+            void xor_imm(int dr, int sr1, int imm5);
+            void br(bool n, bool z, bool p, const std::string &target);
+            void jmp(int base_reg);
+            void jsr(const std::string &target);
+            void jsrr(int base_reg);
+            void lea(int dr, const std::string &target);
+            void ldb(int dr, int base_reg, int offset6);
+            void ldh(int dr, int base_reg, int offset6);
+            void ldw(int dr, int base_reg, int offset6);
+            void stb(int sr, int base_reg, int offset6);
+            void sth(int sr, int base_reg, int offset6);
+            void stw(int sr, int base_reg, int offset6);
+            void lshf(int dr, int sr, int amount);
+            void rshfl(int dr, int sr, int amount);
+            void rshfa(int dr, int sr, int amount);
+            void trap(uint8_t vector);
+            void halt();
+
+            //! Emits a word-aligned 32-bit constant
+            void word(uint32_t value);
+            //! Loads the word at `target` into `dr`
+            void load_constant(int dr, const std::string &target);
+            //! Emits `value` right after the code that loads it into `dr`
+            void set(int dr, uint32_t value);
+
+            //! Resolves labels and returns an executable ELF image
+            std::vector<uint8_t> elf(const std::string &entry = "") const;
+    };
+}
@@ -0,0 +1,169 @@
+#include <argparse/argparse.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "bench.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+using lc32sim::logger;
+using lc32sim::bench::Benchmark;
+using lc32sim::bench::Timer;
+
+namespace {
+    struct Result {
+        std::string name;
+        std::string op;
+        double ns_per_op;
+        uint64_t ops;
+    };
+
+    /*
+     * Doubles the iteration count until one run takes at least `min_time`,
+     * then keeps the fastest of `repetitions` runs at that count.
+     */
+    Result measure(const Benchmark &benchmark, double min_time, unsigned int repetitions) {
+        Benchmark::Body body = benchmark.setup();
+        uint64_t iterations = 1;
+        double best = std::numeric_limits<double>::infinity();
+        uint64_t best_ops = 0;
+        unsigned int timed = 0;
+        while (timed < repetitions) {
+            Timer timer;
+            uint64_t ops = body(iterations, timer);
+            if (ops == 0) {
+                break;
+            }
+            if (timer.seconds < min_time && timed == 0) {
+                iterations *= 2;
+                continue;
+            }
+            timed++;
+            double ns_per_op = timer.seconds * 1e9 / ops;
+            if (ns_per_op < best) {
+                best = ns_per_op;
+                best_ops = ops;
+            }
+        }
+        return {benchmark.name, benchmark.op, best_ops ? best : 0.0, best_ops};
+    }
+
+    std::string to_json(const std::vector<Result> &results) {
+        std::ostringstream out;
+        out << "{\n    \"version\": 1,\n    \"results\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            out << (i ? ",\n" : "\n") << "        {\"name\": \"" << json_escape(r.name) << "\", \"op\": \"" << json_escape(r.op)
+                << "\", \"ns_per_op\": " << std::setprecision(6) << r.ns_per_op
+                << ", \"ops\": " << r.ops << "}";
+        }
+        out << "\n    ]\n}\n";
+        return out.str();
+    }
+
+    // Returns the number of benchmarks that got slower by more than `threshold` percent
+    int compare(const std::vector<Result> &results, const std::string &baseline_path, double threshold) {
+        boost::property_tree::ptree baseline;
+        boost::property_tree::read_json(baseline_path, baseline);
+        std::map<std::string, double> previous;
+        for (auto &[key, entry] : baseline.get_child("results")) {
+            previous[entry.get<std::string>("name")] = entry.get<double>("ns_per_op");
+        }
+
+        int regressions = 0;
+        std::cerr << std::left << std::setw(32) << "benchmark" << std::right << std::setw(14) << "baseline" << std::setw(14) << "current" << std::setw(10) << "change" << "\n";
+        for (const Result &r : results) {
+            auto it = previous.find(r.name);
+            if (it == previous.end() || it->second == 0 || r.ns_per_op == 0) {
+                std::cerr << std::left << std::setw(32) << r.name << std::right << std::setw(14) << "-" << std::setw(14) << r.ns_per_op << std::setw(10) << "new" << "\n";
+                continue;
+            }
+            double change = (r.ns_per_op - it->second) / it->second * 100;
+            bool regressed = change > threshold;
+            regressions += regressed;
+            std::cerr << std::left << std::setw(32) << r.name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(14) << it->second << std::setw(14) << r.ns_per_op
+                      << std::setw(9) << std::showpos << change << "%" << std::noshowpos
+                      << (regressed ? "  REGRESSION" : "") << std::defaultfloat << "\n";
+        }
+        return regressions;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("lc32sim_bench");
+    program.add_argument("-f", "--filter").help("only run benchmarks whose name contains the given string").default_value(std::string(""));
+    program.add_argument("--list").help("list benchmarks and exit").default_value(false).implicit_value(true);
+    program.add_argument("--min-time").help("minimum seconds per timed run").default_value(0.2).scan<'g', double>();
+    program.add_argument("--repetitions").help("timed runs per benchmark; the fastest is reported").default_value(3u).scan<'u', unsigned int>();
+    program.add_argument("-o", "--output").help("write JSON results to the given file instead of standard output");
+    program.add_argument("--baseline").help("compare against JSON results from a previous run and fail on regressions");
+    program.add_argument("--threshold").help("percent slowdown counted as a regression").default_value(10.0).scan<'g', double>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 2;
+    }
+
+    // Benchmarks measure the simulator, not the log, the frame limiter, or console input
+    logger.initialize("warn");
+    lc32sim::config_instance.display.turbo = true;
+    lc32sim::config_instance.console.read_stdin = false;
+
+    std::vector<Benchmark> benchmarks = lc32sim::bench::micro_benchmarks();
+    for (Benchmark &b : lc32sim::bench::workload_benchmarks()) {
+        benchmarks.push_back(std::move(b));
+    }
+    std::string filter = program.get<std::string>("--filter");
+    std::erase_if(benchmarks, [&filter](const Benchmark &b) { return b.name.find(filter) == std::string::npos; });
+
+    if (program["--list"] == true) {
+        for (const Benchmark &b : benchmarks) {
+            std::cout << b.name << std::endl;
+        }
+        return 0;
+    }
+
+    double min_time = program.get<double>("--min-time");
+    unsigned int repetitions = std::max(program.get<unsigned int>("--repetitions"), 1u);
+    std::vector<Result> results;
+    for (const Benchmark &b : benchmarks) {
+        Result r = measure(b, min_time, repetitions);
+        std::cerr << std::left << std::setw(32) << r.name << std::right << std::setw(12) << std::setprecision(4) << r.ns_per_op << " ns/" << r.op << std::endl;
+        results.push_back(r);
+    }
+
+    std::string json = to_json(results);
+    if (auto output = program.present("--output")) {
+        std::ofstream out(*output);
+        out << json;
+        out.close();
+        if (!out) {
+            std::cerr << "Could not write results to " << *output << std::endl;
+            return 1;
+        }
+    } else {
+        std::cout << json;
+    }
+
+    if (auto baseline = program.present("--baseline")) {
+        int regressions = compare(results, *baseline, program.get<double>("--threshold"));
+        if (regressions) {
+            std::cerr << regressions << " benchmark(s) regressed by more than " << program.get<double>("--threshold") << "%" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
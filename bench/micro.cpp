@@ -0,0 +1,228 @@
+#include <memory>
+#include <optional>
+
+#include "bench.hpp"
+#include "config.hpp"
+#include "display.hpp"
+#include "dma_controller.hpp"
+#include "encoder.hpp"
+#include "exceptions.hpp"
+#include "instruction.hpp"
+#include "memory.hpp"
+#include "sim.hpp"
+#include "video_timing.hpp"
+
+namespace lc32sim::bench {
+    namespace {
+        // Keeps results alive so the compiler cannot drop the work
+        volatile uint64_t sink;
+
+        const uint32_t DATA_ADDR = 0x30100000;
+        // Bytes of guest memory cycled through by the memory benchmarks
+        const uint32_t DATA_SIZE = 1 << 16;
+
+        // A loop of 64 copies of one instruction class, for `step/*`
+        Benchmark step_benchmark(const std::string &name, std::function<void(Encoder &)> body) {
+            return {"step/" + name, "instruction", [body]() -> Benchmark::Body {
+                auto sim = std::make_shared<Simulator>(42);
+                Encoder enc;
+                enc.label("loop");
+                for (int i = 0; i < 64; i++) {
+                    body(enc);
+                }
+                enc.br(true, true, true, "loop");
+                enc.label("function");
+                enc.jmp(7);
+                load_program(*sim, enc.elf());
+                sim->regs[1] = DATA_ADDR;
+                sim->regs[2] = 0x12345678;
+                sim->mem.span(DATA_ADDR, DATA_SIZE);
+
+                return [sim](uint64_t iterations, Timer &timer) {
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        sim->step();
+                    }
+                    timer.stop();
+                    return iterations;
+                };
+            }};
+        }
+
+        template<typename T, bool unsafe>
+        Benchmark read_benchmark(const std::string &name) {
+            return {"memory/" + name, "access", []() -> Benchmark::Body {
+                auto mem = std::make_shared<Memory>(42);
+                mem->span(DATA_ADDR, DATA_SIZE);
+                return [mem](uint64_t iterations, Timer &timer) {
+                    uint64_t acc = 0;
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        acc += mem->read<T, unsafe>(DATA_ADDR + ((i * sizeof(T)) & (DATA_SIZE - 1)));
+                    }
+                    timer.stop();
+                    sink = acc;
+                    return iterations;
+                };
+            }};
+        }
+
+        template<typename T, bool unsafe>
+        Benchmark write_benchmark(const std::string &name) {
+            return {"memory/" + name, "access", []() -> Benchmark::Body {
+                auto mem = std::make_shared<Memory>(42);
+                mem->span(DATA_ADDR, DATA_SIZE);
+                return [mem](uint64_t iterations, Timer &timer) {
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        mem->write<T, unsafe>(DATA_ADDR + ((i * sizeof(T)) & (DATA_SIZE - 1)), static_cast<T>(i));
+                    }
+                    timer.stop();
+                    return iterations;
+                };
+            }};
+        }
+
+        /*
+         * Runs DMA transfers of 0xFFFF elements through the control register.
+         * The control bits mirror the private constants in `DMAController`.
+         */
+        Benchmark dma_benchmark(const std::string &name, uint32_t control) {
+            return {"dma/" + name, "element", [control]() -> Benchmark::Body {
+                auto sim = std::make_shared<Simulator>(42);
+                auto timing = std::make_shared<VideoTiming>(sim->scheduler);
+                sim->register_io_device(new DMAController(sim->mem, *timing));
+                return [sim, timing, control](uint64_t iterations, Timer &timer) {
+                    const uint32_t elements = 0xFFFF;
+                    uint64_t transfers = (iterations + elements - 1) / elements;
+                    timer.start();
+                    for (uint64_t i = 0; i < transfers; i++) {
+                        sim->mem.write<uint32_t>(DMA_CONTROLLER_ADDR, DATA_ADDR);
+                        sim->mem.write<uint32_t>(DMA_CONTROLLER_ADDR + 4, DATA_ADDR + (1 << 20));
+                        sim->mem.write<uint32_t>(DMA_CONTROLLER_ADDR + 8, control | elements);
+                    }
+                    timer.stop();
+                    return transfers * elements;
+                };
+            }};
+        }
+    }
+
+    std::vector<Benchmark> micro_benchmarks() {
+        const uint32_t DMA_ON = 1_u32 << 31;
+        const uint32_t DMA_32 = 1_u32 << 26;
+        const uint32_t DMA_SOURCE_FIXED = 2_u32 << 23;
+
+        return {
+            {"decode", "instruction", []() -> Benchmark::Body {
+                return [](uint64_t iterations, Timer &timer) {
+                    uint64_t acc = 0;
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        // Walk all encodings in a scattered order
+                        Instruction inst(static_cast<uint16_t>(i * 40503));
+                        acc += static_cast<uint64_t>(inst.type);
+                    }
+                    timer.stop();
+                    sink = acc;
+                    return iterations;
+                };
+            }},
+
+            step_benchmark("alu", [](Encoder &enc) { enc.add(3, 3, 2); }),
+            step_benchmark("alu_imm", [](Encoder &enc) { enc.xor_imm(3, 3, 5); }),
+            step_benchmark("shift", [](Encoder &enc) { enc.lshf(3, 2, 3); }),
+            step_benchmark("load", [](Encoder &enc) { enc.ldw(3, 1, 4); }),
+            step_benchmark("store", [](Encoder &enc) { enc.stw(2, 1, 4); }),
+            step_benchmark("lea", [](Encoder &enc) { enc.lea(3, "loop"); }),
+            step_benchmark("branch", [](Encoder &enc) {
+                // Always taken, to the next instruction
+                std::string next = "next" + std::to_string(enc.here());
+                enc.br(true, true, true, next);
+                enc.label(next);
+            }),
+            step_benchmark("call", [](Encoder &enc) { enc.jsr("function"); }),
+
+            read_benchmark<uint32_t, false>("read32_checked"),
+            read_benchmark<uint32_t, true>("read32_unchecked"),
+            read_benchmark<uint8_t, false>("read8_checked"),
+            write_benchmark<uint32_t, false>("write32_checked"),
+            write_benchmark<uint32_t, true>("write32_unchecked"),
+
+            {"memory/read_mmio", "access", []() -> Benchmark::Body {
+                auto mem = std::make_shared<Memory>(42);
+                mem->add_read_hook(RNG_ADDR, [](uint32_t val) -> uint32_t { return val + 1; });
+                return [mem](uint64_t iterations, Timer &timer) {
+                    uint64_t acc = 0;
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        acc += mem->read<uint32_t>(RNG_ADDR);
+                    }
+                    timer.stop();
+                    sink = acc;
+                    return iterations;
+                };
+            }},
+            {"memory/write_mmio", "access", []() -> Benchmark::Body {
+                auto mem = std::make_shared<Memory>(42);
+                mem->add_write_hook(RNG_ADDR, [](uint32_t old_value, uint32_t value) -> uint32_t { return value; });
+                return [mem](uint64_t iterations, Timer &timer) {
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        mem->write<uint32_t>(RNG_ADDR, static_cast<uint32_t>(i));
+                    }
+                    timer.stop();
+                    return iterations;
+                };
+            }},
+
+            {"memory/init_page", "page", []() -> Benchmark::Body {
+                return [](uint64_t iterations, Timer &timer) {
+                    // Cycle through a bounded region so resident memory
+                    // stays small, starting over with fresh memory each time
+                    const uint64_t pages_per_memory = 4096;
+                    uint64_t page_size = Config.memory.simulator_page_size;
+                    uint64_t done = 0;
+                    while (done < iterations) {
+                        Memory mem(42);
+                        uint64_t pages = std::min(pages_per_memory, iterations - done);
+                        timer.start();
+                        for (uint64_t i = 0; i < pages; i++) {
+                            mem.span(Config.memory.user_space_min + i * page_size, 1);
+                        }
+                        timer.stop();
+                        done += pages;
+                    }
+                    return done;
+                };
+            }},
+
+            dma_benchmark("copy32", DMA_ON | DMA_32),
+            dma_benchmark("fill32", DMA_ON | DMA_32 | DMA_SOURCE_FIXED),
+            dma_benchmark("copy16", DMA_ON),
+
+            {"display/update", "scanline", []() -> Benchmark::Body {
+                auto sim = std::make_shared<Simulator>(42);
+                auto timing = std::make_shared<VideoTiming>(sim->scheduler);
+                std::shared_ptr<Display> display;
+                try {
+                    display = std::make_shared<Display>(timing->scanline);
+                } catch (DisplayException &e) {
+                    // No display available; report nothing rather than fail
+                    return [](uint64_t iterations, Timer &timer) { return uint64_t(0); };
+                }
+                sim->register_io_device(*display);
+                return [sim, timing, display](uint64_t iterations, Timer &timer) {
+                    uint16_t lines = Config.display.height + Config.display.vblank_length;
+                    timer.start();
+                    for (uint64_t i = 0; i < iterations; i++) {
+                        display->update(*sim);
+                        timing->scanline = (timing->scanline + 1) % lines;
+                    }
+                    timer.stop();
+                    return iterations;
+                };
+            }},
+        };
+    }
+}
@@ -0,0 +1,137 @@
+#include <optional>
+
+#include "bench.hpp"
+#include "cache_model.hpp"
+#include "dma_controller.hpp"
+#include "elf_file.hpp"
+#include "encoder.hpp"
+#include "sim.hpp"
+#include "video_timing.hpp"
+
+namespace lc32sim::bench {
+    void load_program(Simulator &sim, const std::vector<uint8_t> &elf) {
+        ELFFile file(elf.data(), elf.size());
+        sim.mem.load_elf(file);
+        sim.pc = file.get_header().entry;
+    }
+
+    namespace {
+        /*
+         * Runs a whole program to HALT with the same devices as a headless
+         * run, and the cache model if `cached` is set, as with `--cache-report`.
+         * Operations are guest instructions.
+         */
+        Benchmark workload(const std::string &name, std::function<void(Encoder &)> program, bool cached = false) {
+            return {"workload/" + name, "instruction", [program, cached]() -> Benchmark::Body {
+                Encoder enc;
+                program(enc);
+                enc.halt();
+                std::vector<uint8_t> elf = enc.elf();
+
+                return [elf, cached](uint64_t iterations, Timer &timer) {
+                    uint64_t executed = 0;
+                    while (executed < iterations) {
+                        Simulator sim(42);
+                        load_program(sim, elf);
+                        VideoTiming timing(sim.scheduler);
+                        sim.register_io_device(timing);
+                        sim.register_io_device(new DMAController(sim.mem, timing));
+                        ELFFile file(elf.data(), elf.size());
+                        std::optional<CacheModel> cache_model;
+                        if (cached) {
+                            cache_model.emplace(file);
+                            sim.cache_model = &*cache_model;
+                        }
+
+                        timer.start();
+                        sim.run();
+                        timer.stop();
+                        if (sim.scheduler.now == 0) {
+                            break;
+                        }
+                        executed += sim.scheduler.now;
+                    }
+                    return executed;
+                };
+            }};
+        }
+    }
+
+    std::vector<Benchmark> workload_benchmarks() {
+        // Register-only arithmetic
+        auto alu_loop = [](Encoder &enc) {
+            enc.set(1, 1000000);
+            enc.label("loop");
+            enc.add(2, 2, 1);
+            enc.xor_(3, 3, 2);
+            enc.lshf(4, 3, 3);
+            enc.rshfl(5, 4, 2);
+            enc.and_(6, 5, 2);
+            enc.add_imm(1, 1, -1);
+            enc.br(false, false, true, "loop");
+        };
+
+        // Read-modify-write over a 1 MiB buffer, four times over
+        auto memory_stream = [](Encoder &enc) {
+            enc.set(4, 4);
+            enc.label("outer");
+            enc.set(1, 0x30100000);
+            enc.set(2, 1 << 18);
+            enc.label("loop");
+            enc.ldw(3, 1, 0);
+            enc.add_imm(3, 3, 1);
+            enc.stw(3, 1, 0);
+            enc.add_imm(1, 1, 4);
+            enc.add_imm(2, 2, -1);
+            enc.br(false, false, true, "loop");
+            enc.add_imm(4, 4, -1);
+            enc.br(false, false, true, "outer");
+        };
+
+        return {
+            workload("alu_loop", alu_loop),
+            workload("memory_stream", memory_stream),
+            // The same, through the cache model
+            workload("alu_loop_cached", alu_loop, true),
+            workload("memory_stream_cached", memory_stream, true),
+
+            // Data-dependent branches driven by a 16-bit LFSR
+            workload("branch_heavy", [](Encoder &enc) {
+                enc.set(0, 1000000);
+                enc.set(1, 0xACE1);
+                enc.set(4, 0xB400);
+                enc.label("loop");
+                enc.rshfl(2, 1, 1);
+                enc.and_imm(3, 1, 1);
+                enc.br(false, true, false, "no_tap");
+                enc.xor_(2, 2, 4);
+                enc.label("no_tap");
+                enc.add_imm(1, 2, 0);
+                enc.and_imm(5, 1, 2);
+                enc.br(false, true, false, "even");
+                enc.add_imm(6, 6, 1);
+                enc.br(true, true, true, "next");
+                enc.label("even");
+                enc.add_imm(7, 7, 1);
+                enc.label("next");
+                enc.add_imm(0, 0, -1);
+                enc.br(false, false, true, "loop");
+            }),
+
+            // Halfword stores over the whole framebuffer, eight frames
+            workload("framebuffer_fill", [](Encoder &enc) {
+                enc.set(4, 8);
+                enc.label("frame");
+                enc.set(1, VIDEO_BUFFER_ADDR);
+                enc.set(2, Config.display.width * Config.display.height);
+                enc.label("loop");
+                enc.sth(4, 1, 0);
+                enc.add_imm(1, 1, 2);
+                enc.add_imm(2, 2, -1);
+                enc.br(false, false, true, "loop");
+                enc.add_imm(4, 4, -1);
+                enc.br(false, false, true, "frame");
+            }),
+        };
+    }
+}
@@ -0,0 +1,217 @@
+#ifndef LC32SIM_H
+#define LC32SIM_H
+/*
+ * liblc32sim: the LC-3.2 simulator as an embeddable library
+ *
+ * This is the stable interface for hosting the simulator inside another
+ * program, such as an autograder or a test harness. It is plain C so it can
+ * be used through any FFI. Everything else in the simulator is internal and
+ * may change between versions.
+ *
+ * Instances run headless, with the same devices as `lc32sim --headless`:
+ * video timing, DMA, the filesystem, the clock, the RNG, and console input.
+ * A single instance must not be used from several threads at once.
+ * Separate instances are independent, apart from the process-wide settings
+ * in `lc32sim_config` described below.
+ *
+ * Functions that can fail return `LC32SIM_ERROR` (or NULL) and leave a
+ * description in `lc32sim_last_error()`. No C++ exception ever crosses
+ * this interface.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+    #define LC32SIM_API __declspec(dllexport)
+#else
+    #define LC32SIM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LC32SIM_API_VERSION 2
+
+typedef struct lc32sim_instance lc32sim_instance;
+
+typedef enum lc32sim_status {
+    LC32SIM_ERROR = -1,
+    LC32SIM_OK = 0,
+    //! The program executed HALT
+    LC32SIM_HALTED = 1,
+    //! The instruction budget given to `lc32sim_run` ran out
+    LC32SIM_BUDGET_EXHAUSTED = 2,
+    //! A device asked the run loop to stop
+    LC32SIM_STOPPED = 3,
+    //! The program faulted; see `lc32sim_get_fault` and `lc32sim_last_error`
+    LC32SIM_FAULT = 4,
+} lc32sim_status;
+
+typedef enum lc32sim_fault_kind {
+    //! An access outside user space
+    LC32SIM_FAULT_SEGMENTATION = 1,
+    //! An access not aligned to its size
+    LC32SIM_FAULT_UNALIGNED = 2,
+    //! The `CRASH` TRAP
+    LC32SIM_FAULT_CRASH = 3,
+    //! `RTI`, an unknown TRAP vector, or an unknown instruction
+    LC32SIM_FAULT_ILLEGAL_INSTRUCTION = 4,
+    //! A device or TRAP failed while the instruction used it
+    LC32SIM_FAULT_DEVICE = 5,
+} lc32sim_fault_kind;
+
+typedef enum lc32sim_fault_phase {
+    //! While executing the instruction at the PC
+    LC32SIM_PHASE_EXECUTE = 0,
+    //! While fetching the instruction at the PC
+    LC32SIM_PHASE_FETCH = 1,
+    //! In a scheduled device event, before the instruction at the PC
+    LC32SIM_PHASE_EVENT = 2,
+} lc32sim_fault_phase;
+
+/*!
+ * \brief The fault a run stopped at
+ *
+ * The faulting instruction does not complete, and the PC is left on it.
+ */
+typedef struct lc32sim_fault {
+    lc32sim_fault_kind kind;
+    //! Address of the faulting instruction
+    uint32_t pc;
+    //! The instruction, or 0 if it was never fetched
+    uint16_t instruction;
+    //! Address accessed, for segmentation faults and unaligned accesses
+    uint32_t address;
+    //! When the fault was taken
+    lc32sim_fault_phase phase;
+} lc32sim_fault;
+
+/*!
+ * \brief Settings for `lc32sim_create`
+ *
+ * Always fill this in with `lc32sim_config_init` before changing fields, so
+ * that fields added in later versions get their defaults. A caller built
+ * against an older header passes its smaller `struct_size`, and the fields
+ * it does not know about get their defaults too. Strings may be NULL or
+ * empty to mean "unset".
+ *
+ * Everything except `seed` is process-wide: it is applied by the first
+ * `lc32sim_create`, and later instances must be created with the same
+ * values while any instance exists.
+ */
+typedef struct lc32sim_config {
+    //! Set to `sizeof(lc32sim_config)` by `lc32sim_config_init`
+    size_t struct_size;
+    //! Seeds registers, condition codes, and uninitialized memory
+    unsigned int seed;
+    //! One of "trace", "debug", "info", "warn", "error", or "fatal"
+    const char *log_level;
+    unsigned int display_width;
+    unsigned int display_height;
+    unsigned int vblank_length;
+    unsigned int instructions_per_scanline;
+    uint64_t simulator_page_size;
+    uint64_t user_space_min;
+    uint64_t user_space_max;
+    const char *filesystem_preload_manifest;
+    //! "newline", "size", "interval", or "halt"
+    const char *console_flush_policy;
+    //! Host file that also receives everything the guest prints
+    const char *console_capture_file;
+    //! Host file read as console input; without one, there is no console input
+    const char *console_input_file;
+} lc32sim_config;
+
+//! Fills `config` with the same defaults the simulator uses
+LC32SIM_API void lc32sim_config_init(lc32sim_config *config);
+
+/*!
+ * \brief Returns a description of the last error on this thread
+ *
+ * The string stays valid until the next failing call on the same thread.
+ */
+LC32SIM_API const char *lc32sim_last_error(void);
+
+//! Creates an instance with no program loaded, or returns NULL on failure
+LC32SIM_API lc32sim_instance *lc32sim_create(const lc32sim_config *config);
+LC32SIM_API void lc32sim_destroy(lc32sim_instance *sim);
+
+/*!
+ * \brief Loads an ELF image from memory and points the PC at its entry
+ *
+ * The image is copied, so `data` may be freed once this returns.
+ */
+LC32SIM_API lc32sim_status lc32sim_load_elf(lc32sim_instance *sim, const void *data, size_t size);
+
+/*!
+ * \brief Runs the loaded program
+ *
+ * Stops after at most `max_instructions` instructions, or runs until the
+ * program stops by itself if it is zero. Scheduled devices keep their
+ * timing across calls, so a program can be run in slices. The number of
+ * instructions executed by this call, counting one that faulted, is stored
+ * in `executed` if it is not NULL.
+ *
+ * \return `LC32SIM_HALTED`, `LC32SIM_BUDGET_EXHAUSTED`, `LC32SIM_STOPPED`,
+ *         `LC32SIM_FAULT`, or `LC32SIM_ERROR` if `sim` is NULL
+ */
+LC32SIM_API lc32sim_status lc32sim_run(lc32sim_instance *sim, uint64_t max_instructions, uint64_t *executed);
+
+/*!
+ * \brief Describes the fault the last `lc32sim_run` stopped at
+ *
+ * The instance stays usable after a fault. Running it again retries the
+ * faulting instruction, so the host should first change the PC, registers,
+ * or memory, or load another program.
+ *
+ * \return `LC32SIM_FAULT` with `fault` filled in, `LC32SIM_OK` if the last
+ *         run did not fault, or `LC32SIM_ERROR` on invalid arguments
+ */
+LC32SIM_API lc32sim_status lc32sim_get_fault(const lc32sim_instance *sim, lc32sim_fault *fault);
+//! Total number of instructions executed since the instance was created
+LC32SIM_API uint64_t lc32sim_instructions_executed(const lc32sim_instance *sim);
+
+LC32SIM_API lc32sim_status lc32sim_get_register(const lc32sim_instance *sim, unsigned int reg, uint32_t *value);
+LC32SIM_API lc32sim_status lc32sim_set_register(lc32sim_instance *sim, unsigned int reg, uint32_t value);
+LC32SIM_API uint32_t lc32sim_get_pc(const lc32sim_instance *sim);
+LC32SIM_API void lc32sim_set_pc(lc32sim_instance *sim, uint32_t pc);
+
+/*!
+ * \brief Copies guest memory to and from the host
+ *
+ * The whole range must lie in user space. These are direct accesses: they
+ * do not trigger device registers or callbacks.
+ */
+LC32SIM_API lc32sim_status lc32sim_read_memory(lc32sim_instance *sim, uint32_t addr, void *buffer, size_t size);
+LC32SIM_API lc32sim_status lc32sim_write_memory(lc32sim_instance *sim, uint32_t addr, const void *buffer, size_t size);
+
+/*!
+ * \brief Called when the guest reads a word-aligned I/O address
+ *
+ * `value` is what is currently stored there. The return value is what the
+ * guest sees.
+ */
+typedef uint32_t (*lc32sim_read_callback)(void *user, uint32_t addr, uint32_t value);
+/*!
+ * \brief Called when the guest writes a word-aligned I/O address
+ *
+ * `value` is the word as written, merged with `old_value` for narrower
+ * stores. The return value is what gets stored.
+ */
+typedef uint32_t (*lc32sim_write_callback)(void *user, uint32_t addr, uint32_t old_value, uint32_t value);
+
+/*!
+ * \brief Attaches host callbacks to a register in I/O space
+ *
+ * This is how a host adds its own memory-mapped devices. `addr` must be
+ * word-aligned, in I/O space, and not already used by another device.
+ */
+LC32SIM_API lc32sim_status lc32sim_add_read_callback(lc32sim_instance *sim, uint32_t addr, lc32sim_read_callback callback, void *user);
+LC32SIM_API lc32sim_status lc32sim_add_write_callback(lc32sim_instance *sim, uint32_t addr, lc32sim_write_callback callback, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <numeric>
+#include <tuple>
+
+#include "cache_model.hpp"
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "utils.hpp"
+
+namespace lc32sim {
+    namespace {
+        const char *LEVEL_NAMES[] = {"L1I", "L1D", "L2", "TLB"};
+
+        ReplacementPolicy parse_policy(const std::string &name) {
+            if (name == "lru") {
+                return ReplacementPolicy::LRU;
+            } else if (name == "fifo") {
+                return ReplacementPolicy::FIFO;
+            } else if (name == "random") {
+                return ReplacementPolicy::RANDOM;
+            }
+            throw SimulatorException("Unknown cache replacement policy " + name + ", expected lru, fifo, or random");
+        }
+    }
+
+    CacheLevel::CacheLevel(uint64_t size, unsigned int ways, unsigned int line_size, ReplacementPolicy policy)
+        : ways(ways), policy(policy), size(size), line_size(line_size) {
+        if (line_size < 4 || !std::has_single_bit(line_size)) {
+            throw SimulatorException("Cache line size " + std::to_string(line_size) + " is not a power of two of at least 4");
+        }
+        if (ways == 0 || size % (static_cast<uint64_t>(ways) * line_size) != 0) {
+            throw SimulatorException("Cache size " + std::to_string(size) + " is not a multiple of " + std::to_string(ways) + " ways of " + std::to_string(line_size) + " bytes");
+        }
+        uint64_t sets = size / (static_cast<uint64_t>(ways) * line_size);
+        if (!std::has_single_bit(sets) || sets > (UINT64_C(1) << 31)) {
+            throw SimulatorException("Cache of " + std::to_string(size) + " bytes has " + std::to_string(sets) + " sets, which is not a power of two");
+        }
+        this->line_shift = std::countr_zero(line_size);
+        this->set_mask = static_cast<uint32_t>(sets - 1);
+        this->tags.assign(sets * ways, INVALID);
+        this->stamps.assign(sets * ways, 0);
+    }
+
+    bool CacheLevel::access(uint32_t addr) {
+        uint32_t line = this->line(addr);
+        size_t first = static_cast<size_t>(line & this->set_mask) * this->ways;
+        uint32_t *set = &this->tags[first];
+        for (unsigned int way = 0; way < this->ways; way++) {
+            if (set[way] == line) {
+                if (this->policy == ReplacementPolicy::LRU) {
+                    this->stamps[first + way] = ++this->clock;
+                }
+                return true;
+            }
+        }
+
+        // Invalid ways have the oldest stamps, so LRU and FIFO fill them first
+        unsigned int victim = 0;
+        if (this->policy == ReplacementPolicy::RANDOM) {
+            victim = std::find(set, set + this->ways, INVALID) - set;
+            if (victim == this->ways) {
+                // xorshift32
+                this->random_state ^= this->random_state << 13;
+                this->random_state ^= this->random_state >> 17;
+                this->random_state ^= this->random_state << 5;
+                victim = this->random_state % this->ways;
+            }
+        } else {
+            uint64_t *stamps = &this->stamps[first];
+            victim = std::min_element(stamps, stamps + this->ways) - stamps;
+        }
+        set[victim] = line;
+        this->stamps[first + victim] = ++this->clock;
+        return false;
+    }
+
+    CacheModel::CacheModel(ELFFile &elf) : batch(std::make_unique<Access[]>(BATCH_SIZE)) {
+        ReplacementPolicy policy = parse_policy(Config.cache.replacement);
+        this->levels[L1I].emplace(Config.cache.l1i_size, Config.cache.l1i_ways, Config.cache.l1i_line_size, policy);
+        this->levels[L1D].emplace(Config.cache.l1d_size, Config.cache.l1d_ways, Config.cache.l1d_line_size, policy);
+        if (Config.cache.l2_size != 0) {
+            this->levels[L2].emplace(Config.cache.l2_size, Config.cache.l2_ways, Config.cache.l2_line_size, policy);
+        }
+        if (Config.cache.tlb_entries != 0) {
+            this->levels[TLB].emplace(static_cast<uint64_t>(Config.cache.tlb_entries) * Config.cache.tlb_page_size, Config.cache.tlb_ways, Config.cache.tlb_page_size, policy);
+        }
+
+        std::tie(this->base, this->size) = elf.get_executable_range();
+        this->by_pc.resize((static_cast<uint64_t>(this->size) + 1) / 2);
+    }
+
+    void CacheModel::drain() {
+        CacheLevel *tlb = this->levels[TLB] ? &*this->levels[TLB] : nullptr;
+        CacheLevel *l2 = this->levels[L2] ? &*this->levels[L2] : nullptr;
+        CacheLevel &l1i = *this->levels[L1I];
+        CacheLevel &l1d = *this->levels[L1D];
+        for (size_t i = 0; i < this->batched; i++) {
+            const Access &access = this->batch[i];
+            if (access.data && access.addr >= Config.memory.io_space_min) {
+                continue;
+            }
+            Counts &counts = this->counts_for(access.pc);
+            bool hit;
+
+            if (tlb) {
+                uint32_t page = tlb->line(access.addr);
+                hit = page == this->last_page || tlb->access(access.addr);
+                this->last_page = page;
+                counts.accesses[TLB]++;
+                counts.misses[TLB] += !hit;
+            }
+
+            Level level = access.data ? L1D : L1I;
+            if (access.data) {
+                hit = l1d.access(access.addr);
+            } else {
+                uint32_t line = l1i.line(access.addr);
+                hit = line == this->last_fetch_line || l1i.access(access.addr);
+                this->last_fetch_line = line;
+            }
+            counts.accesses[level]++;
+            counts.misses[level] += !hit;
+
+            if (!hit && l2) {
+                hit = l2->access(access.addr);
+                counts.accesses[L2]++;
+                counts.misses[L2] += !hit;
+            }
+        }
+        this->batched = 0;
+    }
+
+    CacheModel::Counts CacheModel::get_totals() {
+        this->drain();
+        Counts totals = this->elsewhere;
+        for (const Counts &counts : this->by_pc) {
+            for (size_t level = 0; level < LEVELS; level++) {
+                totals.accesses[level] += counts.accesses[level];
+                totals.misses[level] += counts.misses[level];
+            }
+        }
+        return totals;
+    }
+
+    void CacheModel::clear_counts() {
+        this->drain();
+        std::fill(this->by_pc.begin(), this->by_pc.end(), Counts());
+        this->elsewhere = Counts();
+    }
+
+    void CacheModel::write_counts(std::ostream &out, const Counts &counts) const {
+        bool first = true;
+        for (size_t level = 0; level < LEVELS; level++) {
+            if (!this->levels[level]) {
+                continue;
+            }
+            uint64_t accesses = counts.accesses[level];
+            uint64_t misses = counts.misses[level];
+            double miss_rate = accesses ? static_cast<double>(misses) / accesses : 0.0;
+            out << (first ? "" : ", ") << "\"" << LEVEL_NAMES[level] << "\": {"
+                << "\"accesses\": " << accesses << ", \"misses\": " << misses << ", \"miss_rate\": " << miss_rate << "}";
+            first = false;
+        }
+    }
+
+    void CacheModel::write_report(ELFFile &elf, const std::string &path) {
+        this->drain();
+
+        auto add = [](Counts &to, const Counts &from) {
+            for (size_t level = 0; level < LEVELS; level++) {
+                to.accesses[level] += from.accesses[level];
+                to.misses[level] += from.misses[level];
+            }
+        };
+        auto used = [](const Counts &counts) {
+            return std::any_of(std::begin(counts.accesses), std::end(counts.accesses), [](uint64_t n) { return n != 0; });
+        };
+        auto total_misses = [](const Counts &counts) {
+            return std::accumulate(std::begin(counts.misses), std::end(counts.misses), UINT64_C(0));
+        };
+        // Attribute each PC to the function symbol it falls in, if any
+        std::vector<elf_symbol> symbols = elf.get_function_symbols();
+        auto function_of = [&](uint32_t pc) -> const elf_symbol* {
+            auto after = std::upper_bound(symbols.begin(), symbols.end(), pc, [](uint32_t pc, const elf_symbol &s) { return pc < s.value; });
+            if (after == symbols.begin()) {
+                return nullptr;
+            }
+            const elf_symbol &s = *(after - 1);
+            // Symbols without a size run up to the next one
+            return s.size == 0 || pc - s.value < s.size ? &s : nullptr;
+        };
+
+        Counts totals = this->elsewhere;
+        std::vector<Counts> by_function(symbols.size());
+        Counts unknown_function = this->elsewhere;
+        std::vector<uint32_t> hot;
+        for (size_t i = 0; i < this->by_pc.size(); i++) {
+            const Counts &counts = this->by_pc[i];
+            if (!used(counts)) {
+                continue;
+            }
+            uint32_t pc = this->base + static_cast<uint32_t>(i * 2);
+            add(totals, counts);
+            const elf_symbol *function = function_of(pc);
+            add(function ? by_function[function - symbols.data()] : unknown_function, counts);
+            if (total_misses(counts) != 0) {
+                hot.push_back(pc);
+            }
+        }
+
+        // Functions and PCs with the most misses first
+        std::vector<size_t> functions;
+        for (size_t i = 0; i < symbols.size(); i++) {
+            if (used(by_function[i])) {
+                functions.push_back(i);
+            }
+        }
+        std::stable_sort(functions.begin(), functions.end(), [&](size_t a, size_t b) {
+            return total_misses(by_function[a]) > total_misses(by_function[b]);
+        });
+        size_t hot_count = std::min<size_t>(hot.size(), Config.cache.hot_pcs);
+        std::partial_sort(hot.begin(), hot.begin() + hot_count, hot.end(), [&](uint32_t a, uint32_t b) {
+            uint64_t misses_a = total_misses(this->counts_for(a)), misses_b = total_misses(this->counts_for(b));
+            return misses_a != misses_b ? misses_a > misses_b : a < b;
+        });
+        hot.resize(hot_count);
+
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            throw SimulatorException("Could not open cache report " + path);
+        }
+        out << "{\n    \"levels\": {";
+        bool first = true;
+        for (size_t level = 0; level < LEVELS; level++) {
+            if (!this->levels[level]) {
+                continue;
+            }
+            const CacheLevel &cache = *this->levels[level];
+            uint64_t accesses = totals.accesses[level];
+            uint64_t misses = totals.misses[level];
+            out << (first ? "\n" : ",\n") << "        \"" << LEVEL_NAMES[level] << "\": {"
+                << "\"size\": " << cache.size << ", \"ways\": " << cache.get_ways() << ", \"line_size\": " << cache.line_size
+                << ", \"accesses\": " << accesses << ", \"misses\": " << misses
+                << ", \"miss_rate\": " << (accesses ? static_cast<double>(misses) / accesses : 0.0) << "}";
+            first = false;
+        }
+        out << "\n    },\n    \"functions\": [";
+        first = true;
+        for (size_t i : functions) {
+            out << (first ? "\n" : ",\n") << "        {\"name\": \"" << json_escape(symbols[i].name) << "\", \"address\": \"0x" << int_to_hex(symbols[i].value) << "\", ";
+            this->write_counts(out, by_function[i]);
+            out << "}";
+            first = false;
+        }
+        if (used(unknown_function)) {
+            out << (first ? "\n" : ",\n") << "        {\"name\": null, ";
+            this->write_counts(out, unknown_function);
+            out << "}";
+            first = false;
+        }
+        out << "\n    ],\n    \"hot_pcs\": [";
+        first = true;
+        for (uint32_t pc : hot) {
+            const elf_symbol *function = function_of(pc);
+            out << (first ? "\n" : ",\n") << "        {\"pc\": \"0x" << int_to_hex(pc) << "\", \"function\": ";
+            if (function) {
+                out << "\"" << json_escape(function->name) << "\", ";
+            } else {
+                out << "null, ";
+            }
+            this->write_counts(out, this->counts_for(pc));
+            out << "}";
+            first = false;
+        }
+        out << "\n    ]\n}\n";
+        if (!out) {
+            throw SimulatorException("Could not write cache report " + path);
+        }
+    }
+}
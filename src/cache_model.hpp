@@ -0,0 +1,142 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "elf_file.hpp"
+
+namespace lc32sim {
+    enum class ReplacementPolicy { LRU, FIFO, RANDOM };
+
+    /*!
+     * \brief A set-associative cache that only tracks which lines it holds
+     *
+     * A TLB is modelled as a cache whose lines are pages. Misses always fill
+     * the line, taking an invalid way first and otherwise the one the
+     * replacement policy picks.
+     */
+    class CacheLevel {
+        private:
+            static constexpr uint32_t INVALID = UINT32_MAX;
+            unsigned int ways;
+            unsigned int line_shift;
+            uint32_t set_mask;
+            ReplacementPolicy policy;
+            // Line held by each way, set after set
+            std::vector<uint32_t> tags;
+            // When each way was last used for LRU, or filled for FIFO
+            std::vector<uint64_t> stamps;
+            uint64_t clock = 0;
+            uint32_t random_state = 0x9e3779b9;
+
+        public:
+            const uint64_t size;
+            const unsigned int line_size;
+
+            /*!
+             * \brief Creates an empty cache of `size` bytes
+             * \throws SimulatorException if the sizes are not powers of two,
+             *         or do not divide into a whole number of sets
+             */
+            CacheLevel(uint64_t size, unsigned int ways, unsigned int line_size, ReplacementPolicy policy);
+            unsigned int get_ways() const { return this->ways; }
+            //! The line `addr` falls in, which is what the cache holds
+            uint32_t line(uint32_t addr) const { return addr >> this->line_shift; }
+            //! Looks up the line holding `addr`, filling it on a miss, and returns whether it hit
+            bool access(uint32_t addr);
+    };
+
+    /*!
+     * \brief Runs the program's memory accesses through a cache hierarchy
+     *
+     * Instruction fetches go to an L1 instruction cache, and guest loads and
+     * stores to an L1 data cache. Misses in either go on to a shared L2, and
+     * every access is looked up in a TLB. Writes allocate like reads, and
+     * accesses to I/O space are not cached. Hits and misses are counted per
+     * PC, which adds up to the totals per level and per function.
+     *
+     * Accesses are queued and run through the caches in batches, so the
+     * interpreter and the model each keep their data in the host's caches for
+     * a while. Everything queued has been counted by the time a report is
+     * written.
+     */
+    class CacheModel {
+        public:
+            enum Level { L1I, L1D, L2, TLB, LEVELS };
+            struct Counts {
+                uint64_t accesses[LEVELS] = {};
+                uint64_t misses[LEVELS] = {};
+            };
+
+        private:
+            struct Access {
+                uint32_t pc;
+                uint32_t addr;
+                bool data;
+            };
+            static constexpr size_t BATCH_SIZE = 4096;
+            static constexpr uint32_t NO_LINE = UINT32_MAX;
+
+            std::optional<CacheLevel> levels[LEVELS];
+            std::unique_ptr<Access[]> batch;
+            size_t batched = 0;
+            // A line or page used by the last access cannot have been evicted,
+            // so repeated accesses to it skip the lookup
+            uint32_t last_fetch_line = NO_LINE;
+            uint32_t last_page = NO_LINE;
+
+            // Counts for each halfword of the executable segments, from `base`
+            uint32_t base = 0;
+            uint32_t size = 0;
+            std::vector<Counts> by_pc;
+            // Counts for PCs outside the executable segments
+            Counts elsewhere;
+
+            Counts &counts_for(uint32_t pc) {
+                uint32_t offset = pc - this->base;
+                return offset < this->size ? this->by_pc[offset >> 1] : this->elsewhere;
+            }
+            // Runs the queued accesses through the caches
+            void drain();
+
+        public:
+            /*!
+             * \brief Sets up the caches from the `cache` config
+             * \throws SimulatorException if the configured geometry is invalid
+             */
+            CacheModel(ELFFile &elf);
+
+            //! Queues the fetch of the instruction at `pc`
+            inline void fetch(uint32_t pc) {
+                this->batch[this->batched++] = Access{pc, pc, false};
+                if (this->batched == BATCH_SIZE) [[unlikely]] {
+                    this->drain();
+                }
+            }
+            //! Queues a load or store of `addr` by the instruction at `pc`
+            inline void data(uint32_t pc, uint32_t addr) {
+                this->batch[this->batched++] = Access{pc, addr, true};
+                if (this->batched == BATCH_SIZE) [[unlikely]] {
+                    this->drain();
+                }
+            }
+
+            //! Accesses and misses at each level so far
+            Counts get_totals();
+            //! Forgets the counts so far, but not what the caches hold
+            void clear_counts();
+            //! Writes counts as JSON members, one object per level modelled
+            void write_counts(std::ostream &out, const Counts &counts) const;
+
+            /*!
+             * \brief Writes hits and misses per level, per function, and for
+             *        the PCs with the most misses, as JSON
+             * \throws SimulatorException if the file cannot be written
+             */
+            void write_report(ELFFile &elf, const std::string &path);
+    };
+}
@@ -0,0 +1,368 @@
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "lc32sim.h"
+
+#include "clock.hpp"
+#include "config.hpp"
+#include "dma_controller.hpp"
+#include "elf_file.hpp"
+#include "exceptions.hpp"
+#include "filesystem.hpp"
+#include "hart_control.hpp"
+#include "log.hpp"
+#include "perf_counters.hpp"
+#include "rng.hpp"
+#include "sim.hpp"
+#include "video_timing.hpp"
+
+using lc32sim::Config;
+using lc32sim::config_instance;
+
+struct lc32sim_instance {
+    // Declared first so it outlives the devices referring to it
+    std::unique_ptr<lc32sim::Simulator> sim;
+    std::unique_ptr<lc32sim::VideoTiming> timing;
+};
+
+namespace {
+    thread_local std::string last_error;
+
+    // Guards the process-wide settings shared by every instance
+    std::mutex config_mutex;
+    unsigned int live_instances = 0;
+
+    lc32sim_status fail(const std::string &message) {
+        last_error = message;
+        return LC32SIM_ERROR;
+    }
+
+    // NULL and empty strings both mean "unset"
+    std::string string_or(const char *value, const std::string &fallback) {
+        return value && *value ? std::string(value) : fallback;
+    }
+
+    /*
+     * Runs `body`, turning any exception into an error return. Everything
+     * crossing the C interface goes through this.
+     */
+    template<typename F>
+    lc32sim_status guarded(F &&body) {
+        try {
+            return body();
+        } catch (const std::exception &e) {
+            return fail(e.what());
+        } catch (...) {
+            return fail("Unknown error");
+        }
+    }
+
+    /*
+     * Copies the process-wide fields of `config` into the global `Config`.
+     * Only done while no instances exist, since memory layout and device
+     * timing are read from it as instances run.
+     */
+    void apply_config(const lc32sim_config &config) {
+        // Throws on an invalid level before anything is changed
+        std::string log_level = string_or(config.log_level, config_instance.log_level);
+        lc32sim::logger.initialize(log_level);
+        config_instance.log_level = log_level;
+        config_instance.display.width = config.display_width;
+        config_instance.display.height = config.display_height;
+        config_instance.display.vblank_length = config.vblank_length;
+        config_instance.display.instructions_per_scanline = config.instructions_per_scanline;
+        config_instance.memory.simulator_page_size = config.simulator_page_size;
+        config_instance.memory.user_space_min = config.user_space_min;
+        config_instance.memory.user_space_max = config.user_space_max;
+        config_instance.filesystem.preload_manifest = string_or(config.filesystem_preload_manifest, "");
+        config_instance.console.flush_policy = string_or(config.console_flush_policy, config_instance.console.flush_policy);
+        config_instance.console.capture_file = string_or(config.console_capture_file, "");
+        config_instance.console.input_file = string_or(config.console_input_file, "");
+        // The host owns standard input and the terminal
+        config_instance.console.read_stdin = false;
+        // Embedded instances never have a display to pace against
+        config_instance.display.turbo = true;
+    }
+
+    bool config_matches(const lc32sim_config &config) {
+        return Config.log_level == string_or(config.log_level, Config.log_level)
+            && Config.display.width == config.display_width
+            && Config.display.height == config.display_height
+            && Config.display.vblank_length == config.vblank_length
+            && Config.display.instructions_per_scanline == config.instructions_per_scanline
+            && Config.memory.simulator_page_size == config.simulator_page_size
+            && Config.memory.user_space_min == config.user_space_min
+            && Config.memory.user_space_max == config.user_space_max
+            && Config.filesystem.preload_manifest == string_or(config.filesystem_preload_manifest, "")
+            && Config.console.flush_policy == string_or(config.console_flush_policy, Config.console.flush_policy)
+            && Config.console.capture_file == string_or(config.console_capture_file, "")
+            && Config.console.input_file == string_or(config.console_input_file, "");
+    }
+
+    lc32sim_status check_io_address(uint32_t addr) {
+        if (addr % 4 != 0) {
+            return fail("Callback address is not word-aligned");
+        }
+        if (addr < Config.memory.io_space_min || addr > Config.memory.user_space_max) {
+            return fail("Callback address is not in user-accessible I/O space");
+        }
+        return LC32SIM_OK;
+    }
+}
+
+extern "C" {
+    void lc32sim_config_init(lc32sim_config *config) {
+        if (!config) {
+            return;
+        }
+        // A default-constructed `Config` cannot be made, so restate its defaults
+        *config = lc32sim_config{};
+        config->struct_size = sizeof(lc32sim_config);
+        config->seed = 42;
+        config->log_level = "warn";
+        config->display_width = 640;
+        config->display_height = 480;
+        config->vblank_length = 68;
+        config->instructions_per_scanline = 400;
+        config->simulator_page_size = static_cast<uint64_t>(1) << 12;
+        config->user_space_min = 0x30000000;
+        config->user_space_max = 0xFDFFFFFF;
+        config->filesystem_preload_manifest = nullptr;
+        config->console_flush_policy = "newline";
+        config->console_capture_file = nullptr;
+        config->console_input_file = nullptr;
+    }
+
+    const char *lc32sim_last_error(void) {
+        return last_error.c_str();
+    }
+
+    lc32sim_instance *lc32sim_create(const lc32sim_config *config) {
+        // The layout as of API version 1, the oldest a caller can have
+        constexpr size_t OLDEST_CONFIG_SIZE = offsetof(lc32sim_config, console_input_file) + sizeof(lc32sim_config::console_input_file);
+        lc32sim_config defaults;
+        lc32sim_config_init(&defaults);
+        if (config) {
+            if (config->struct_size < OLDEST_CONFIG_SIZE || config->struct_size > sizeof(lc32sim_config)) {
+                fail("lc32sim_config has the wrong size; fill it in with lc32sim_config_init");
+                return nullptr;
+            }
+            // Fields newer than the caller's header keep their defaults
+            std::memcpy(&defaults, config, config->struct_size);
+            defaults.struct_size = sizeof(lc32sim_config);
+        }
+        config = &defaults;
+
+        std::unique_ptr<lc32sim_instance> instance;
+        lc32sim_status status = guarded([&]() {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            if (live_instances == 0) {
+                apply_config(*config);
+            } else if (!config_matches(*config)) {
+                return fail("Process-wide settings differ from those of the existing instances");
+            }
+
+            instance = std::make_unique<lc32sim_instance>();
+            instance->sim = std::make_unique<lc32sim::Simulator>(config->seed);
+            lc32sim::Simulator &sim = *instance->sim;
+            instance->timing = std::make_unique<lc32sim::VideoTiming>(sim.scheduler);
+            sim.register_io_device(*instance->timing);
+            sim.register_io_device(new lc32sim::DMAController(sim.mem, *instance->timing));
+            sim.register_io_device(new lc32sim::Filesystem(sim.mem));
+            sim.register_io_device(new lc32sim::Clock());
+            sim.register_io_device(new lc32sim::RNG());
+            sim.register_io_device(new lc32sim::PerfCounters(sim, *instance->timing));
+            // Snapshots cannot capture other threads, so embedded programs
+            // get the atomics but only ever one hart
+            sim.register_io_device(new lc32sim::HartControl(sim, 1));
+            live_instances++;
+            return LC32SIM_OK;
+        });
+        if (status != LC32SIM_OK) {
+            return nullptr;
+        }
+        return instance.release();
+    }
+
+    void lc32sim_destroy(lc32sim_instance *sim) {
+        if (!sim) {
+            return;
+        }
+        delete sim;
+        std::lock_guard<std::mutex> lock(config_mutex);
+        live_instances--;
+    }
+
+    lc32sim_status lc32sim_load_elf(lc32sim_instance *sim, const void *data, size_t size) {
+        if (!sim || !data) {
+            return fail("Invalid argument to lc32sim_load_elf");
+        }
+        return guarded([&]() {
+            lc32sim::ELFFile elf(static_cast<const uint8_t*>(data), size);
+            sim->sim->mem.load_elf(elf);
+            sim->sim->pc = elf.get_header().entry;
+            sim->sim->halted = false;
+            sim->sim->fault.reset();
+            return LC32SIM_OK;
+        });
+    }
+
+    lc32sim_status lc32sim_run(lc32sim_instance *sim, uint64_t max_instructions, uint64_t *executed) {
+        if (executed) {
+            *executed = 0;
+        }
+        if (!sim) {
+            return fail("Invalid argument to lc32sim_run");
+        }
+        lc32sim::Simulator &s = *sim->sim;
+        if (s.halted) {
+            return LC32SIM_HALTED;
+        }
+
+        // The budget is just another event that asks the run loop to stop
+        bool budget_reached = false;
+        std::optional<lc32sim::Scheduler::event_id> budget;
+        if (max_instructions != 0) {
+            budget = s.scheduler.schedule(max_instructions, [&]() {
+                budget_reached = true;
+                s.scheduler.stop();
+            });
+        }
+
+        uint64_t start = s.scheduler.now;
+        lc32sim_status status;
+        try {
+            s.run();
+            if (s.fault) {
+                last_error = s.fault->describe();
+                status = LC32SIM_FAULT;
+            } else {
+                status = s.halted ? LC32SIM_HALTED : budget_reached ? LC32SIM_BUDGET_EXHAUSTED : LC32SIM_STOPPED;
+            }
+        } catch (const std::exception &e) {
+            // Guest faults and failed events are recorded, so this is the host failing
+            last_error = e.what();
+            s.fault = lc32sim::Fault{lc32sim::FaultKind::DEVICE_ERROR, s.pc, 0, 0, 0, e.what(), lc32sim::FaultPhase::EVENT};
+            status = LC32SIM_FAULT;
+        } catch (...) {
+            last_error = "Unknown error";
+            s.fault = lc32sim::Fault{lc32sim::FaultKind::DEVICE_ERROR, s.pc, 0, 0, 0, last_error, lc32sim::FaultPhase::EVENT};
+            status = LC32SIM_FAULT;
+        }
+        if (budget && !budget_reached) {
+            s.scheduler.cancel(*budget);
+        }
+        if (status == LC32SIM_FAULT) {
+            s.console.flush();
+        }
+        if (executed) {
+            *executed = s.scheduler.now - start;
+        }
+        return status;
+    }
+
+    lc32sim_status lc32sim_get_fault(const lc32sim_instance *sim, lc32sim_fault *fault) {
+        if (!sim || !fault) {
+            return fail("Invalid argument to lc32sim_get_fault");
+        }
+        const std::optional<lc32sim::Fault> &f = sim->sim->fault;
+        if (!f) {
+            return LC32SIM_OK;
+        }
+        static_assert(static_cast<int>(lc32sim::FaultKind::DEVICE_ERROR) + 1 == LC32SIM_FAULT_DEVICE);
+        fault->kind = static_cast<lc32sim_fault_kind>(static_cast<int>(f->kind) + 1);
+        fault->pc = f->pc;
+        fault->instruction = f->instruction;
+        fault->address = f->addr;
+        static_assert(static_cast<int>(lc32sim::FaultPhase::EVENT) == LC32SIM_PHASE_EVENT);
+        fault->phase = static_cast<lc32sim_fault_phase>(f->phase);
+        return LC32SIM_FAULT;
+    }
+
+    uint64_t lc32sim_instructions_executed(const lc32sim_instance *sim) {
+        return sim ? sim->sim->scheduler.now : 0;
+    }
+
+    lc32sim_status lc32sim_get_register(const lc32sim_instance *sim, unsigned int reg, uint32_t *value) {
+        if (!sim || !value || reg >= 8) {
+            return fail("Invalid argument to lc32sim_get_register");
+        }
+        *value = sim->sim->regs[reg];
+        return LC32SIM_OK;
+    }
+
+    lc32sim_status lc32sim_set_register(lc32sim_instance *sim, unsigned int reg, uint32_t value) {
+        if (!sim || reg >= 8) {
+            return fail("Invalid argument to lc32sim_set_register");
+        }
+        sim->sim->regs[reg] = value;
+        return LC32SIM_OK;
+    }
+
+    uint32_t lc32sim_get_pc(const lc32sim_instance *sim) {
+        return sim ? sim->sim->pc : 0;
+    }
+
+    void lc32sim_set_pc(lc32sim_instance *sim, uint32_t pc) {
+        if (sim) {
+            sim->sim->pc = pc;
+        }
+    }
+
+    lc32sim_status lc32sim_read_memory(lc32sim_instance *sim, uint32_t addr, void *buffer, size_t size) {
+        if (!sim || (!buffer && size)) {
+            return fail("Invalid argument to lc32sim_read_memory");
+        }
+        return guarded([&]() {
+            lc32sim::GuestSpan span = sim->sim->mem.span(addr, size);
+            std::memcpy(buffer, span.data, span.size);
+            return LC32SIM_OK;
+        });
+    }
+
+    lc32sim_status lc32sim_write_memory(lc32sim_instance *sim, uint32_t addr, const void *buffer, size_t size) {
+        if (!sim || (!buffer && size)) {
+            return fail("Invalid argument to lc32sim_write_memory");
+        }
+        return guarded([&]() {
+            lc32sim::GuestSpan span = sim->sim->mem.span(addr, size);
+            std::memcpy(span.data, buffer, span.size);
+            return LC32SIM_OK;
+        });
+    }
+
+    lc32sim_status lc32sim_add_read_callback(lc32sim_instance *sim, uint32_t addr, lc32sim_read_callback callback, void *user) {
+        if (!sim || !callback) {
+            return fail("Invalid argument to lc32sim_add_read_callback");
+        }
+        if (check_io_address(addr) != LC32SIM_OK) {
+            return LC32SIM_ERROR;
+        }
+        return guarded([&]() {
+            sim->sim->mem.add_read_hook(addr, [callback, user, addr](uint32_t val) -> uint32_t {
+                return callback(user, addr, val);
+            });
+            return LC32SIM_OK;
+        });
+    }
+
+    lc32sim_status lc32sim_add_write_callback(lc32sim_instance *sim, uint32_t addr, lc32sim_write_callback callback, void *user) {
+        if (!sim || !callback) {
+            return fail("Invalid argument to lc32sim_add_write_callback");
+        }
+        if (check_io_address(addr) != LC32SIM_OK) {
+            return LC32SIM_ERROR;
+        }
+        return guarded([&]() {
+            sim->sim->mem.add_write_hook(addr, [callback, user, addr](uint32_t old_value, uint32_t value) -> uint32_t {
+                return callback(user, addr, old_value, value);
+            });
+            return LC32SIM_OK;
+        });
+    }
+}
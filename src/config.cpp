@@ -48,6 +48,57 @@ namespace lc32sim {
         if (program["--software-rendering"] == true) {
             this->display.accelerated_rendering = false;
         }
+        if (program["--turbo"] == true) {
+            this->display.turbo = true;
+        }
+        if (auto fast_forward = program.present<double>("--fast-forward")) {
+            this->display.fast_forward = *fast_forward;
+        }
+        if (auto frame_skip = program.present<unsigned int>("--frame-skip")) {
+            this->display.frame_skip = *frame_skip;
+        }
+        if (auto flush_policy = program.present<std::string>("--console-flush")) {
+            this->console.flush_policy = *flush_policy;
+        }
+        if (auto capture_file = program.present<std::string>("--capture-output")) {
+            this->console.capture_file = *capture_file;
+        }
+        if (auto input_file = program.present<std::string>("--input")) {
+            this->console.input_file = *input_file;
+        }
+        if (auto output_file = program.present<std::string>("--metrics")) {
+            this->metrics.output_file = *output_file;
+        }
+        if (auto interval_ms = program.present<unsigned int>("--metrics-interval")) {
+            this->metrics.interval_ms = *interval_ms;
+        }
+        if (auto checkpoint_interval = program.present<uint64_t>("--checkpoint-interval")) {
+            this->reverse.checkpoint_interval = *checkpoint_interval;
+        }
+        if (auto max_memory_mb = program.present<uint64_t>("--reverse-memory")) {
+            this->reverse.max_memory_mb = *max_memory_mb;
+        }
+        if (auto instruction_budget = program.present<uint64_t>("--fuzz-budget")) {
+            this->fuzz.instruction_budget = *instruction_budget;
+        }
+        if (auto output_file = program.present<std::string>("--coverage")) {
+            this->coverage.output_file = *output_file;
+        }
+        if (auto output_file = program.present<std::string>("--cache-report")) {
+            this->cache.output_file = *output_file;
+        }
+        if (auto interval = program.present<uint64_t>("--simpoint-interval")) {
+            this->simpoint.interval = *interval;
+        }
+        if (auto count = program.present<unsigned int>("--harts")) {
+            this->harts.count = *count;
+        }
+        if (auto functions = program.present<std::string>("--hle")) {
+            this->hle.functions = *functions;
+        }
+        if (program["--hle-verify"] == true) {
+            this->hle.verify = true;
+        }
 
         try {
             logger.initialize(log_level);
@@ -56,7 +107,11 @@ namespace lc32sim {
             logger.error << "Invalid log level: " << log_level << ". Using default (" << DEFAULT_LOG_LEVEL << ")";
         }
 
-        (config_error ? logger.error : logger.info) << config_message;
+        if (config_error) {
+            logger.error << config_message;
+        } else {
+            logger.info << config_message;
+        }
         #define log_config(name, description) logger.info << std::boolalpha << "    " << description << ": " << name;
         FOR_EACH_CONFIG_OPTION(log_config);
         #undef log_config
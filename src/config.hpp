@@ -28,6 +28,14 @@ namespace lc32sim {
                 unsigned int instructions_per_scanline = 400;
                 double frames_per_second = 60.0;
                 bool accelerated_rendering = true;
+                // Run as fast as possible instead of locking to `frames_per_second`
+                bool turbo = false;
+                // Present one frame, then skip this many. When zero, frames are
+                // skipped automatically if the host falls behind, or in turbo
+                // mode, whenever the host display is not ready for another one.
+                unsigned int frame_skip = 0;
+                // Multiplier on `frames_per_second` when not in turbo mode
+                double fast_forward = 1.0;
             } display;
 
             struct {
@@ -54,6 +62,160 @@ namespace lc32sim {
                 uint64_t io_space_min = 0xF0000000;
             } memory;
 
+            struct {
+                /*
+                 * Path to a list of host files, one per line, that are read into
+                 * memory at startup. Opening one of them for reading is then
+                 * served from memory without touching the host filesystem.
+                 */
+                std::string preload_manifest = "";
+            } filesystem;
+
+            struct {
+                /*
+                 * Guest output is buffered and written out by a background
+                 * thread. The flush policy decides when: "newline", "size"
+                 * (every `flush_size` bytes), "interval" (every
+                 * `flush_interval_ms`), or "halt" (only when the buffer fills,
+                 * before reading input, and when the program stops).
+                 */
+                std::string flush_policy = "newline";
+                uint64_t buffer_size = (static_cast<uint64_t>(1) << 16);
+                uint64_t flush_size = 4096;
+                unsigned int flush_interval_ms = 50;
+                // Host file that also receives everything the guest prints
+                std::string capture_file = "";
+                // Input script read by GETC, IN, and the console input device
+                // instead of standard input
+                std::string input_file = "";
+                // Whether to read standard input when there is no input
+                // file. Embedded and benchmark instances leave it alone.
+                bool read_stdin = true;
+            } console;
+
+            struct {
+                /*
+                 * JSON file that runtime metrics are written to when the
+                 * program ends, every `interval_ms` if that is non-zero, and
+                 * whenever the process receives SIGUSR1. If empty, SIGUSR1
+                 * writes them to standard error instead.
+                 */
+                std::string output_file = "";
+                unsigned int interval_ms = 0;
+            } metrics;
+
+            struct {
+                /*
+                 * With --reverse, execution is recorded for reverse debugging.
+                 * A checkpoint is taken every `checkpoint_interval`
+                 * instructions, and the oldest ones are dropped to keep the
+                 * recording within `max_memory_mb`. More frequent checkpoints
+                 * make going back faster, at the cost of recording speed.
+                 */
+                uint64_t checkpoint_interval = 1000000;
+                uint64_t max_memory_mb = 1024;
+            } reverse;
+
+            struct {
+                /*
+                 * With --fuzz, a test case that runs for more than
+                 * `instruction_budget` instructions after the program first
+                 * reads input is reported as a hang.
+                 */
+                uint64_t instruction_budget = 10000000;
+            } fuzz;
+
+            struct {
+                /*
+                 * lcov tracefile that source line coverage is written to when
+                 * the program ends. Needs a program built with debug info.
+                 * Coverage is not recorded if empty.
+                 */
+                std::string output_file = "";
+            } coverage;
+
+            struct {
+                /*
+                 * Cycles each kind of instruction adds to the performance
+                 * counter device's cycle count. ALU instructions are the
+                 * arithmetic, logic, and shift ones and LEA. Memory ones are
+                 * the loads and stores. Control ones are branches, jumps,
+                 * subroutine calls, and RTI.
+                 */
+                unsigned int alu_cycles = 1;
+                unsigned int memory_cycles = 2;
+                unsigned int control_cycles = 2;
+                unsigned int trap_cycles = 1;
+            } perf;
+
+            struct {
+                /*
+                 * JSON report of cache and TLB hits and misses, written when
+                 * the program ends. Instruction fetches go through an L1
+                 * instruction cache and loads and stores through an L1 data
+                 * cache, both backed by a shared L2, and every access is
+                 * looked up in a TLB. The model is off if empty.
+                 *
+                 * Sizes are in bytes. Line sizes and the number of sets each
+                 * level ends up with must be powers of two. An L2 size or TLB
+                 * entry count of 0 leaves that level out. The replacement
+                 * policy, used by every level, is "lru", "fifo", or "random".
+                 */
+                std::string output_file = "";
+                uint64_t l1i_size = 16384;
+                unsigned int l1i_ways = 4;
+                unsigned int l1i_line_size = 64;
+                uint64_t l1d_size = 16384;
+                unsigned int l1d_ways = 4;
+                unsigned int l1d_line_size = 64;
+                uint64_t l2_size = 262144;
+                unsigned int l2_ways = 8;
+                unsigned int l2_line_size = 64;
+                unsigned int tlb_entries = 64;
+                unsigned int tlb_ways = 4;
+                unsigned int tlb_page_size = 4096;
+                std::string replacement = "lru";
+                // Number of PCs with the most misses listed in the report
+                unsigned int hot_pcs = 20;
+            } cache;
+
+            struct {
+                /*
+                 * With --simpoint, the program is profiled in intervals of
+                 * `interval` instructions, which are grouped into up to
+                 * `clusters` clusters. One interval from each is run through
+                 * the cache model after `warmup` instructions of warming up
+                 * the caches, `jobs` at a time, or one per host core if 0.
+                 */
+                uint64_t interval = 10000000;
+                unsigned int clusters = 10;
+                uint64_t warmup = 1000000;
+                unsigned int jobs = 0;
+            } simpoint;
+
+            struct {
+                /*
+                 * Most harts that can run at once, counting the one the
+                 * program starts on, or one per host core if 0. Extra harts
+                 * are started through the hart control device, and each runs
+                 * on its own host thread.
+                 */
+                unsigned int count = 0;
+            } harts;
+
+            struct {
+                /*
+                 * Comma-separated libc routines to run natively instead of
+                 * interpreting them, out of memcpy, memmove, memset, memcmp,
+                 * strlen, strcmp, strcpy, and strchr, or "all" of them. They
+                 * are found by name in the program's symbol table. With
+                 * `verify`, the routines are interpreted as usual, and each
+                 * call's result is checked against the native one.
+                 */
+                std::string functions = "";
+                bool verify = false;
+            } hle;
+
             struct {
                 // https://wiki.libsdl.org/SDL2/SDL_Keycode
                 std::string a = "a";
@@ -77,10 +239,53 @@ namespace lc32sim {
         X(display.instructions_per_scanline, "Instructions per scanline") \
         X(display.frames_per_second, "Framerate (FPS)") \
         X(display.accelerated_rendering, "Hardware-accelerated rendering") \
+        X(display.turbo, "Turbo mode") \
+        X(display.frame_skip, "Frame skip") \
+        X(display.fast_forward, "Fast-forward ratio") \
         X(memory.size, "Memory size") \
         X(memory.simulator_page_size, "Simulator page size") \
         X(memory.user_space_min, "User space minimum address") \
         X(memory.user_space_max, "User space maximum address") \
+        X(filesystem.preload_manifest, "Filesystem preload manifest") \
+        X(console.flush_policy, "Console flush policy") \
+        X(console.buffer_size, "Console buffer size") \
+        X(console.flush_size, "Console flush size") \
+        X(console.flush_interval_ms, "Console flush interval (ms)") \
+        X(console.capture_file, "Console capture file") \
+        X(console.input_file, "Console input file") \
+        X(console.read_stdin, "Read console input from standard input") \
+        X(metrics.output_file, "Metrics output file") \
+        X(metrics.interval_ms, "Metrics export interval (ms)") \
+        X(reverse.checkpoint_interval, "Reverse execution checkpoint interval") \
+        X(reverse.max_memory_mb, "Reverse execution memory budget (MiB)") \
+        X(fuzz.instruction_budget, "Fuzzing instruction budget") \
+        X(coverage.output_file, "Coverage report file") \
+        X(perf.alu_cycles, "ALU instruction cycles") \
+        X(perf.memory_cycles, "Memory instruction cycles") \
+        X(perf.control_cycles, "Control instruction cycles") \
+        X(perf.trap_cycles, "TRAP instruction cycles") \
+        X(cache.output_file, "Cache report file") \
+        X(cache.l1i_size, "L1 instruction cache size") \
+        X(cache.l1i_ways, "L1 instruction cache ways") \
+        X(cache.l1i_line_size, "L1 instruction cache line size") \
+        X(cache.l1d_size, "L1 data cache size") \
+        X(cache.l1d_ways, "L1 data cache ways") \
+        X(cache.l1d_line_size, "L1 data cache line size") \
+        X(cache.l2_size, "L2 cache size") \
+        X(cache.l2_ways, "L2 cache ways") \
+        X(cache.l2_line_size, "L2 cache line size") \
+        X(cache.tlb_entries, "TLB entries") \
+        X(cache.tlb_ways, "TLB ways") \
+        X(cache.tlb_page_size, "TLB page size") \
+        X(cache.replacement, "Cache replacement policy") \
+        X(cache.hot_pcs, "Cache report hot PCs") \
+        X(simpoint.interval, "SimPoint interval") \
+        X(simpoint.clusters, "SimPoint clusters") \
+        X(simpoint.warmup, "SimPoint cache warmup") \
+        X(simpoint.jobs, "SimPoint parallel jobs") \
+        X(harts.count, "Maximum harts") \
+        X(hle.functions, "Natively run libc routines") \
+        X(hle.verify, "Verify natively run libc routines") \
         X(keybinds.a, "\"A\" button keybind") \
         X(keybinds.b, "\"B\" button keybind") \
         X(keybinds.select, "\"Select\" button keybind") \
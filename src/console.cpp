@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "console.hpp"
+#include "exceptions.hpp"
+
+namespace lc32sim {
+    namespace {
+        // Terminal settings are process-wide, so the first instance reading
+        // from a terminal saves them and the last one puts them back
+        std::mutex terminal_lock;
+        unsigned int terminal_users = 0;
+        int terminal_fd = -1;
+        struct termios saved_terminal;
+
+        void acquire_terminal(int fd) {
+            std::lock_guard<std::mutex> guard(terminal_lock);
+            if (terminal_users == 0) {
+                if (tcgetattr(fd, &saved_terminal))
+                    throw TerminalConfigurationException("Could not retrieve terminal configuration");
+                struct termios ti = saved_terminal;
+                ti.c_lflag &= ~(ECHO | ICANON);
+                if (tcsetattr(fd, TCSANOW, &ti))
+                    throw TerminalConfigurationException("Could not disable ECHO");
+                // Kept open, since the instance's own descriptor may be closed first
+                terminal_fd = ::dup(fd);
+            }
+            terminal_users++;
+        }
+
+        void release_terminal() {
+            std::lock_guard<std::mutex> guard(terminal_lock);
+            if (--terminal_users > 0) {
+                return;
+            }
+            // Don't fail if this doesn't work - we're dead anyway
+            tcsetattr(terminal_fd, TCSANOW, &saved_terminal);
+            ::close(terminal_fd);
+            terminal_fd = -1;
+        }
+    }
+
+    ConsoleOutput::ConsoleOutput() {
+        const std::string &policy = Config.console.flush_policy;
+        if (policy == "newline") {
+            this->policy = FlushPolicy::NEWLINE;
+        } else if (policy == "size") {
+            this->policy = FlushPolicy::SIZE;
+        } else if (policy == "interval") {
+            this->policy = FlushPolicy::INTERVAL;
+        } else if (policy == "halt") {
+            this->policy = FlushPolicy::HALT;
+        } else {
+            throw SimulatorException("Unknown console flush policy " + policy);
+        }
+        this->flush_size = std::max<uint64_t>(Config.console.flush_size, 1);
+        this->flush_interval = std::chrono::milliseconds(Config.console.flush_interval_ms);
+
+        this->capacity = std::bit_ceil(std::max<uint64_t>(Config.console.buffer_size, 1));
+        this->ring = std::make_unique<char[]>(this->capacity);
+
+        if (!Config.console.capture_file.empty()) {
+            this->capture = fopen(Config.console.capture_file.c_str(), "wb");
+            if (this->capture == nullptr) {
+                throw SimulatorException("Could not open console capture file " + Config.console.capture_file);
+            }
+        }
+
+        this->bytes_written = metrics.counter("console.bytes_written");
+        this->flushes = metrics.counter("console.flushes");
+    }
+
+    ConsoleOutput::~ConsoleOutput() {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->wake_writer.notify_all();
+        if (this->writer.joinable()) {
+            this->writer.join();
+        }
+        if (this->capture) {
+            fclose(this->capture);
+        }
+    }
+
+    void ConsoleOutput::writer_loop() {
+        std::unique_lock<std::mutex> guard(this->lock);
+        auto ready = [this]() {
+            return this->stopping || this->flush_target.load(std::memory_order_acquire) > this->tail.load(std::memory_order_relaxed);
+        };
+        while (true) {
+            if (this->policy == FlushPolicy::INTERVAL) {
+                this->wake_writer.wait_for(guard, this->flush_interval, ready);
+            } else {
+                this->wake_writer.wait(guard, ready);
+            }
+            // The producer is gone once `stopping` is set, so this last drain
+            // picks up everything
+            bool stop = this->stopping;
+            guard.unlock();
+            this->drain();
+            guard.lock();
+            this->drained.notify_all();
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    void ConsoleOutput::drain() {
+        uint64_t start = this->tail.load(std::memory_order_relaxed);
+        uint64_t end = this->head.load(std::memory_order_acquire);
+        if (start == end) {
+            return;
+        }
+        while (start != end) {
+            uint64_t offset = start & (this->capacity - 1);
+            uint64_t len = std::min(end - start, this->capacity - offset);
+            fwrite(this->ring.get() + offset, 1, len, stdout);
+            if (this->capture) {
+                fwrite(this->ring.get() + offset, 1, len, this->capture);
+            }
+            start += len;
+        }
+        fflush(stdout);
+        if (this->capture) {
+            fflush(this->capture);
+        }
+        this->bytes_written.add(end - this->tail.load(std::memory_order_relaxed));
+        this->flushes.add();
+        this->tail.store(end, std::memory_order_release);
+    }
+
+    void ConsoleOutput::request_flush(uint64_t target) {
+        if (target <= this->flush_target.load(std::memory_order_relaxed)) {
+            return;
+        }
+        this->flush_target.store(target, std::memory_order_release);
+        // Taking the lock orders this against the writer checking its
+        // predicate, so the wakeup cannot be lost
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+        }
+        this->wake_writer.notify_one();
+    }
+
+    void ConsoleOutput::wait_for_room(uint64_t position) {
+        this->request_flush(position);
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->drained.wait(guard, [this, position]() {
+            return position - this->tail.load(std::memory_order_acquire) < this->capacity;
+        });
+    }
+
+    void ConsoleOutput::put(char c) {
+        this->write(&c, 1);
+    }
+
+    void ConsoleOutput::write(const char *data, size_t size) {
+        if (this->discarding) {
+            return;
+        }
+        // Simulators that never print, like most embedded and benchmark
+        // instances, never start a writer
+        if (!this->writer.joinable()) [[unlikely]] {
+            this->writer = std::thread(&ConsoleOutput::writer_loop, this);
+        }
+        bool newline = this->policy == FlushPolicy::NEWLINE && std::memchr(data, '\n', size) != nullptr;
+        while (size > 0) {
+            uint64_t h = this->head.load(std::memory_order_relaxed);
+            uint64_t space = this->capacity - (h - this->tail.load(std::memory_order_acquire));
+            if (space == 0) {
+                this->wait_for_room(h);
+                continue;
+            }
+            uint64_t offset = h & (this->capacity - 1);
+            size_t len = std::min<uint64_t>({size, space, this->capacity - offset});
+            std::memcpy(this->ring.get() + offset, data, len);
+            this->head.store(h + len, std::memory_order_release);
+            data += len;
+            size -= len;
+        }
+
+        uint64_t h = this->head.load(std::memory_order_relaxed);
+        if (newline || (this->policy == FlushPolicy::SIZE && h - this->flush_target.load(std::memory_order_relaxed) >= this->flush_size)) {
+            this->request_flush(h);
+        }
+    }
+
+    void ConsoleOutput::flush() {
+        uint64_t h = this->head.load(std::memory_order_relaxed);
+        if (this->tail.load(std::memory_order_acquire) == h) {
+            return;
+        }
+        this->request_flush(h);
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->drained.wait(guard, [this, h]() {
+            return this->tail.load(std::memory_order_acquire) >= h;
+        });
+    }
+
+    void ConsoleOutput::discard() {
+        this->flush();
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+        }
+        this->wake_writer.notify_all();
+        if (this->writer.joinable()) {
+            this->writer.join();
+        }
+        this->discarding = true;
+    }
+
+    ConsoleInput::ConsoleInput() {
+        const std::string &path = Config.console.input_file;
+        if (path.empty() && !Config.console.read_stdin) {
+            this->eof = true;
+            return;
+        } else if (path.empty()) {
+            this->fd = STDIN_FILENO;
+        } else {
+            this->fd = ::open(path.c_str(), O_RDONLY);
+            if (this->fd < 0) {
+                throw SimulatorException("Could not open console input file " + path);
+            }
+            this->owns_fd = true;
+        }
+
+        if (this->read_file()) {
+            return;
+        }
+
+        // GETC and IN assume that characters are not echoed and that input
+        // is not line buffered
+        if (isatty(this->fd)) {
+            acquire_terminal(this->fd);
+            this->terminal = true;
+        }
+    }
+
+    ConsoleInput::~ConsoleInput() {
+        if (this->reader.joinable()) {
+            char c = 0;
+            // Nothing useful can be done if this fails
+            [[maybe_unused]] ssize_t ret = ::write(this->wake_pipe[1], &c, 1);
+            this->reader.join();
+            ::close(this->wake_pipe[0]);
+            ::close(this->wake_pipe[1]);
+        }
+        if (this->terminal) {
+            release_terminal();
+        }
+        if (this->owns_fd) {
+            ::close(this->fd);
+        }
+    }
+
+    bool ConsoleInput::read_file() {
+        struct stat st;
+        if (fstat(this->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        // Input scripts are small, so take them all at once
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::read(this->fd, buf, sizeof(buf))) > 0) {
+            this->queue.insert(this->queue.end(), buf, buf + n);
+        }
+        this->eof = true;
+        return true;
+    }
+
+    void ConsoleInput::rewind() {
+        this->queue.clear();
+        if (this->fd < 0) {
+            // There is no input to read again
+            return;
+        }
+        this->eof = false;
+        if (this->owns_fd) {
+            ::close(this->fd);
+            this->fd = ::open(Config.console.input_file.c_str(), O_RDONLY);
+            if (this->fd < 0) {
+                this->owns_fd = false;
+                throw SimulatorException("Could not open console input file " + Config.console.input_file);
+            }
+        } else {
+            ::lseek(this->fd, 0, SEEK_SET);
+        }
+        this->read_file();
+    }
+
+    void ConsoleInput::start_reader() {
+        if (this->eof || this->reader.joinable()) {
+            return;
+        }
+        if (pipe(this->wake_pipe)) {
+            throw SimulatorException("Could not create console input pipe");
+        }
+        this->reader = std::thread(&ConsoleInput::reader_loop, this);
+    }
+
+    void ConsoleInput::reader_loop() {
+        char buf[4096];
+        while (true) {
+            struct pollfd fds[2] = {
+                { this->fd, POLLIN, 0 },
+                { this->wake_pipe[0], POLLIN, 0 },
+            };
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents) {
+                return;
+            }
+
+            ssize_t n = ::read(this->fd, buf, sizeof(buf));
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (n <= 0) {
+                break;
+            }
+            this->queue.insert(this->queue.end(), buf, buf + n);
+            this->available.notify_all();
+        }
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->eof = true;
+        this->available.notify_all();
+    }
+
+    int ConsoleInput::get() {
+        this->start_reader();
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->available.wait(guard, [this]() { return this->eof || !this->queue.empty(); });
+        if (this->queue.empty()) {
+            return EOF;
+        }
+        unsigned char c = this->queue.front();
+        this->queue.pop_front();
+        return c;
+    }
+
+    std::optional<int> ConsoleInput::try_get() {
+        this->start_reader();
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->queue.empty()) {
+            return std::nullopt;
+        }
+        unsigned char c = this->queue.front();
+        this->queue.pop_front();
+        return c;
+    }
+
+    uint32_t ConsoleInput::status() {
+        this->start_reader();
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (!this->queue.empty()) {
+            return CONSOLE_STATUS_READY;
+        }
+        return this->eof ? CONSOLE_STATUS_EOF : 0;
+    }
+}
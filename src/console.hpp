@@ -0,0 +1,152 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "iodevice.hpp"
+#include "metrics.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Buffered console output drained by a background writer
+     *
+     * The simulator thread is the only producer. Bytes go into a lock-free
+     * single-producer, single-consumer ring, and a writer thread, started on
+     * the first output, copies them to `stdout`, and optionally a capture
+     * file, according to the configured flush policy:
+     *  - `newline`: write out whenever a newline is produced
+     *  - `size`: write out once `flush_size` bytes are waiting
+     *  - `interval`: write out every `flush_interval_ms` milliseconds
+     *  - `halt`: only write out when the ring fills up or on `flush()`
+     */
+    class ConsoleOutput {
+        private:
+            enum class FlushPolicy { NEWLINE, SIZE, INTERVAL, HALT };
+            FlushPolicy policy;
+            uint64_t flush_size;
+            std::chrono::milliseconds flush_interval;
+
+            // Positions only ever increase, and are reduced modulo the
+            // capacity, which is a power of two, when indexing the ring
+            std::unique_ptr<char[]> ring;
+            uint64_t capacity;
+            std::atomic<uint64_t> head = 0; // written by the producer
+            std::atomic<uint64_t> tail = 0; // written by the writer
+            // Everything before this position should be written out promptly
+            std::atomic<uint64_t> flush_target = 0;
+
+            std::thread writer;
+            std::mutex lock;
+            std::condition_variable wake_writer;
+            std::condition_variable drained;
+            bool stopping = false;
+            // Set once output is thrown away, see `discard()`
+            bool discarding = false;
+            FILE *capture = nullptr;
+            Counter bytes_written;
+            Counter flushes;
+
+            void writer_loop();
+            // Writes out everything produced so far; only called by `writer`
+            void drain();
+            void request_flush(uint64_t target);
+            // Blocks until the ring has room past position `position`
+            void wait_for_room(uint64_t position);
+
+        public:
+            ConsoleOutput();
+            ~ConsoleOutput();
+            ConsoleOutput(ConsoleOutput const&) = delete;
+            void operator=(ConsoleOutput const&) = delete;
+
+            void put(char c);
+            void write(const char *data, size_t size);
+            //! Blocks until everything produced so far has been written out
+            void flush();
+            /*!
+             * \brief Writes out what is buffered, then drops all later output
+             *
+             * This also stops the writer thread, so the process can fork.
+             */
+            void discard();
+    };
+
+    /*!
+     * \brief Console input from the terminal, a pipe, or an input script
+     *
+     * Input comes from `console.input_file`, or standard input when that is
+     * empty. A regular file is read in bulk up front. Anything else is read
+     * by a background thread into a queue, which is only started once the
+     * guest first asks for input.
+     *
+     * Besides the blocking `GETC` and `IN` TRAPs, the queue is exposed
+     * through the non-blocking `CONSOLE_STATUS_ADDR` and `CONSOLE_DATA_ADDR`
+     * registers so guests can poll for input.
+     *
+     * The terminal is only switched out of ECHO and ICANON mode when input
+     * actually comes from one. Its settings are saved by the first instance
+     * reading from a terminal and restored by the last. With no input file
+     * and `console.read_stdin` off, there is no input at all.
+     */
+    class ConsoleInput : public IODevice {
+        private:
+            int fd = -1;
+            bool owns_fd = false;
+            bool terminal = false;
+
+            std::thread reader;
+            // Written to by the destructor to wake up `reader`
+            int wake_pipe[2] = {-1, -1};
+            std::mutex lock;
+            std::condition_variable available;
+            std::deque<char> queue;
+            bool eof = false;
+
+            void reader_loop();
+            // Starts `reader` if input has not been read in bulk
+            void start_reader();
+            // Reads all of `fd` into the queue if it is a regular file
+            bool read_file();
+
+        public:
+            ConsoleInput();
+            ~ConsoleInput();
+            ConsoleInput(ConsoleInput const&) = delete;
+            void operator=(ConsoleInput const&) = delete;
+
+            //! Blocks for the next character, returning `EOF` once input runs out
+            int get();
+            //! Returns the next character if one is ready, without blocking
+            std::optional<int> try_get();
+            //! Returns `CONSOLE_STATUS_READY` and `CONSOLE_STATUS_EOF` flags
+            uint32_t status();
+            /*!
+             * \brief Forgets what is queued and reads input from the start again
+             *
+             * Only input files are read again, since they may have been
+             * rewritten; they are reopened if given by path. Must not be
+             * called once input is read in the background.
+             */
+            void rewind();
+
+            std::string get_name() override { return "Console Input"; };
+            read_handlers get_read_handlers() override {
+                return {
+                    { CONSOLE_STATUS_ADDR, [this](uint32_t val) -> uint32_t {
+                        return this->status();
+                    }},
+                    { CONSOLE_DATA_ADDR, [this](uint32_t val) -> uint32_t {
+                        return static_cast<uint32_t>(this->try_get().value_or(EOF));
+                    }},
+                };
+            }
+    };
+}
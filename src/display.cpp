@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <iostream>
 #include <set>
 
@@ -8,7 +9,10 @@
 
 namespace lc32sim {
     Display::Display(uint16_t &scanline) : scanline(scanline) {
-        this->ticks_per_frame = 1000.0 / Config.display.frames_per_second;
+        if (Config.display.fast_forward <= 0) {
+            throw SimulatorException("Fast-forward ratio must be positive");
+        }
+        this->ticks_per_frame = 1000.0 / (Config.display.frames_per_second * Config.display.fast_forward);
 
         int renderer_flags = Config.display.accelerated_rendering ? SDL_RENDERER_ACCELERATED : SDL_RENDERER_SOFTWARE;
         const int window_flags = SDL_WINDOW_ALLOW_HIGHDPI;
@@ -36,6 +40,19 @@ namespace lc32sim {
         SDL_GetRendererOutputSize(this->renderer, &render_width, &render_height);
         SDL_RenderSetScale(renderer, render_width / Config.display.width, render_height / Config.display.height);
 
+        // Used to decide when the host is ready for another frame in turbo mode
+        SDL_DisplayMode mode;
+        int refresh_rate = 60;
+        if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(this->window), &mode) == 0 && mode.refresh_rate > 0) {
+            refresh_rate = mode.refresh_rate;
+        }
+        this->ticks_per_refresh = 1000.0 / refresh_rate;
+        this->stats_start = SDL_GetTicks64();
+        this->frame_time_us = metrics.histogram("display.frame_time_us");
+        this->present_time_us = metrics.histogram("display.present_time_us");
+        this->presented_count = metrics.counter("display.frames_presented");
+        this->skipped_count = metrics.counter("display.frames_skipped");
+
         initialize_key(Config.keybinds.a, 0);
         initialize_key(Config.keybinds.b, 1);
         initialize_key(Config.keybinds.select, 2);
@@ -69,36 +86,98 @@ namespace lc32sim {
         key.map_location = map_location;
     }
 
+    bool Display::should_present(uint64_t now) {
+        if (Config.display.frame_skip > 0) {
+            return this->frames_skipped >= Config.display.frame_skip;
+        }
+        if (this->frames_skipped >= MAX_AUTO_SKIP) {
+            return true;
+        }
+        if (Config.display.turbo) {
+            // Only present once the host display could actually show it
+            return now - this->last_present >= this->ticks_per_refresh;
+        }
+        // Skip if we are already more than a frame late
+        return this->target_time == 0 || now <= this->target_time + this->ticks_per_frame;
+    }
+
+    void Display::update_stats(uint64_t now) {
+        uint64_t elapsed = now - this->stats_start;
+        if (elapsed < 1000) {
+            return;
+        }
+
+        double seconds = elapsed / 1000.0;
+        double instructions_per_frame = static_cast<double>(Config.display.height + Config.display.vblank_length) * Config.display.instructions_per_scanline;
+        double mhz = this->stats_frames * instructions_per_frame / seconds / 1e6;
+        double fps = this->stats_frames / seconds;
+        double presented_fps = this->stats_presented / seconds;
+
+        char title[128];
+        std::snprintf(title, sizeof(title), "LC3.2 Simulator - %.2f MHz, %.1f FPS (%.1f presented)", mhz, fps, presented_fps);
+        SDL_SetWindowTitle(this->window, title);
+        logger.debug << title;
+
+        this->stats_start = now;
+        this->stats_frames = 0;
+        this->stats_presented = 0;
+    }
+
     bool Display::update(Simulator &sim) {
         uint16_t *video_buffer = sim.mem.get_video_buffer();
-        SDL_Event e;
-        if (SDL_PollEvent(&e)) {
-            if (e.type == SDL_QUIT) {
-                SDL_DestroyRenderer(this->renderer);
-                SDL_DestroyWindow(this->window);
-                SDL_Quit();
-                return false;
-            }
+
+        if (scanline == 0) {
+            this->present_frame = this->should_present(SDL_GetTicks64());
         }
 
-        if (scanline < Config.display.height) {
+        if (this->present_frame && scanline < Config.display.height) {
             SDL_Rect line = {0, static_cast<int>(scanline), static_cast<int>(Config.display.width), 1};
             SDL_UpdateTexture(this->texture, &line, video_buffer + scanline * Config.display.width, Config.display.width * sizeof(uint16_t));
         }
 
         if (scanline == Config.display.height - 1) {
-            SDL_RenderCopy(this->renderer, this->texture, nullptr, nullptr);
-            if (this->target_time == 0) {
-                this->target_time = static_cast<double>(SDL_GetTicks());
-                SDL_RenderPresent(this->renderer);
-            } else {
-                uint64_t target_time_int = static_cast<uint64_t>(this->target_time);
-                while (target_time_int > SDL_GetTicks()) {
-                    SDL_Delay(1);
+            SDL_Event e;
+            while (SDL_PollEvent(&e)) {
+                if (e.type == SDL_QUIT) {
+                    SDL_DestroyRenderer(this->renderer);
+                    SDL_DestroyWindow(this->window);
+                    SDL_Quit();
+                    return false;
+                }
+            }
+
+            if (!Config.display.turbo) {
+                if (this->target_time == 0) {
+                    this->target_time = static_cast<double>(SDL_GetTicks64());
+                } else {
+                    uint64_t target_time_int = static_cast<uint64_t>(this->target_time);
+                    while (target_time_int > SDL_GetTicks64()) {
+                        SDL_Delay(1);
+                    }
+                    this->target_time += this->ticks_per_frame;
                 }
+            }
+
+            uint64_t now = SDL_GetTicks64();
+            auto frame_end = std::chrono::steady_clock::now();
+            if (this->present_frame) {
+                SDL_RenderCopy(this->renderer, this->texture, nullptr, nullptr);
                 SDL_RenderPresent(this->renderer);
-                this->target_time += this->ticks_per_frame;
+                this->present_time_us.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - frame_end).count());
+                this->presented_count.add();
+                this->last_present = now;
+                this->frames_skipped = 0;
+                this->stats_presented++;
+            } else {
+                this->skipped_count.add();
+                this->frames_skipped++;
+            }
+            if (this->last_frame_end != std::chrono::steady_clock::time_point()) {
+                this->frame_time_us.record(std::chrono::duration_cast<std::chrono::microseconds>(frame_end - this->last_frame_end).count());
             }
+            this->last_frame_end = frame_end;
+            this->stats_frames++;
+            this->update_stats(now);
         }
         return true;
     }
@@ -1,8 +1,10 @@
 #pragma once
+#include <chrono>
 #include <string>
 
 #include "config.hpp"
 #include "iodevice.hpp"
+#include "metrics.hpp"
 #include "SDL2/SDL.h"
 #include "sim.hpp"
 #include "utils.hpp"
@@ -16,16 +18,37 @@ namespace lc32sim {
     class Display : public IODevice {
         private:
             static const size_t NUM_KEYS = 10;
+            static const unsigned int MAX_AUTO_SKIP = 4;
             uint16_t &scanline;
             double target_time = 0;
             double ticks_per_frame;
+            double ticks_per_refresh;
             Keybind keys[NUM_KEYS];
 
+            // Whether the frame currently being scanned out will be presented
+            bool present_frame = true;
+            unsigned int frames_skipped = 0;
+            uint64_t last_present = 0;
+
+            // Frame statistics for the window title, reset every second
+            uint64_t stats_start = 0;
+            uint64_t stats_frames = 0;
+            uint64_t stats_presented = 0;
+
+            // Host time per guest frame, and per `SDL_RenderPresent`
+            std::chrono::steady_clock::time_point last_frame_end;
+            Histogram frame_time_us;
+            Histogram present_time_us;
+            Counter presented_count;
+            Counter skipped_count;
+
             SDL_Renderer *renderer = nullptr;
             SDL_Window *window = nullptr;
             SDL_Texture *texture = nullptr;
 
             void initialize_key(std::string key_name, size_t map_location);
+            bool should_present(uint64_t now);
+            void update_stats(uint64_t now);
         public:
             Display(uint16_t &scanline);
             bool update(Simulator &sim);
@@ -33,9 +56,6 @@ namespace lc32sim {
             // IODevice methods
             std::string get_name() override { return "SDL2 Display"; };
             read_handlers get_read_handlers() override { return {
-                { REG_VCOUNT_ADDR, [this](uint32_t val) -> uint32_t {
-                    return this->scanline;
-                }},
                 { REG_KEYINPUT_ADDR, [this](uint32_t val) -> uint32_t {
                     uint32_t keyinput = 0;
                     const uint8_t *keystate = SDL_GetKeyboardState(nullptr);
@@ -1,15 +1,32 @@
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <utility>
 
 #include "config.hpp"
 #include "exceptions.hpp"
 #include "iodevice.hpp"
+#include "log.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
+#include "video_timing.hpp"
 
 namespace lc32sim {
     class DMAController : public IODevice {
         private:
             Memory &mem;
             bool dma_on = false;
+            Counter transfers;
+            Counter bytes;
+
+            // Transfer waiting on a video timing signal, if any
+            struct {
+                bool armed = false;
+                uint32_t source;
+                uint32_t dest;
+                uint32_t dest_start;
+                uint32_t control;
+            } pending;
 
             static const uint32_t DMA_DESTINATION = 3_u32 << 21;
             static const uint32_t DMA_DESTINATION_INCREMENT = 0_u32 << 21;
@@ -39,132 +56,205 @@ namespace lc32sim {
 
             static const uint32_t DMA_NUM_TRANSFERS = 0xFFFF_u32;
 
-            forceinline void handle_dma(uint32_t source, uint32_t dest, uint32_t control) {
-                if ((control & DMA_TIMING) != DMA_NOW) {
-                    throw SimulatorException("DMA timing besides DMA_NOW not implemented");
+            // Half-open range of bytes touched by `num` transfers of `T`
+            // starting at `addr` and stepping by `increment`
+            template<typename T>
+            static std::pair<uint32_t, uint64_t> transfer_range(uint32_t addr, uint32_t num, int increment) {
+                if (increment > 0) {
+                    return {addr, static_cast<uint64_t>(addr) + num * sizeof(T)};
+                } else if (increment < 0) {
+                    return {addr - (num - 1) * sizeof(T), static_cast<uint64_t>(addr) + sizeof(T)};
+                } else {
+                    return {addr, static_cast<uint64_t>(addr) + sizeof(T)};
+                }
+            }
+
+            /*
+             * Copies `num` elements of `T`, with the same result as doing them
+             * one at a time.
+             *
+             * Whenever neither range touches an MMIO hook, the transfer is
+             * done in bulk directly on the backing store. Increment-increment
+             * and decrement-decrement become a `memmove`, a fixed source
+             * becomes a fill, and mixed directions become a reversed copy.
+             * Overlaps where element-wise order would give a different result
+             * from a block copy fall back to a raw element loop.
+             */
+            template<typename T>
+            forceinline void transfer(uint32_t &source, uint32_t &dest, uint32_t num, int source_increment, int destination_increment) {
+                if (num == 0) {
+                    return;
+                }
+                if (source_increment < 0 && source < (num - 1) * sizeof(T)) {
+                    throw SimulatorException("DMA_SOURCE_DECREMENT hits start of memory");
+                }
+                if (destination_increment < 0 && dest < (num - 1) * sizeof(T)) {
+                    throw SimulatorException("DMA_DESTINATION_DECREMENT hits start of memory");
+                }
+                auto [src_lo, src_hi] = transfer_range<T>(source, num, source_increment);
+                auto [dst_lo, dst_hi] = transfer_range<T>(dest, num, destination_increment);
+                if (src_hi > Config.memory.size) {
+                    throw SimulatorException("DMA source hits end of memory");
                 }
-                if (control & DMA_IRQ) {
-                    throw SimulatorException("DMA_IRQ not implemented");
+                if (dst_hi > Config.memory.size) {
+                    throw SimulatorException("DMA destination hits end of memory");
                 }
+                // DMA reaches all of memory, not just user space, so this
+                // only initializes the pages of both ranges
+                GuestSpan src = this->mem.device_span(src_lo, src_hi - src_lo);
+                GuestSpan dst = this->mem.device_span(dst_lo, dst_hi - dst_lo);
+                bool aligned = source % sizeof(T) == 0 && dest % sizeof(T) == 0;
+
+                if (!aligned || src.hooked || dst.hooked) {
+                    for (uint32_t i = 0; i < num; i++) {
+                        T tmp = this->mem.read<T, true>(source);
+                        this->mem.write<T, true>(dest, tmp);
+
+                        source += source_increment;
+                        dest += destination_increment;
+                    }
+                    return;
+                }
+
+                bool overlap = src_lo < dst_hi && dst_lo < src_hi;
+                T *src_ptr = reinterpret_cast<T*>(src.data);
+                T *dst_ptr = reinterpret_cast<T*>(dst.data);
+                if (source_increment == 0) {
+                    T val = *this->mem.ptr_to<T>(source);
+                    std::fill_n(dst_ptr, destination_increment == 0 ? 1 : num, val);
+                } else if (source_increment == destination_increment && (!overlap || (source_increment > 0 ? dst_lo <= src_lo : dst_lo >= src_lo))) {
+                    std::memmove(dst_ptr, src_ptr, num * sizeof(T));
+                } else if (!overlap && destination_increment == 0) {
+                    // Only the last element survives
+                    *dst_ptr = source_increment > 0 ? src_ptr[num - 1] : src_ptr[0];
+                } else if (!overlap) {
+                    std::reverse_copy(src_ptr, src_ptr + num, dst_ptr);
+                } else {
+                    for (uint32_t i = 0; i < num; i++) {
+                        *this->mem.ptr_to<T>(dest + i * destination_increment) = *this->mem.ptr_to<T>(source + i * source_increment);
+                    }
+                }
+                source += num * source_increment;
+                dest += num * destination_increment;
+            }
+
+            // Advances `source` and `dest` past the transfer
+            forceinline void handle_dma(uint32_t &source, uint32_t &dest, uint32_t control) {
                 if ((control & DMA_DESTINATION) == DMA_DESTINATION_RESET) {
-                    // Since DMA_TIMING_(H|V)BLANK are not implemented,
-                    // these are equivalent
+                    // Resetting is handled by the caller between repeats
                     control &= ~DMA_DESTINATION;
                     control |= DMA_DESTINATION_INCREMENT;
                 }
 
                 uint32_t num_transfers = control & DMA_NUM_TRANSFERS;
-                uint32_t transfer_size = ((control & DMA_WIDTH) == DMA_32 ? 4 : 2);
-                uint32_t total_size = num_transfers * transfer_size;
+                int transfer_size = ((control & DMA_WIDTH) == DMA_32 ? 4 : 2);
 
                 int source_increment = 0;
-                int destination_increment = 0;
-
-                // Ensure all source pages are initialized
-                uint32_t start_page = source / Config.memory.simulator_page_size;
                 if ((control & DMA_SOURCE) == DMA_SOURCE_INCREMENT) {
-                    if ((Config.memory.size - source) < total_size) {
-                        throw SimulatorException("DMA_SOURCE_INCREMENT hits end of memory");
-                    }
-                    uint32_t end_page = (source + total_size) / Config.memory.simulator_page_size;
-                    for (uint32_t page = start_page; page <= end_page; page++) {
-                        if (!this->mem.page_initialized[page]) {
-                            this->mem.init_page(page);
-                        }
-                    }
                     source_increment = transfer_size;
                 } else if ((control & DMA_SOURCE) == DMA_SOURCE_DECREMENT) {
-                    if (source < total_size) {
-                        throw SimulatorException("DMA_SOURCE_DECREMENT hits start of memory");
-                    }
-                    uint32_t end_page = (source - total_size) / Config.memory.simulator_page_size;
-                    for (uint32_t page = start_page; page >= end_page; page--) {
-                        if (!this->mem.page_initialized[page]) {
-                            this->mem.init_page(page);
-                        }
-                    }
                     source_increment = -transfer_size;
-                } else if ((control & DMA_SOURCE) == DMA_SOURCE_FIXED) {
-                    if (!this->mem.page_initialized[start_page]) {
-                        this->mem.init_page(start_page);
-                    }   
-                } else {
+                } else if ((control & DMA_SOURCE) != DMA_SOURCE_FIXED) {
                     throw SimulatorException("DMA_SOURCE invalid");
                 }
 
-                // Ensure all destination pages are initialized
-                start_page = dest / Config.memory.simulator_page_size;
+                int destination_increment = 0;
                 if ((control & DMA_DESTINATION) == DMA_DESTINATION_INCREMENT) {
-                    if ((Config.memory.size - dest) < total_size) {
-                        throw SimulatorException("DMA_DESTINATION_INCREMENT hits end of memory");
-                    }
-                    uint32_t end_page = (dest + total_size) / Config.memory.simulator_page_size;
-                    for (uint32_t page = start_page; page <= end_page; page++) {
-                        if (!this->mem.page_initialized[page]) {
-                            this->mem.init_page(page);
-                        }
-                    }
                     destination_increment = transfer_size;
                 } else if ((control & DMA_DESTINATION) == DMA_DESTINATION_DECREMENT) {
-                    if (dest < total_size) {
-                        throw SimulatorException("DMA_DESTINATION_DECREMENT hits start of memory");
-                    }
-                    uint32_t end_page = (dest - total_size) / Config.memory.simulator_page_size;
-                    for (uint32_t page = start_page; page >= end_page; page--) {
-                        if (!this->mem.page_initialized[page]) {
-                            this->mem.init_page(page);
-                        }
-                    }
                     destination_increment = -transfer_size;
-                } else if ((control & DMA_DESTINATION) == DMA_DESTINATION_FIXED) {
-                    if (!this->mem.page_initialized[start_page]) {
-                        this->mem.init_page(start_page);
-                    }   
-                } else {
+                } else if ((control & DMA_DESTINATION) != DMA_DESTINATION_FIXED) {
                     throw SimulatorException("DMA_DESTINATION invalid");
                 }
 
+                this->transfers.add();
+                this->bytes.add(static_cast<uint64_t>(num_transfers) * transfer_size);
                 if ((control & DMA_WIDTH) == DMA_16) {
-                    for (uint32_t i = 0; i < num_transfers; i++) {
-                        uint16_t tmp = this->mem.read<uint16_t, true>(source);
-                        this->mem.write<uint16_t, true>(dest, tmp);
-
-                        source += source_increment;
-                        dest += destination_increment;
-                    }
+                    transfer<uint16_t>(source, dest, num_transfers, source_increment, destination_increment);
                 } else if ((control & DMA_WIDTH) == DMA_32) {
-                    for (uint32_t i = 0; i < num_transfers; i++) {
-                        uint32_t tmp = this->mem.read<uint32_t, true>(source);
-                        this->mem.write<uint32_t, true>(dest, tmp);
-
-                        source += source_increment;
-                        dest += destination_increment;
-                    }
+                    transfer<uint32_t>(source, dest, num_transfers, source_increment, destination_increment);
                 } else {
                     throw SimulatorException("DMA_WIDTH invalid");
                 }
             }
 
+            // Runs the pending transfer if it is waiting on `timing`
+            void trigger(uint32_t timing) {
+                if (!this->pending.armed || (this->pending.control & DMA_TIMING) != timing) {
+                    return;
+                }
+                if ((this->pending.control & DMA_DESTINATION) == DMA_DESTINATION_RESET) {
+                    this->pending.dest = this->pending.dest_start;
+                }
+                handle_dma(this->pending.source, this->pending.dest, this->pending.control);
+
+                if (!(this->pending.control & DMA_REPEAT)) {
+                    // Clear DMA_ON so the guest can see that the transfer ran
+                    this->pending.armed = false;
+                    uint32_t control = this->pending.control & ~DMA_ON;
+                    if constexpr (std::endian::native == std::endian::big) {
+                        control = std::byteswap(control);
+                    }
+                    *this->mem.ptr_to<uint32_t>(DMA_CONTROLLER_ADDR + 8) = control;
+                }
+            }
+
         public:
-            DMAController(Memory &mem) : mem(mem) {}
+            DMAController(Memory &mem, VideoTiming &timing) : mem(mem), transfers(metrics.counter("dma.transfers")), bytes(metrics.counter("dma.bytes")) {
+                timing.on_hblank.push_back([this]() { this->trigger(DMA_AT_HBLANK); });
+                timing.on_vblank.push_back([this]() { this->trigger(DMA_AT_VBLANK); });
+                timing.on_frame.push_back([this]() { this->trigger(DMA_AT_REFRESH); });
+            }
             
             std::string get_name() override {
                 return "DMA Controller";
             }
 
+            bool replayable() override { return true; }
+            std::any save_state() override {
+                return this->pending;
+            }
+            void restore_state(const std::any &state) override {
+                this->pending = std::any_cast<decltype(this->pending)>(state);
+            }
+
             write_handlers get_write_handlers() override {
                 return {
                     {DMA_CONTROLLER_ADDR + 8, [this](uint32_t old_value, uint32_t value) {
+                        // Writing the control register always replaces
+                        // whatever transfer was waiting
+                        this->pending.armed = false;
+
                         if ((value & DMA_ON) && !dma_on) {
-                            dma_on = true;
+                            if (value & DMA_IRQ) {
+                                // There is no interrupt controller in a user-mode
+                                // simulator, so completion is only visible by
+                                // polling DMA_ON
+                                static bool warned = false;
+                                if (!warned) {
+                                    logger.warn << "DMA_IRQ requested, but interrupts are not simulated";
+                                    warned = true;
+                                }
+                            }
+
                             uint32_t source = this->mem.read<uint32_t, true>(DMA_CONTROLLER_ADDR);
                             uint32_t dest = this->mem.read<uint32_t, true>(DMA_CONTROLLER_ADDR + 4);
 
-                            handle_dma(source, dest, value);
+                            if ((value & DMA_TIMING) != DMA_NOW) {
+                                // Keep DMA_ON set until the transfer has run
+                                this->pending.armed = true;
+                                this->pending.source = source;
+                                this->pending.dest = dest;
+                                this->pending.dest_start = dest;
+                                this->pending.control = value;
+                                return value;
+                            }
 
+                            dma_on = true;
+                            handle_dma(source, dest, value);
                             dma_on = false;
                         }
-                        return 0;
+                        return 0_u32;
                     }}
                 };
             }
@@ -5,12 +5,15 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <sstream>
 
 namespace lc32sim {
     // TODO: investigate potential performance improvement by using mmap()
     template <typename T, bool reverse> T ELFFile::read() {
         char buf[sizeof(T)];
-        file.read(buf, sizeof(T));
+        if (!file->read(buf, sizeof(T))) {
+            throw ELFParsingException("Unexpected end of ELF file");
+        }
         if constexpr (reverse) {
             std::reverse(buf, buf + sizeof(T));
         }
@@ -18,11 +21,20 @@ namespace lc32sim {
     }
 
     ELFFile::ELFFile(const std::string& filename) {
-        file.open(filename, std::ios_base::in | std::ios::binary);
-        if (!file.is_open()) {
+        auto stream = std::make_unique<std::ifstream>(filename, std::ios_base::in | std::ios::binary);
+        if (!stream->is_open()) {
             throw ELFParsingException("File " + filename + " does not exist");
         }
+        file = std::move(stream);
+        parse();
+    }
 
+    ELFFile::ELFFile(const uint8_t *data, size_t size) {
+        file = std::make_unique<std::istringstream>(std::string(reinterpret_cast<const char*>(data), size), std::ios_base::in | std::ios::binary);
+        parse();
+    }
+
+    void ELFFile::parse() {
         // Read header
         struct elf32_ident {
             uint8_t magic[4];
@@ -88,7 +100,7 @@ namespace lc32sim {
 
         // Read program headers
         ph = std::make_unique<elf32_program_header[]>(eh.phnum);
-        file.seekg(eh.phoff, std::ios::beg);
+        file->seekg(eh.phoff, std::ios::beg);
         std::streamoff phentsize_diff = eh.phentsize - sizeof(elf32_program_header);
         for (uint16_t i = 0; i < eh.phnum; i++) {
             if (reverse) {
@@ -96,15 +108,110 @@ namespace lc32sim {
             } else {
                 ph[i] = read<elf32_program_header, false>();
             }
-            file.seekg(phentsize_diff, std::ios::cur);
+            file->seekg(phentsize_diff, std::ios::cur);
         }
+
+        parse_sections();
     }
-    ELFFile::~ELFFile() {
-        file.close();
+
+    void ELFFile::parse_sections() {
+        // Section headers are optional in executables
+        if (eh.shoff == 0 || eh.shnum == 0) {
+            return;
+        }
+        sh.resize(eh.shnum);
+        file->seekg(eh.shoff, std::ios::beg);
+        std::streamoff shentsize_diff = eh.shentsize - sizeof(elf32_section_header);
+        for (uint16_t i = 0; i < eh.shnum; i++) {
+            if (reverse) {
+                sh[i] = read<elf32_section_header, true>();
+            } else {
+                sh[i] = read<elf32_section_header, false>();
+            }
+            file->seekg(shentsize_diff, std::ios::cur);
+        }
+
+        // Names are offsets into the section header string table
+        section_names.resize(eh.shnum);
+        if (eh.shstrndx == 0 || eh.shstrndx >= eh.shnum) {
+            return;
+        }
+        const elf32_section_header &strtab = sh[eh.shstrndx];
+        std::string names(strtab.size, '\0');
+        read_chunk(reinterpret_cast<uint8_t*>(names.data()), strtab.offset, strtab.size);
+        for (uint16_t i = 0; i < eh.shnum; i++) {
+            if (sh[i].name >= names.size()) {
+                throw ELFParsingException("Section name offset " + std::to_string(sh[i].name) + " is past the end of the string table");
+            }
+            section_names[i] = names.c_str() + sh[i].name;
+        }
+    }
+
+    ELFFile::~ELFFile() {}
+
+    std::optional<std::vector<uint8_t>> ELFFile::read_section(const std::string &name) {
+        for (size_t i = 0; i < sh.size(); i++) {
+            if (section_names[i] != name) {
+                continue;
+            }
+            std::vector<uint8_t> contents(sh[i].type == SECTION_NOBITS ? 0 : sh[i].size);
+            read_chunk(contents.data(), sh[i].offset, contents.size());
+            return contents;
+        }
+        return std::nullopt;
+    }
+
+    std::vector<elf_symbol> ELFFile::get_function_symbols() {
+        std::vector<elf_symbol> symbols;
+        for (size_t i = 0; i < sh.size(); i++) {
+            if (sh[i].type != SECTION_SYMTAB || sh[i].link >= sh.size()) {
+                continue;
+            }
+            // Symbol names are offsets into the linked string table
+            const elf32_section_header &strtab = sh[sh[i].link];
+            std::string names(strtab.size, '\0');
+            read_chunk(reinterpret_cast<uint8_t*>(names.data()), strtab.offset, strtab.size);
+            std::vector<uint8_t> table(sh[i].size);
+            read_chunk(table.data(), sh[i].offset, sh[i].size);
+
+            auto word = [&](size_t pos) {
+                uint32_t value;
+                std::copy(&table[pos], &table[pos] + 4, reinterpret_cast<uint8_t*>(&value));
+                return reverse ? std::byteswap(value) : value;
+            };
+            // name, value, size, info, other, and section index
+            const size_t SYMBOL_SIZE = 16;
+            for (size_t pos = 0; pos + SYMBOL_SIZE <= table.size(); pos += SYMBOL_SIZE) {
+                uint32_t name = word(pos);
+                if ((table[pos + 12] & 0xf) != SYMBOL_FUNCTION || name >= names.size()) {
+                    continue;
+                }
+                symbols.push_back(elf_symbol{names.c_str() + name, word(pos + 4), word(pos + 8)});
+            }
+        }
+        std::sort(symbols.begin(), symbols.end(), [](const elf_symbol &a, const elf_symbol &b) { return a.value < b.value; });
+        return symbols;
     }
 
     void ELFFile::read_chunk(uint8_t *buf, uint32_t offset, uint32_t size) {
-        file.seekg(offset, std::ios::beg);
-        file.read(reinterpret_cast<char*>(buf), size);
+        file->seekg(offset, std::ios::beg);
+        if (!file->read(reinterpret_cast<char*>(buf), size)) {
+            throw ELFParsingException("Segment extends past the end of the ELF file");
+        }
+    }
+
+    std::pair<uint32_t, uint32_t> ELFFile::get_executable_range() const {
+        uint64_t start = UINT64_MAX, end = 0;
+        for (uint16_t i = 0; i < eh.phnum; i++) {
+            const elf32_program_header &ph = this->ph[i];
+            if (ph.type == segment_type::LOADABLE && (ph.flags & SEGMENT_EXECUTABLE) && ph.memsz > 0) {
+                start = std::min<uint64_t>(start, ph.vaddr);
+                end = std::max<uint64_t>(end, static_cast<uint64_t>(ph.vaddr) + ph.memsz);
+            }
+        }
+        if (start >= end) {
+            return {0, 0};
+        }
+        return {static_cast<uint32_t>(start), static_cast<uint32_t>(std::min<uint64_t>(end - start, UINT32_MAX))};
     }
-}
\ No newline at end of file
+}
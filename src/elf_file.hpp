@@ -2,7 +2,10 @@
 #include <bit>
 #include <fstream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace lc32sim {
     static_assert(std::endian::native == std::endian::little || std::endian::native == std::endian::big, "mixed-endian architectures are not supported");
@@ -74,16 +77,48 @@ namespace lc32sim {
         uint32_t align;
     }__attribute__((packed, aligned(4)));
     static_assert(sizeof(elf32_program_header) == 32, "elf32_program_header is not 32 bytes");
+    // Segment permission flags
+    const uint32_t SEGMENT_EXECUTABLE = 0x1;
+    struct elf32_section_header {
+        uint32_t name;
+        uint32_t type;
+        uint32_t flags;
+        uint32_t addr;
+        uint32_t offset;
+        uint32_t size;
+        uint32_t link;
+        uint32_t info;
+        uint32_t addralign;
+        uint32_t entsize;
+    }__attribute__((packed, aligned(4)));
+    static_assert(sizeof(elf32_section_header) == 40, "elf32_section_header is not 40 bytes");
+    // Sections of this type take up no space in the file
+    const uint32_t SECTION_NOBITS = 0x8;
+    const uint32_t SECTION_SYMTAB = 0x2;
+    // Symbol type, in the low nibble of a symbol's info byte
+    const uint8_t SYMBOL_FUNCTION = 0x2;
+    struct elf_symbol {
+        std::string name;
+        uint32_t value;
+        uint32_t size;
+    };
     class ELFFile {
         private:
             bool reverse;
             elf32_header eh;
-            std::ifstream file;
+            // Either a file on disk or an in-memory image
+            std::unique_ptr<std::istream> file;
             std::unique_ptr<elf32_program_header[]> ph;
+            std::vector<elf32_section_header> sh;
+            std::vector<std::string> section_names;
             template <typename T, bool reverse> T read();
+            void parse();
+            void parse_sections();
 
         public:
             ELFFile(const std::string& filename);
+            //! Parses an ELF image held in memory, which is copied
+            ELFFile(const uint8_t *data, size_t size);
             ~ELFFile();
             void read_chunk(uint8_t *buf, uint32_t offset, uint32_t size);
             inline const elf32_header &get_header() const { return eh; }
@@ -92,5 +127,24 @@ namespace lc32sim {
                     throw std::out_of_range("program header index out of range");
                 return ph[i];
             }
+            //! Whether multi-byte values in the file need their bytes swapped
+            inline bool byte_swapped() const { return reverse; }
+            inline size_t get_section_count() const { return sh.size(); }
+            inline const elf32_section_header &get_section_header(size_t i) const {
+                if (i >= sh.size())
+                    throw std::out_of_range("section header index out of range");
+                return sh[i];
+            }
+            inline const std::string &get_section_name(size_t i) const {
+                if (i >= sh.size())
+                    throw std::out_of_range("section header index out of range");
+                return section_names[i];
+            }
+            //! Returns the contents of the named section, if there is one
+            std::optional<std::vector<uint8_t>> read_section(const std::string &name);
+            //! Returns the function symbols in `.symtab`, sorted by address
+            std::vector<elf_symbol> get_function_symbols();
+            //! Returns the start and size of the range spanned by the executable segments, with a size of 0 if there are none
+            std::pair<uint32_t, uint32_t> get_executable_range() const;
     };
 }
\ No newline at end of file
@@ -21,9 +21,11 @@ namespace lc32sim {
     };
     class UnalignedMemoryAccessException : public SimulatorException {
         public:
+            const uint32_t addr;
+            const int alignment;
             UnalignedMemoryAccessException(uint32_t addr, int alignment) : SimulatorException(
                 "Address 0x" + int_to_hex(addr) + " is not " + std::to_string(alignment) + "-byte aligned"
-            ) {}
+            ), addr(addr), alignment(alignment) {}
     };
     class ELFParsingException : public std::runtime_error {
         public:
@@ -54,8 +56,15 @@ namespace lc32sim {
 
     class SegmentationFaultException : public SimulatorException {
         public:
+            const uint32_t addr;
             SegmentationFaultException(uint32_t addr) : SimulatorException(
                 "Segmentation fault at address 0x" + int_to_hex(addr)
-            ) {}
+            ), addr(addr) {}
+    };
+
+    //! Thrown when the program executes the `CRASH` TRAP
+    class CrashTrapException : public SimulatorException {
+        public:
+            CrashTrapException() : SimulatorException("simulate(): encountered CRASH") {}
     };
 }
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "exceptions.hpp"
+
+namespace lc32sim {
+    enum class FaultKind : uint8_t {
+        // An access outside user space
+        SEGMENTATION_FAULT,
+        // An access not aligned to its size
+        UNALIGNED_ACCESS,
+        // The `CRASH` TRAP
+        CRASH,
+        // `RTI`, an unknown TRAP vector, or an unknown instruction
+        ILLEGAL_INSTRUCTION,
+        // A device or TRAP failed while the instruction used it
+        DEVICE_ERROR,
+    };
+
+    //! When a fault was taken
+    enum class FaultPhase : uint8_t {
+        // While executing the instruction at the PC
+        EXECUTE,
+        // While fetching the instruction at the PC
+        FETCH,
+        // In a scheduled device event, before the instruction at the PC
+        EVENT,
+    };
+
+    /*!
+     * \brief A fault taken by a guest instruction
+     *
+     * The instruction does not complete: registers, condition codes, and the
+     * PC are left as they were before it, and its store, if any, is dropped.
+     * Device accesses it made before faulting still happened.
+     */
+    struct Fault {
+        FaultKind kind;
+        // Address of the faulting instruction
+        uint32_t pc;
+        // The instruction, or 0 if it was never fetched
+        uint16_t instruction;
+        // Address accessed, for segmentation faults and unaligned accesses
+        uint32_t addr = 0;
+        // Size of the access, for unaligned accesses
+        uint8_t size = 0;
+        // What failed, for illegal instructions and device errors
+        std::string message = "";
+        FaultPhase phase = FaultPhase::EXECUTE;
+
+        //! Describes the fault the way the equivalent exception would
+        std::string describe() const {
+            switch (this->kind) {
+                case FaultKind::SEGMENTATION_FAULT:
+                    return SegmentationFaultException(this->addr).what();
+                case FaultKind::UNALIGNED_ACCESS:
+                    return UnalignedMemoryAccessException(this->addr, this->size).what();
+                case FaultKind::CRASH:
+                    return CrashTrapException().what();
+                default:
+                    return this->message;
+            }
+        }
+    };
+}
@@ -1,16 +1,185 @@
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
 
+#include "config.hpp"
+#include "exceptions.hpp"
 #include "filesystem.hpp"
+#include "log.hpp"
 
 namespace lc32sim {
+    Filesystem::Filesystem(Memory &mem) : file_table(), mem(mem) {
+        const char *names[] = {"off", "open", "close", "read", "write", "seek", "mmap", "munmap"};
+        for (uint16_t mode = MODE_OPEN; mode <= MODE_MUNMAP; mode++) {
+            std::string prefix = std::string("filesystem.") + names[mode];
+            this->operation_metrics[mode] = {metrics.counter(prefix + ".count"), metrics.histogram(prefix + ".latency_ns")};
+        }
+        if (!Config.filesystem.preload_manifest.empty()) {
+            this->preload(Config.filesystem.preload_manifest);
+        }
+    }
+
+    void Filesystem::preload(const std::string &manifest) {
+        std::ifstream list(manifest);
+        if (!list.is_open()) {
+            throw SimulatorException("Could not open preload manifest " + manifest);
+        }
+
+        // One path per line; blank lines and lines starting with '#' are skipped
+        std::string path;
+        size_t total = 0;
+        while (std::getline(list, path)) {
+            if (path.empty() || path[0] == '#') {
+                continue;
+            }
+            std::ifstream in(path, std::ios::in | std::ios::binary);
+            if (!in.is_open()) {
+                throw SimulatorException("Could not open preloaded file " + path);
+            }
+            auto contents = std::make_shared<std::vector<uint8_t>>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            total += contents->size();
+            this->preloaded[path] = std::move(contents);
+        }
+        logger.info << "Preloaded " << this->preloaded.size() << " files (" << total << " bytes) from " << manifest;
+    }
+
+    sim_fd Filesystem::allocate_fd(File file) {
+        if (!this->free_fds.empty()) {
+            sim_fd fd = this->free_fds.back();
+            this->free_fds.pop_back();
+            this->file_table[fd - 1] = std::move(file);
+            return fd;
+        }
+        if (this->file_table.size() >= std::numeric_limits<sim_fd>::max()) {
+            if (file.f) {
+                fclose(file.f);
+            }
+            return 0;
+        }
+        this->file_table.push_back(std::move(file));
+        return this->file_table.size();
+    }
+
+    Filesystem::~Filesystem() {
+        if (this->worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->stopping = true;
+            }
+            this->cv.notify_all();
+            this->worker.join();
+        }
+    }
+
+    void Filesystem::check_buffers(uint16_t mode, uint32_t data1, uint32_t data2, uint32_t data3) {
+        switch (mode) {
+            case MODE_OPEN:
+                this->mem.string_at(data1);
+                this->mem.string_at(data2);
+                break;
+            case MODE_READ:
+            case MODE_WRITE:
+                if (this->mem.span(data1, static_cast<uint64_t>(data2) * data3).hooked) {
+                    throw SimulatorException("Filesystem buffer at 0x" + int_to_hex(data1) + " overlaps I/O registers");
+                }
+                break;
+        }
+    }
+
+    uint32_t Filesystem::execute(uint16_t mode, sim_fd fd, uint32_t data1, uint32_t data2, uint32_t data3) {
+        if (mode > MODE_MUNMAP) {
+            return this->perform(mode, fd, data1, data2, data3);
+        }
+        auto start = std::chrono::steady_clock::now();
+        uint32_t ret = this->perform(mode, fd, data1, data2, data3);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        this->operation_metrics[mode].count.add();
+        this->operation_metrics[mode].latency_ns.record(elapsed.count());
+        return ret;
+    }
+
+    uint32_t Filesystem::perform(uint16_t mode, sim_fd fd, uint32_t data1, uint32_t data2, uint32_t data3) {
+        uint64_t data12;
+        switch (mode) {
+            case MODE_OPEN:
+                return this->open(this->mem.ptr_to<const char>(data1), this->mem.ptr_to<const char>(data2));
+            case MODE_CLOSE:
+                return this->close(fd);
+            case MODE_READ:
+                return this->read(fd, this->mem.ptr_to<void>(data1), data2, data3);
+            case MODE_WRITE:
+                return this->write(fd, this->mem.ptr_to<const void>(data1), data2, data3);
+            case MODE_SEEK:
+                data12 = ((static_cast<uint64_t>(data2) << 32) | data1);
+                return this->seek(fd, data12, data3);
+            case MODE_MMAP:
+                return this->map(fd, data1, data2, data3);
+            case MODE_MUNMAP:
+                return this->unmap(data1, data2);
+            default:
+                // Unknown modes leave the result register untouched
+                return data3;
+        }
+    }
+
+    void Filesystem::submit(Request req) {
+        std::unique_lock<std::mutex> guard(this->lock);
+        if (!this->worker.joinable()) {
+            this->worker = std::thread(&Filesystem::worker_loop, this);
+        }
+        this->cv.wait(guard, [this]() { return !this->request.has_value(); });
+        this->request = req;
+        this->status.store(FS_STATUS_BUSY, std::memory_order_release);
+        this->cv.notify_all();
+    }
+
+    void Filesystem::wait_idle() {
+        if (!this->worker.joinable()) {
+            return;
+        }
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->cv.wait(guard, [this]() { return !this->request.has_value(); });
+    }
+
+    void Filesystem::worker_loop() {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (true) {
+            this->cv.wait(guard, [this]() { return this->stopping || this->request.has_value(); });
+            if (!this->request.has_value()) {
+                return;
+            }
+
+            // The file table is only touched with a request in flight, and
+            // everyone else waits for it to clear, so the lock can be dropped
+            Request req = *this->request;
+            guard.unlock();
+            uint32_t ret = this->execute(req.mode, req.fd, req.data1, req.data2, req.data3);
+            guard.lock();
+
+            this->result.store(ret, std::memory_order_release);
+            this->status.store(FS_STATUS_DONE, std::memory_order_release);
+            this->request.reset();
+            this->cv.notify_all();
+        }
+    }
+
     sim_fd Filesystem::open(const char *filename, const char *mode) {
+        // Reads of preloaded files never touch the host filesystem
+        if (std::strcmp(mode, "r") == 0 || std::strcmp(mode, "rb") == 0) {
+            auto it = this->preloaded.find(filename);
+            if (it != this->preloaded.end()) {
+                return this->allocate_fd(File(it->second));
+            }
+        }
+
         FILE *f = fopen(filename, mode);
         if (f == nullptr) {
             return 0;
         }
 
-        file_table.push_back(File(f, true));
-        return file_table.size();
+        return this->allocate_fd(File(f, true));
     }
 
     sim_size_t Filesystem::read(sim_fd fd, void *ptr, sim_size_t size, sim_size_t nmemb) {
@@ -23,6 +192,15 @@ namespace lc32sim {
             return 0;
         }
 
+        if (f.contents) {
+            // Same partial-item semantics as fread
+            size_t available = f.position < f.contents->size() ? f.contents->size() - f.position : 0;
+            size_t bytes = std::min(static_cast<size_t>(size) * nmemb, available);
+            std::memcpy(ptr, f.contents->data() + f.position, bytes);
+            f.position += bytes;
+            return size == 0 ? 0 : bytes / size;
+        }
+
         return fread(ptr, size, nmemb, f.f);
     }
 
@@ -36,6 +214,11 @@ namespace lc32sim {
             return 0;
         }
 
+        if (f.contents) {
+            // Preloaded files are read-only
+            return 0;
+        }
+
         return fwrite(ptr, size, nmemb, f.f);
     }
 
@@ -49,6 +232,21 @@ namespace lc32sim {
             return 2111;
         }
 
+        if (f.contents) {
+            sim_long base;
+            switch (whence) {
+                case SEEK_SET: base = 0; break;
+                case SEEK_CUR: base = f.position; break;
+                case SEEK_END: base = f.contents->size(); break;
+                default: return -1;
+            }
+            if (base + offset < 0) {
+                return -1;
+            }
+            f.position = base + offset;
+            return 0;
+        }
+
         return fseek(f.f, offset, whence);
     }
 
@@ -62,8 +260,37 @@ namespace lc32sim {
             return EOF;
         }
 
-        fclose(f.f);
+        if (f.contents) {
+            f.contents.reset();
+        } else {
+            fclose(f.f);
+        }
         f.open = false;
+        this->free_fds.push_back(fd);
         return 0;
     }
+
+    sim_size_t Filesystem::map(sim_fd fd, uint32_t addr, sim_size_t length, uint32_t offset) {
+        if (fd == 0 || fd > file_table.size()) {
+            return 0;
+        }
+
+        File &f = file_table[fd - 1];
+        if (!f.open) {
+            return 0;
+        }
+
+        if (f.contents) {
+            // There is no host file behind a preloaded file to map
+            return 0;
+        }
+
+        // The mapping reads the file directly, so flush anything buffered
+        fflush(f.f);
+        return this->mem.map_file(addr, length, fileno(f.f), offset);
+    }
+
+    sim_int Filesystem::unmap(uint32_t addr, sim_size_t length) {
+        return this->mem.unmap_file(addr, length) ? 0 : EOF;
+    }
 }
\ No newline at end of file
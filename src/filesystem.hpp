@@ -1,14 +1,22 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <bit>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "iodevice.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "utils.hpp"
 
 namespace lc32sim { 
@@ -22,32 +30,100 @@ namespace lc32sim {
 
     class Filesystem : public IODevice {
         private:
+            using Contents = std::shared_ptr<const std::vector<uint8_t>>;
+
             struct File {
                 FILE *f = nullptr;
                 bool open = false;
+                // Set instead of `f` for files served from the preload store
+                Contents contents;
+                size_t position = 0;
                 File(FILE *f, bool open) : f(f), open(open) {}
+                File(Contents contents) : open(true), contents(std::move(contents)) {}
             };
 
             std::vector<File> file_table;
+            // Closed slots in `file_table`, reused before the table grows
+            std::vector<sim_fd> free_fds;
+            // Files read into memory at startup, keyed by path
+            std::unordered_map<std::string, Contents> preloaded;
             Memory &mem;
 
+            sim_fd allocate_fd(File file);
+            void preload(const std::string &manifest);
+
             static const uint16_t MODE_OFF = 0;
             static const uint16_t MODE_OPEN = 1;
             static const uint16_t MODE_CLOSE = 2;
             static const uint16_t MODE_READ = 3;
             static const uint16_t MODE_WRITE = 4;
             static const uint16_t MODE_SEEK = 5;
+            static const uint16_t MODE_MMAP = 6;
+            static const uint16_t MODE_MUNMAP = 7;
+
+            // Count and latency in nanoseconds of each operation, by mode
+            struct OperationMetrics {
+                Counter count;
+                Histogram latency_ns;
+            };
+            std::array<OperationMetrics, MODE_MUNMAP + 1> operation_metrics;
+
+            // Asynchronous operations run one at a time on `worker`, which is
+            // only started once the guest first asks for one
+            struct Request {
+                uint16_t mode;
+                sim_fd fd;
+                uint32_t data1, data2, data3;
+            };
+            std::thread worker;
+            std::mutex lock;
+            std::condition_variable cv;
+            std::optional<Request> request;
+            bool stopping = false;
+            std::atomic<uint32_t> status = FS_STATUS_IDLE;
+            std::atomic<uint32_t> result = 0;
+
+            // Validates and initializes the guest memory an operation will use
+            void check_buffers(uint16_t mode, uint32_t data1, uint32_t data2, uint32_t data3);
+            // Runs an operation and returns its result
+            uint32_t execute(uint16_t mode, sim_fd fd, uint32_t data1, uint32_t data2, uint32_t data3);
+            uint32_t perform(uint16_t mode, sim_fd fd, uint32_t data1, uint32_t data2, uint32_t data3);
+            void submit(Request req);
+            void wait_idle();
+            void worker_loop();
 
         public:
-            Filesystem(Memory &mem) : file_table(), mem(mem) {}
+            /*
+             * Runs asynchronous operations before the write that submits
+             * them returns, so they take effect at a deterministic point.
+             * They still complete through the status and result registers.
+             */
+            bool synchronous = false;
+
+            Filesystem(Memory &mem);
+            ~Filesystem();
 
             sim_fd open(const char *filename, const char* mode);
             sim_size_t read(sim_fd fd, void *ptr, sim_size_t size, sim_size_t nmemb);
             sim_size_t write(sim_fd fd, const void *ptr, sim_size_t size, sim_size_t nmemb);
             sim_size_t seek(sim_fd fd, sim_long offset, uint32_t whence);
             sim_int close(sim_fd fd);
+            sim_size_t map(sim_fd fd, uint32_t addr, sim_size_t length, uint32_t offset);
+            sim_int unmap(uint32_t addr, sim_size_t length);
 
             std::string get_name() override { return "Filesystem"; };
+            // Requests leave their result in the last data register
+            bool writes_registers() override { return true; }
+            read_handlers get_read_handlers() override {
+                return {
+                    { FS_STATUS_ADDR, [this](uint32_t val) -> uint32_t {
+                        return this->status.load(std::memory_order_acquire);
+                    }},
+                    { FS_RESULT_ADDR, [this](uint32_t val) -> uint32_t {
+                        return this->result.load(std::memory_order_acquire);
+                    }},
+                };
+            }
             write_handlers get_write_handlers() override {
                 return {
                     { FS_CONTROLLER_ADDR, [this](uint32_t old_value, uint32_t value) {
@@ -62,32 +138,34 @@ namespace lc32sim {
                         uint32_t data1 = this->mem.read<uint32_t, true>(FS_CONTROLLER_ADDR + 4);
                         uint32_t data2 = this->mem.read<uint32_t, true>(FS_CONTROLLER_ADDR + 8);
                         uint32_t data3 = this->mem.read<uint32_t, true>(FS_CONTROLLER_ADDR + 12);
-                        uint64_t data12;
-
-                        uint32_t ret;
-                        switch (mode) {
-                            case MODE_OPEN:
-                                ret = this->open(this->mem.ptr_to<const char>(data1), this->mem.ptr_to<const char>(data2));
-                                return from16(MODE_OFF, ret);
-                            case MODE_CLOSE:
-                                ret = this->close(fd);
-                                goto write_ret;
-                            case MODE_READ:
-                                ret = this->read(fd, this->mem.ptr_to<void>(data1), data2, data3);
-                                goto write_ret;
-                            case MODE_WRITE:
-                                ret = this->write(fd, this->mem.ptr_to<const void>(data1), data2, data3);
-                                goto write_ret;
-                            case MODE_SEEK:
-                                data12 = ((static_cast<uint64_t>(data2) << 32) | data1);
-                                ret = this->seek(fd, data12, data3);
-                                goto write_ret;
-                            write_ret:
-                                this->mem.write<uint32_t, true>(FS_CONTROLLER_ADDR + 12, ret);
-                                break;
+
+                        // Faults are raised here, on the simulator thread, even
+                        // for asynchronous operations
+                        this->check_buffers(mode & ~FS_MODE_ASYNC, data1, data2, data3);
+
+                        if (mode & FS_MODE_ASYNC) {
+                            Request req{static_cast<uint16_t>(mode & ~FS_MODE_ASYNC), fd, data1, data2, data3};
+                            // Mapping replaces guest memory, which only the
+                            // simulator thread may do while the guest runs
+                            if (this->synchronous || req.mode == MODE_MMAP || req.mode == MODE_MUNMAP) {
+                                this->wait_idle();
+                                this->result.store(this->execute(req.mode, req.fd, req.data1, req.data2, req.data3), std::memory_order_release);
+                                this->status.store(FS_STATUS_DONE, std::memory_order_release);
+                            } else {
+                                this->submit(req);
+                            }
+                            return from16(MODE_OFF, fd);
                         }
 
-                        return from16(MODE_OFF, second16(value));
+                        // Synchronous operations must not race with an
+                        // asynchronous one on the file table
+                        this->wait_idle();
+                        uint32_t ret = this->execute(mode, fd, data1, data2, data3);
+                        if (mode == MODE_OPEN) {
+                            return from16(MODE_OFF, ret);
+                        }
+                        this->mem.write<uint32_t, true>(FS_CONTROLLER_ADDR + 12, ret);
+                        return from16(MODE_OFF, fd);
                     }
                 }};
             }
@@ -0,0 +1,132 @@
+#include <bit>
+#include <cstring>
+#include <iomanip>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "frame_hash.hpp"
+#include "log.hpp"
+
+namespace lc32sim {
+    // Constants from xxHash
+    static const uint32_t PRIME32_1 = 0x9E3779B1;
+    static const uint32_t PRIME32_2 = 0x85EBCA77;
+    static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87;
+    static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4F;
+
+    FrameHasher::FrameHasher(std::optional<std::string> output_path, std::optional<std::string> golden_path) {
+        if (output_path) {
+            this->output.open(*output_path, std::ios::out | std::ios::trunc);
+            if (!this->output.is_open()) {
+                throw SimulatorException("Could not open frame hash output file " + *output_path);
+            }
+        }
+        if (golden_path) {
+            std::ifstream in(*golden_path);
+            if (!in.is_open()) {
+                throw SimulatorException("Could not open golden frame hash file " + *golden_path);
+            }
+            uint64_t frame, hash;
+            while (in >> std::dec >> frame >> std::hex >> hash) {
+                if (frame != this->golden.size()) {
+                    throw SimulatorException("Golden frame hash file " + *golden_path + " is not in frame order at frame " + std::to_string(frame));
+                }
+                this->golden.push_back(hash);
+            }
+            if (!in.eof()) {
+                throw SimulatorException("Could not parse golden frame hash file " + *golden_path);
+            }
+            this->comparing = true;
+        }
+    }
+
+    FrameHasher::~FrameHasher() {
+        if (this->comparing && !this->diverged && this->frames_checked < this->golden.size()) {
+            logger.warn << "Run ended after " << this->frames_checked << " frames, but the golden list has " << this->golden.size();
+        }
+    }
+
+    uint64_t FrameHasher::hash(const uint16_t *buf, size_t num_pixels) {
+        // Every lane is an independent xxHash32-style accumulator, so the
+        // inner loop is a straight-line SIMD multiply/rotate
+        const size_t LANES = 16;
+        uint32_t acc[LANES];
+        for (size_t l = 0; l < LANES; l++) {
+            acc[l] = PRIME32_1 * static_cast<uint32_t>(l + 1);
+        }
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t*>(buf);
+        size_t num_bytes = num_pixels * sizeof(uint16_t);
+        size_t num_blocks = num_bytes / sizeof(acc);
+        for (size_t b = 0; b < num_blocks; b++) {
+            uint32_t block[LANES];
+            std::memcpy(block, bytes + b * sizeof(block), sizeof(block));
+            for (size_t l = 0; l < LANES; l++) {
+                acc[l] += block[l] * PRIME32_2;
+                acc[l] = std::rotl(acc[l], 13);
+                acc[l] *= PRIME32_1;
+            }
+        }
+
+        uint64_t h = PRIME64_2 ^ num_bytes;
+        for (size_t l = 0; l < LANES; l++) {
+            h = std::rotl(h ^ (acc[l] * PRIME64_1), 31) * PRIME64_2;
+        }
+        for (size_t i = num_blocks * sizeof(acc); i < num_bytes; i++) {
+            h = std::rotl(h ^ (bytes[i] * PRIME64_1), 11) * PRIME64_2;
+        }
+
+        // Final avalanche
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_1;
+        h ^= h >> 32;
+        return h;
+    }
+
+    bool FrameHasher::check(uint64_t frame, const uint16_t *buf) {
+        uint64_t h = hash(buf, Config.display.width * Config.display.height);
+        this->frames_checked = frame + 1;
+
+        if (this->output.is_open()) {
+            this->output << std::dec << frame << ' ' << std::hex << std::setw(16) << std::setfill('0') << h << '\n';
+        }
+
+        if (this->comparing) {
+            if (frame >= this->golden.size()) {
+                if (frame == this->golden.size()) {
+                    logger.warn << "Golden frame hash list ends at frame " << frame << "; later frames are not compared";
+                }
+                return true;
+            }
+            if (this->golden[frame] != h) {
+                logger.error << "Frame " << frame << " diverged from golden list: expected hash " << std::hex << this->golden[frame] << ", got " << h;
+                this->diverged = true;
+                this->dump_frame(frame, buf);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void FrameHasher::dump_frame(uint64_t frame, const uint16_t *buf) {
+        std::string path = "frame-" + std::to_string(frame) + ".ppm";
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            logger.error << "Could not open " << path << " to dump divergent frame";
+            return;
+        }
+
+        // Expand BGR555 to 8 bits per channel
+        out << "P6\n" << Config.display.width << ' ' << Config.display.height << "\n255\n";
+        for (size_t i = 0; i < Config.display.width * Config.display.height; i++) {
+            uint16_t px = buf[i];
+            for (int shift : {0, 5, 10}) {
+                uint8_t c = (px >> shift) & 0x1F;
+                out.put(static_cast<char>((c << 3) | (c >> 2)));
+            }
+        }
+        logger.error << "Divergent frame dumped to " << path;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace lc32sim {
+    /*!
+     * \brief Hashes the framebuffer at every VBlank for regression testing
+     *
+     * In record mode, a line of the form `<frame> <hash>` is written for every
+     * frame. In compare mode, each frame's hash is checked against a golden
+     * list produced by an earlier recording. On the first mismatch, the
+     * offending frame is dumped as a PPM image and the run should be stopped.
+     * Both modes may be used at once.
+     */
+    class FrameHasher {
+        private:
+            std::ofstream output;
+            std::vector<uint64_t> golden;
+            bool comparing = false;
+            bool diverged = false;
+            uint64_t frames_checked = 0;
+
+            void dump_frame(uint64_t frame, const uint16_t *buf);
+
+        public:
+            FrameHasher(std::optional<std::string> output_path, std::optional<std::string> golden_path);
+            ~FrameHasher();
+
+            /*!
+             * \brief Hashes `num_pixels` BGR555 pixels starting at `buf`
+             *
+             * The framebuffer is consumed as independent 32-bit lanes so the
+             * loop vectorises. A full 640x480 frame hashes in well under a
+             * millisecond.
+             */
+            static uint64_t hash(const uint16_t *buf, size_t num_pixels);
+
+            /*!
+             * \brief Records and/or checks the hash of a frame
+             * \return Whether the frame matched the golden list, or `true` if
+             *         not comparing
+             */
+            bool check(uint64_t frame, const uint16_t *buf);
+    };
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "fault.hpp"
+#include "fuzzer.hpp"
+#include "log.hpp"
+
+namespace lc32sim {
+    namespace {
+        // Set by AFL to the System V shared memory holding its map
+        const char *SHM_ENV_VAR = "__AFL_SHM_ID";
+    }
+
+    Fuzzer::Fuzzer(Simulator &sim) : sim(sim) {
+        if (sim.fuzzer) {
+            throw SimulatorException("Simulator is already being fuzzed");
+        }
+        if (const char *shm_id = std::getenv(SHM_ENV_VAR)) {
+            void *map = shmat(std::atoi(shm_id), nullptr, 0);
+            if (map == reinterpret_cast<void*>(-1)) {
+                throw SimulatorException(std::string("Could not attach to AFL's coverage map: ") + std::strerror(errno));
+            }
+            this->shared_map = static_cast<uint8_t*>(map);
+            sim.coverage = this->shared_map;
+        } else {
+            this->private_map = std::make_unique<uint8_t[]>(MAP_SIZE);
+            sim.coverage = this->private_map.get();
+        }
+        sim.fuzzer = this;
+    }
+
+    Fuzzer::~Fuzzer() {
+        this->sim.fuzzer = nullptr;
+        this->sim.coverage = nullptr;
+        if (this->shared_map) {
+            shmdt(this->shared_map);
+        }
+    }
+
+    void Fuzzer::arm_budget() {
+        if (Config.fuzz.instruction_budget == 0) {
+            return;
+        }
+        this->sim.scheduler.schedule(Config.fuzz.instruction_budget, [this]() {
+            this->hung = true;
+            this->sim.scheduler.stop();
+        });
+    }
+
+    void Fuzzer::start() {
+        if (this->started) {
+            return;
+        }
+        this->started = true;
+
+        // AFL is listening if the hello gets through
+        uint32_t hello = 0;
+        if (::write(FORKSRV_FD + 1, &hello, sizeof(hello)) != sizeof(hello)) {
+            this->arm_budget();
+            return;
+        }
+
+        // Only this thread survives a fork, so stop the others. Children
+        // have nobody to print to anyway.
+        this->sim.console.discard();
+        logger.stop_formatter();
+        // Crashes are reported by signal, and dumping core only slows them down
+        struct rlimit no_core = {0, 0};
+        setrlimit(RLIMIT_CORE, &no_core);
+
+        while (true) {
+            // AFL says whether it killed the last child, which does not
+            // matter when every test case gets a fresh one
+            uint32_t was_killed;
+            if (::read(FORKSRV_FD, &was_killed, sizeof(was_killed)) != sizeof(was_killed)) {
+                _exit(0);
+            }
+
+            pid_t child = fork();
+            if (child < 0) {
+                logger.fatal << "Could not fork: " << std::strerror(errno);
+                _exit(1);
+            }
+            if (child == 0) {
+                ::close(FORKSRV_FD);
+                ::close(FORKSRV_FD + 1);
+                this->forked = true;
+                // The test case was written since input was last read
+                this->sim.input.rewind();
+                this->arm_budget();
+                return;
+            }
+
+            int status;
+            if (::write(FORKSRV_FD + 1, &child, sizeof(child)) != sizeof(child) || waitpid(child, &status, 0) < 0) {
+                _exit(1);
+            }
+            if (::write(FORKSRV_FD + 1, &status, sizeof(status)) != sizeof(status)) {
+                _exit(1);
+            }
+        }
+    }
+
+    void Fuzzer::run() {
+        int signal = 0;
+        std::string fault;
+        try {
+            this->sim.run();
+            if (this->sim.fault) {
+                switch (this->sim.fault->kind) {
+                    case FaultKind::SEGMENTATION_FAULT:
+                        signal = SIGSEGV;
+                        break;
+                    case FaultKind::UNALIGNED_ACCESS:
+                        signal = SIGBUS;
+                        break;
+                    case FaultKind::CRASH:
+                        signal = SIGABRT;
+                        break;
+                    default:
+                        signal = SIGILL;
+                        break;
+                }
+                fault = this->sim.fault->describe();
+            }
+        } catch (const SimulatorException &e) {
+            // Scheduled device events can still fail
+            signal = SIGILL;
+            fault = e.what();
+        }
+        // Programs that never read input still need to answer AFL, and every
+        // test case then ends the same way
+        this->start();
+
+        if (!this->forked) {
+            this->sim.console.flush();
+            uint8_t *map = this->sim.coverage;
+            size_t edges = std::count_if(map, map + MAP_SIZE, [](uint8_t count) { return count != 0; });
+            if (signal) {
+                logger.info << "Test case crashed: " << fault;
+            } else if (this->hung) {
+                logger.info << "Test case hung after " << Config.fuzz.instruction_budget << " instructions";
+            } else {
+                logger.info << "Test case finished";
+            }
+            logger.info << "Covered " << edges << " branch edges";
+            logger.flush();
+        }
+
+        if (signal) {
+            std::signal(signal, SIG_DFL);
+            std::raise(signal);
+            _exit(1);
+        }
+        if (this->hung) {
+            if (!this->forked) {
+                std::exit(HANG_EXIT_STATUS);
+            }
+            while (true) {
+                pause();
+            }
+        }
+        if (this->forked) {
+            _exit(0);
+        }
+        std::exit(0);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "scheduler.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Runs the program as an AFL fork server target
+     *
+     * Branch edges are counted into AFL's shared coverage map, or a private
+     * one when not run by AFL. The fork server is started lazily, right
+     * before the program first reads console input or touches a device
+     * outside the simulation, so loading the ELF and everything the program
+     * does up to that point happens once. Each test case then runs in a
+     * child forked from there.
+     *
+     * Test cases end in one of three ways. Halting exits normally. Faults
+     * kill the child with a matching signal: `SIGSEGV` for segmentation
+     * faults, `SIGBUS` for unaligned accesses, `SIGABRT` for the `CRASH`
+     * TRAP, and `SIGILL` for anything else. Running for more than
+     * `fuzz.instruction_budget` instructions is a hang. AFL only counts
+     * hangs it times out itself, so the child then waits to be killed.
+     * Outside AFL, hangs exit with `HANG_EXIT_STATUS` instead.
+     */
+    class Fuzzer {
+        private:
+            Simulator &sim;
+            // AFL's map, if run by AFL
+            uint8_t *shared_map = nullptr;
+            std::unique_ptr<uint8_t[]> private_map;
+            bool started = false;
+            // Whether this is a child of the fork server
+            bool forked = false;
+            bool hung = false;
+
+            // Starts counting towards a hang
+            void arm_budget();
+
+        public:
+            static constexpr size_t MAP_SIZE = 1 << 16;
+            //! AFL's control pipe, with the status pipe one above
+            static constexpr int FORKSRV_FD = 198;
+            static constexpr int HANG_EXIT_STATUS = 124;
+
+            Fuzzer(Simulator &sim);
+            ~Fuzzer();
+            Fuzzer(Fuzzer const&) = delete;
+            void operator=(Fuzzer const&) = delete;
+
+            /*!
+             * \brief Starts the fork server, unless already started
+             *
+             * When run by AFL, this only returns in the forked children, each
+             * running one test case. The server itself exits once AFL is done.
+             * Otherwise, this returns right away and the one test case runs
+             * in this process.
+             */
+            void start();
+            //! Runs the program, and exits according to how the test case ended
+            [[noreturn]] void run();
+    };
+}
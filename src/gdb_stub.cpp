@@ -0,0 +1,635 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+#include "fault.hpp"
+#include "gdb_stub.hpp"
+#include "log.hpp"
+#include "recorder.hpp"
+
+namespace lc32sim {
+    namespace {
+        // How often a running program checks for an interrupt from GDB
+        const uint64_t INTERRUPT_POLL_INTERVAL = 1 << 16;
+
+        // GDB's own signal numbers, which are used in stop replies
+        const int GDB_SIGINT = 2;
+        const int GDB_SIGILL = 4;
+        const int GDB_SIGTRAP = 5;
+        const int GDB_SIGBUS = 10;
+        const int GDB_SIGSEGV = 11;
+
+        // Register numbers, matching the target description below
+        const unsigned int REG_PC = 8;
+        const unsigned int REG_CC = 9;
+        const unsigned int NUM_REGS = 10;
+
+        const char TARGET_XML[] =
+            "<?xml version=\"1.0\"?>"
+            "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+            "<target version=\"1.0\">"
+            "<feature name=\"org.lc32sim.core\">"
+            "<reg name=\"r0\" bitsize=\"32\" type=\"uint32\" regnum=\"0\"/>"
+            "<reg name=\"r1\" bitsize=\"32\" type=\"uint32\"/>"
+            "<reg name=\"r2\" bitsize=\"32\" type=\"uint32\"/>"
+            "<reg name=\"r3\" bitsize=\"32\" type=\"uint32\"/>"
+            "<reg name=\"r4\" bitsize=\"32\" type=\"uint32\"/>"
+            "<reg name=\"r5\" bitsize=\"32\" type=\"data_ptr\"/>"
+            "<reg name=\"r6\" bitsize=\"32\" type=\"data_ptr\"/>"
+            "<reg name=\"r7\" bitsize=\"32\" type=\"code_ptr\"/>"
+            "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+            "<reg name=\"cc\" bitsize=\"32\" type=\"uint32\"/>"
+            "</feature>"
+            "</target>";
+
+        const char HEX_DIGITS[] = "0123456789abcdef";
+
+        std::string hex_byte(uint8_t b) {
+            return {HEX_DIGITS[b >> 4], HEX_DIGITS[b & 0xf]};
+        }
+
+        // Registers go over the wire in target byte order, which is little-endian
+        std::string hex_word(uint32_t value) {
+            std::string out;
+            for (int i = 0; i < 4; i++) {
+                out += hex_byte((value >> (8 * i)) & 0xff);
+            }
+            return out;
+        }
+
+        int hex_value(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        bool parse_hex_bytes(const std::string &hex, std::vector<uint8_t> &out) {
+            if (hex.size() % 2 != 0) {
+                return false;
+            }
+            out.clear();
+            for (size_t i = 0; i < hex.size(); i += 2) {
+                int hi = hex_value(hex[i]);
+                int lo = hex_value(hex[i + 1]);
+                if (hi < 0 || lo < 0) {
+                    return false;
+                }
+                out.push_back(hi << 4 | lo);
+            }
+            return true;
+        }
+
+        bool parse_hex_word(const std::string &hex, uint32_t &value) {
+            std::vector<uint8_t> bytes;
+            if (!parse_hex_bytes(hex, bytes) || bytes.size() != 4) {
+                return false;
+            }
+            value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+            return true;
+        }
+
+        // Parses a big-endian hex number, as used for addresses and lengths
+        bool parse_number(const std::string &s, uint32_t &value) {
+            if (s.empty() || s.size() > 8) {
+                return false;
+            }
+            value = 0;
+            for (char c : s) {
+                int digit = hex_value(c);
+                if (digit < 0) {
+                    return false;
+                }
+                value = value << 4 | digit;
+            }
+            return true;
+        }
+
+        std::string signal_reply(int signal) {
+            return "S" + hex_byte(signal);
+        }
+
+        std::string watch_reply(const WatchHit &hit) {
+            const char *reason = hit.watchpoint.kind == WatchKind::WRITE ? "watch"
+                               : hit.watchpoint.kind == WatchKind::READ ? "rwatch" : "awatch";
+            std::ostringstream reply;
+            reply << "T" << hex_byte(GDB_SIGTRAP) << reason << ":" << std::hex << hit.addr << ";";
+            return reply.str();
+        }
+    }
+
+    GDBStub::GDBStub(Simulator &sim, const std::string &socket_path) : sim(sim), socket_path(socket_path) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            throw SimulatorException("GDB socket path is too long: " + socket_path);
+        }
+        std::strcpy(addr.sun_path, socket_path.c_str());
+
+        this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->listen_fd < 0) {
+            throw SimulatorException("Could not create GDB socket");
+        }
+        unlink(socket_path.c_str());
+        if (bind(this->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) || listen(this->listen_fd, 1)) {
+            ::close(this->listen_fd);
+            throw SimulatorException("Could not listen on GDB socket " + socket_path + ": " + std::strerror(errno));
+        }
+    }
+
+    GDBStub::~GDBStub() {
+        if (this->fd >= 0) {
+            ::close(this->fd);
+        }
+        ::close(this->listen_fd);
+        unlink(this->socket_path.c_str());
+    }
+
+    bool GDBStub::read_byte(char &c) {
+        while (true) {
+            ssize_t n = recv(this->fd, &c, 1, 0);
+            if (n == 1) {
+                return true;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+    }
+
+    bool GDBStub::receive_packet(std::string &packet) {
+        while (true) {
+            char c;
+            // Acknowledgements, and interrupts while stopped, are skipped
+            do {
+                if (!this->read_byte(c)) {
+                    return false;
+                }
+            } while (c != '$');
+
+            packet.clear();
+            uint8_t sum = 0;
+            while (true) {
+                if (!this->read_byte(c)) {
+                    return false;
+                }
+                if (c == '#') {
+                    break;
+                }
+                packet += c;
+                sum += c;
+            }
+            char checksum[2];
+            if (!this->read_byte(checksum[0]) || !this->read_byte(checksum[1])) {
+                return false;
+            }
+
+            if (!this->acks) {
+                return true;
+            }
+            bool valid = hex_value(checksum[0]) >= 0 && hex_value(checksum[1]) >= 0 && (hex_value(checksum[0]) << 4 | hex_value(checksum[1])) == sum;
+            [[maybe_unused]] ssize_t ret = send(this->fd, valid ? "+" : "-", 1, MSG_NOSIGNAL);
+            if (valid) {
+                return true;
+            }
+        }
+    }
+
+    void GDBStub::send_packet(const std::string &packet) {
+        uint8_t sum = 0;
+        for (char c : packet) {
+            sum += c;
+        }
+        std::string framed = "$" + packet + "#" + hex_byte(sum);
+        while (true) {
+            size_t sent = 0;
+            while (sent < framed.size()) {
+                ssize_t n = send(this->fd, framed.data() + sent, framed.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return;
+                }
+                sent += n;
+            }
+            if (!this->acks) {
+                return;
+            }
+            // Resend until GDB acknowledges it
+            char c;
+            if (!this->read_byte(c) || c != '-') {
+                return;
+            }
+        }
+    }
+
+    void GDBStub::poll_interrupt() {
+        char buf[64];
+        ssize_t n;
+        while ((n = recv(this->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            if (std::memchr(buf, 0x03, n)) {
+                this->interrupted = true;
+                this->sim.scheduler.stop();
+            }
+        }
+    }
+
+    std::string GDBStub::resume(bool single_step) {
+        if (this->fault_signal) {
+            // Like a real process, the program does not survive its fault
+            this->exited = true;
+            return "X" + hex_byte(*this->fault_signal);
+        }
+        if (this->sim.halted) {
+            this->exited = true;
+            return "W00";
+        }
+
+        if (this->sim.mem.has_breakpoint(this->sim.pc)) {
+            this->sim.mem.step_over_breakpoint(this->sim.pc);
+        }
+        this->interrupted = false;
+        try {
+            if (single_step) {
+                this->sim.scheduler.resume();
+                this->sim.at_breakpoint = false;
+                this->sim.watch_hit.reset();
+                this->sim.fault.reset();
+                this->sim.scheduler.now++;
+                this->sim.step();
+                if (this->sim.scheduler.now >= this->sim.scheduler.next_deadline()) {
+                    this->sim.scheduler.dispatch();
+                }
+                this->sim.console.flush();
+            } else {
+                this->sim.run();
+            }
+        } catch (const SimulatorException &e) {
+            // Scheduled device events can still fail
+            logger.error << e.what();
+            this->fault_signal = GDB_SIGILL;
+        }
+        if (this->sim.fault) {
+            logger.error << this->sim.fault->describe();
+            switch (this->sim.fault->kind) {
+                case FaultKind::SEGMENTATION_FAULT:
+                    this->fault_signal = GDB_SIGSEGV;
+                    break;
+                case FaultKind::UNALIGNED_ACCESS:
+                    this->fault_signal = GDB_SIGBUS;
+                    break;
+                default:
+                    this->fault_signal = GDB_SIGILL;
+                    break;
+            }
+        }
+
+        if (this->fault_signal) {
+            return signal_reply(*this->fault_signal);
+        }
+        if (this->sim.halted) {
+            this->exited = true;
+            return "W00";
+        }
+        if (this->sim.at_breakpoint) {
+            return "T" + hex_byte(GDB_SIGTRAP) + "swbreak:;";
+        }
+        if (this->sim.watch_hit) {
+            return watch_reply(*this->sim.watch_hit);
+        }
+        return signal_reply(this->interrupted ? GDB_SIGINT : GDB_SIGTRAP);
+    }
+
+    std::string GDBStub::reverse(bool single_step) {
+        Recorder &recorder = *this->sim.recorder;
+        bool found;
+        std::optional<WatchHit> watch_hit;
+        try {
+            if (single_step) {
+                found = recorder.step_back();
+            } else {
+                Recorder::ReverseStop stop = recorder.continue_back();
+                found = stop.found;
+                watch_hit = stop.watch_hit;
+                // Even without a hit, execution went back to the start
+                this->fault_signal.reset();
+            }
+        } catch (const SimulatorException &e) {
+            logger.error << e.what();
+            return "E01";
+        }
+
+        if (!found) {
+            return "T" + hex_byte(GDB_SIGTRAP) + "replaylog:begin;";
+        }
+        this->fault_signal.reset();
+        if (single_step) {
+            return signal_reply(GDB_SIGTRAP);
+        }
+        if (watch_hit) {
+            return watch_reply(*watch_hit);
+        }
+        return "T" + hex_byte(GDB_SIGTRAP) + "swbreak:;";
+    }
+
+    void GDBStub::modified() {
+        if (this->sim.recorder) {
+            this->sim.recorder->diverge();
+        }
+    }
+
+    std::string GDBStub::read_register(unsigned int reg) {
+        if (reg < 8) {
+            return hex_word(this->sim.regs[reg]);
+        } else if (reg == REG_PC) {
+            return hex_word(this->sim.pc);
+        } else if (reg == REG_CC) {
+            return hex_word(this->sim.cond);
+        }
+        return "E01";
+    }
+
+    bool GDBStub::write_register(unsigned int reg, uint32_t value) {
+        if (reg < 8) {
+            this->sim.regs[reg] = value;
+        } else if (reg == REG_PC) {
+            this->sim.pc = value;
+        } else if (reg == REG_CC) {
+            this->sim.cond = value & 0b111;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string GDBStub::read_registers() {
+        std::string out;
+        for (unsigned int reg = 0; reg < NUM_REGS; reg++) {
+            out += this->read_register(reg);
+        }
+        return out;
+    }
+
+    bool GDBStub::write_registers(const std::string &hex) {
+        if (hex.size() != NUM_REGS * 8) {
+            return false;
+        }
+        for (unsigned int reg = 0; reg < NUM_REGS; reg++) {
+            uint32_t value;
+            if (!parse_hex_word(hex.substr(reg * 8, 8), value)) {
+                return false;
+            }
+            this->write_register(reg, value);
+        }
+        return true;
+    }
+
+    // Debugger accesses go straight to memory, without triggering devices
+    std::string GDBStub::read_memory(uint32_t addr, uint32_t length) {
+        try {
+            GuestSpan span = this->sim.mem.span(addr, length);
+            std::string out;
+            for (size_t i = 0; i < span.size; i++) {
+                out += hex_byte(span.data[i]);
+            }
+            return out;
+        } catch (const SegmentationFaultException &e) {
+            return "E01";
+        }
+    }
+
+    bool GDBStub::write_memory(uint32_t addr, const std::string &hex) {
+        std::vector<uint8_t> bytes;
+        if (!parse_hex_bytes(hex, bytes)) {
+            return false;
+        }
+        try {
+            GuestSpan span = this->sim.mem.span(addr, bytes.size());
+            std::memcpy(span.data, bytes.data(), bytes.size());
+            return true;
+        } catch (const SegmentationFaultException &e) {
+            return false;
+        }
+    }
+
+    std::string GDBStub::breakpoint(const std::string &packet, bool insert) {
+        // Ztype,addr,kind: software breakpoints, and write, read, and access
+        // watchpoints, whose kind is the length watched
+        size_t comma1 = packet.find(',');
+        size_t comma2 = packet.find(',', comma1 + 1);
+        std::string type = packet.substr(1, comma1 - 1);
+        if (type != "0" && type != "2" && type != "3" && type != "4") {
+            return "";
+        }
+        uint32_t addr, length;
+        if (comma1 == std::string::npos || comma2 == std::string::npos || !parse_number(packet.substr(comma1 + 1, comma2 - comma1 - 1), addr)
+            || !parse_number(packet.substr(comma2 + 1), length)) {
+            return "E01";
+        }
+
+        if (type == "0") {
+            if (!insert) {
+                this->sim.mem.remove_breakpoint(addr);
+                return "OK";
+            }
+            try {
+                this->sim.mem.add_breakpoint(addr);
+            } catch (const SegmentationFaultException &e) {
+                return "E01";
+            }
+            return "OK";
+        }
+
+        WatchKind kind = type == "2" ? WatchKind::WRITE : type == "3" ? WatchKind::READ : WatchKind::ACCESS;
+        if (!insert) {
+            this->sim.mem.remove_watchpoint(addr, length, kind);
+            return "OK";
+        }
+        try {
+            this->sim.mem.add_watchpoint(Watchpoint{addr, length, kind, true});
+        } catch (const SimulatorException &e) {
+            return "E01";
+        }
+        return "OK";
+    }
+
+    std::string GDBStub::query(const std::string &packet) {
+        if (packet.starts_with("qSupported")) {
+            std::string features = "PacketSize=4000;qXfer:features:read+;QStartNoAckMode+;swbreak+";
+            if (this->sim.recorder) {
+                features += ";ReverseStep+;ReverseContinue+";
+            }
+            return features;
+        } else if (packet == "qAttached") {
+            return "1";
+        } else if (packet == "qC") {
+            return "QC1";
+        } else if (packet == "qfThreadInfo") {
+            return "m1";
+        } else if (packet == "qsThreadInfo") {
+            return "l";
+        } else if (packet.starts_with("qXfer:features:read:target.xml:")) {
+            // qXfer:features:read:target.xml:offset,length
+            std::string range = packet.substr(std::strlen("qXfer:features:read:target.xml:"));
+            size_t comma = range.find(',');
+            uint32_t offset, length;
+            if (comma == std::string::npos || !parse_number(range.substr(0, comma), offset) || !parse_number(range.substr(comma + 1), length)) {
+                return "E01";
+            }
+            std::string xml = TARGET_XML;
+            if (offset >= xml.size()) {
+                return "l";
+            }
+            std::string chunk = xml.substr(offset, length);
+            return (offset + chunk.size() >= xml.size() ? "l" : "m") + chunk;
+        }
+        return "";
+    }
+
+    void GDBStub::serve() {
+        logger.info << "Waiting for GDB on " << this->socket_path;
+        logger.flush();
+        this->fd = accept(this->listen_fd, nullptr, nullptr);
+        if (this->fd < 0) {
+            throw SimulatorException("Could not accept GDB connection");
+        }
+        logger.info << "GDB connected";
+        this->interrupt_poll = this->sim.scheduler.schedule(INTERRUPT_POLL_INTERVAL, [this]() { this->poll_interrupt(); }, INTERRUPT_POLL_INTERVAL);
+
+        bool killed = false;
+        std::string packet;
+        while (!killed && this->receive_packet(packet)) {
+            std::string reply;
+            std::string args = packet.empty() ? "" : packet.substr(1);
+            switch (packet.empty() ? '\0' : packet[0]) {
+                case '?':
+                    reply = signal_reply(GDB_SIGTRAP);
+                    break;
+                case 'g':
+                    reply = this->read_registers();
+                    break;
+                case 'G':
+                    reply = this->write_registers(args) ? "OK" : "E01";
+                    this->modified();
+                    break;
+                case 'p': {
+                    uint32_t reg;
+                    reply = parse_number(args, reg) ? this->read_register(reg) : "E01";
+                    break;
+                }
+                case 'P': {
+                    size_t eq = args.find('=');
+                    uint32_t reg, value;
+                    bool ok = eq != std::string::npos && parse_number(args.substr(0, eq), reg) && parse_hex_word(args.substr(eq + 1), value);
+                    reply = ok && this->write_register(reg, value) ? "OK" : "E01";
+                    this->modified();
+                    break;
+                }
+                case 'm': {
+                    size_t comma = args.find(',');
+                    uint32_t addr, length;
+                    if (comma == std::string::npos || !parse_number(args.substr(0, comma), addr) || !parse_number(args.substr(comma + 1), length)) {
+                        reply = "E01";
+                    } else {
+                        reply = this->read_memory(addr, length);
+                    }
+                    break;
+                }
+                case 'M': {
+                    size_t comma = args.find(',');
+                    size_t colon = args.find(':');
+                    uint32_t addr, length;
+                    if (comma == std::string::npos || colon == std::string::npos || !parse_number(args.substr(0, comma), addr)
+                        || !parse_number(args.substr(comma + 1, colon - comma - 1), length) || args.size() - colon - 1 != length * 2) {
+                        reply = "E01";
+                    } else {
+                        reply = this->write_memory(addr, args.substr(colon + 1)) ? "OK" : "E01";
+                        this->modified();
+                    }
+                    break;
+                }
+                case 'c':
+                case 's': {
+                    // An optional address to resume from
+                    uint32_t addr;
+                    if (!args.empty() && parse_number(args, addr)) {
+                        this->sim.pc = addr;
+                    }
+                    reply = this->resume(packet[0] == 's');
+                    break;
+                }
+                case 'b':
+                    // bs and bc, which step and continue backwards
+                    if (this->sim.recorder && !this->exited && (packet == "bs" || packet == "bc")) {
+                        reply = this->reverse(packet == "bs");
+                    }
+                    break;
+                case 'Z':
+                case 'z':
+                    reply = this->breakpoint(packet, packet[0] == 'Z');
+                    break;
+                case 'q':
+                    reply = this->query(packet);
+                    break;
+                case 'Q':
+                    if (packet == "QStartNoAckMode") {
+                        this->send_packet("OK");
+                        this->acks = false;
+                        continue;
+                    }
+                    break;
+                case 'H':
+                case 'T':
+                    reply = "OK";
+                    break;
+                case 'D':
+                    this->send_packet("OK");
+                    logger.info << "GDB detached";
+                    this->sim.scheduler.cancel(this->interrupt_poll);
+                    ::close(this->fd);
+                    this->fd = -1;
+                    this->run_detached();
+                    return;
+                case 'k':
+                    killed = true;
+                    continue;
+                case 'v':
+                    if (packet == "vKill;1") {
+                        this->send_packet("OK");
+                        killed = true;
+                        continue;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            this->send_packet(reply);
+        }
+
+        this->sim.scheduler.cancel(this->interrupt_poll);
+        if (killed) {
+            logger.info << "Program killed by GDB";
+            return;
+        }
+        // The connection dropped, so carry on without the debugger
+        logger.warn << "GDB connection closed";
+        this->run_detached();
+    }
+
+    void GDBStub::run_detached() {
+        if (this->exited || this->fault_signal) {
+            return;
+        }
+        // Nothing is left to stop for, so the program runs to the end
+        this->sim.mem.clear_breakpoints();
+        this->sim.mem.clear_watchpoints();
+        this->sim.run();
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "scheduler.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief GDB Remote Serial Protocol server over a Unix socket
+     *
+     * Connect with `target remote unix::<path>` in GDB or
+     * `gdb-remote unix-connect://<path>` in LLDB. The stub supports register
+     * and memory access, single-step, continue, software breakpoints, watchpoints, and
+     * interrupting a running program with Ctrl-C. Registers are R0-R7, the
+     * PC, and the condition codes, as described by the target XML the stub
+     * sends.
+     *
+     * Breakpoints are kept by `Memory` and checked on instruction fetch, so
+     * the run loop is the same one used without a debugger.
+     *
+     * If the simulator has a `Recorder` attached, `reverse-stepi` and
+     * `reverse-continue` are supported too. Changing registers or memory
+     * while in the past discards the recorded future.
+     */
+    class GDBStub {
+        private:
+            Simulator &sim;
+            std::string socket_path;
+            int listen_fd = -1;
+            int fd = -1;
+            bool acks = true;
+            // Set when GDB sends an interrupt while the program runs
+            bool interrupted = false;
+            Scheduler::event_id interrupt_poll;
+            // GDB signal number of the fault the program stopped on, if any
+            std::optional<int> fault_signal;
+            // Whether GDB has been told the program is gone
+            bool exited = false;
+
+            bool read_byte(char &c);
+
+            // Returns false if the connection was closed
+            bool receive_packet(std::string &packet);
+            void send_packet(const std::string &packet);
+            void poll_interrupt();
+
+            // Runs the program, or a single instruction, and returns the stop reply
+            std::string resume(bool single_step);
+            // Same, but backwards, when execution is being recorded
+            std::string reverse(bool single_step);
+            // Called when GDB changes registers or memory
+            void modified();
+            std::string read_registers();
+            bool write_registers(const std::string &hex);
+            std::string read_register(unsigned int reg);
+            bool write_register(unsigned int reg, uint32_t value);
+            std::string read_memory(uint32_t addr, uint32_t length);
+            bool write_memory(uint32_t addr, const std::string &hex);
+            std::string query(const std::string &packet);
+            // Handles Z and z, for both breakpoints and watchpoints
+            std::string breakpoint(const std::string &packet, bool insert);
+            // Clears breakpoints and watchpoints, and runs the program on without GDB
+            void run_detached();
+
+        public:
+            GDBStub(Simulator &sim, const std::string &socket_path);
+            ~GDBStub();
+            GDBStub(GDBStub const&) = delete;
+            void operator=(GDBStub const&) = delete;
+
+            /*!
+             * \brief Waits for a debugger, then serves it until it is done
+             *
+             * If the debugger detaches, or the connection drops, every
+             * breakpoint and watchpoint is cleared and the program runs on by
+             * itself. Returns once the program stops or the
+             * debugger kills it.
+             */
+            void serve();
+    };
+}
@@ -0,0 +1,176 @@
+#include <bit>
+#include <iomanip>
+#include <string>
+
+#include "exceptions.hpp"
+#include "hart_control.hpp"
+#include "instruction.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+namespace lc32sim {
+    namespace {
+        // Instructions an extra hart runs between checks for shutdown
+        constexpr unsigned int SLICE = 4096;
+
+        // Words in guest memory are stored little-endian
+        uint32_t to_host(uint32_t word) {
+            return std::endian::native == std::endian::big ? std::byteswap(word) : word;
+        }
+        uint32_t to_guest(uint32_t word) {
+            return to_host(word);
+        }
+    }
+
+    HartControl::HartControl(Simulator &sim, unsigned int count) : sim(sim), instructions_retired(metrics.counter("harts.instructions_retired")) {
+        if (count == 0) {
+            throw SimulatorException("hart count must be at least 1");
+        }
+        for (unsigned int id = 0; id < count; id++) {
+            this->harts.push_back(std::make_unique<Hart>());
+            this->harts.back()->id = id;
+        }
+    }
+
+    HartControl::~HartControl() {
+        {
+            std::lock_guard<std::mutex> lock(this->lock);
+            this->stopping = true;
+        }
+        this->hart_stopped.notify_all();
+        for (auto &hart : this->harts) {
+            if (hart->thread.joinable()) {
+                hart->thread.join();
+            }
+        }
+    }
+
+    read_handlers HartControl::get_read_handlers() {
+        return {
+            { HART_START_ADDR, [this](uint32_t val) -> uint32_t {
+                return this->start();
+            }},
+            { HART_JOIN_ADDR, [this](uint32_t val) -> uint32_t {
+                return this->registers().join_result;
+            }},
+            { HART_ID_ADDR, [](uint32_t val) -> uint32_t {
+                return Simulator::hart_id;
+            }},
+            { ATOMIC_CAS_ADDR, [this](uint32_t val) -> uint32_t {
+                const Registers &regs = this->registers();
+                uint32_t expected = to_guest(regs.atomic_expected);
+                this->atomic_word().compare_exchange_strong(expected, to_guest(regs.atomic_value));
+                return to_host(expected);
+            }},
+            { ATOMIC_ADD_ADDR, [this](uint32_t val) -> uint32_t {
+                uint32_t value = this->registers().atomic_value;
+                std::atomic_ref<uint32_t> word = this->atomic_word();
+                uint32_t old = word.load();
+                while (!word.compare_exchange_weak(old, to_guest(to_host(old) + value))) {}
+                return to_host(old);
+            }},
+        };
+    }
+
+    write_handlers HartControl::get_write_handlers() {
+        // Each register keeps what was written, for the hart that wrote it
+        auto set = [this](uint32_t Registers::*field) {
+            return [this, field](uint32_t old_value, uint32_t value) -> uint32_t {
+                this->registers().*field = value;
+                return value;
+            };
+        };
+        return {
+            { HART_PC_ADDR, set(&Registers::pc) },
+            { HART_SP_ADDR, set(&Registers::sp) },
+            { HART_ARG_ADDR, set(&Registers::arg) },
+            { HART_JOIN_ADDR, [this](uint32_t old_value, uint32_t value) -> uint32_t {
+                std::optional<HartState> state = this->join(value);
+                // Harts that faulted have no result
+                this->registers().join_result = state && !state->fault ? state->regs[0] : HART_NONE;
+                return value;
+            }},
+            { ATOMIC_ADDR_ADDR, set(&Registers::atomic_addr) },
+            { ATOMIC_EXPECTED_ADDR, set(&Registers::atomic_expected) },
+            { ATOMIC_VALUE_ADDR, set(&Registers::atomic_value) },
+        };
+    }
+
+    uint32_t HartControl::start() {
+        const Registers &regs = this->registers();
+        std::lock_guard<std::mutex> lock(this->lock);
+        for (size_t id = 1; id < this->harts.size(); id++) {
+            Hart &hart = *this->harts[id];
+            if (hart.running) {
+                continue;
+            }
+            // It has stopped, so this does not wait
+            if (hart.thread.joinable()) {
+                hart.thread.join();
+            }
+            hart.registers = Registers();
+            hart.state = HartState();
+            hart.state.pc = regs.pc;
+            hart.state.regs[0] = regs.arg;
+            hart.state.regs[5] = regs.sp;
+            hart.state.regs[6] = regs.sp;
+            hart.running = true;
+            hart.thread = std::thread([this, &hart]() { this->run(hart); });
+            return hart.id;
+        }
+        return HART_NONE;
+    }
+
+    std::optional<HartState> HartControl::join(uint32_t id) {
+        if (id == 0 || id >= this->harts.size() || id == Simulator::hart_id) {
+            return std::nullopt;
+        }
+        Hart &hart = *this->harts[id];
+        std::unique_lock<std::mutex> lock(this->lock);
+        this->hart_stopped.wait(lock, [&]() { return !hart.running || this->stopping; });
+        if (hart.running) {
+            return std::nullopt;
+        }
+        return hart.state;
+    }
+
+    std::atomic_ref<uint32_t> HartControl::atomic_word() {
+        uint32_t addr = this->registers().atomic_addr;
+        if (addr % 4 != 0) {
+            throw UnalignedMemoryAccessException(addr, 4);
+        }
+        GuestSpan span = this->sim.mem.span(addr, 4);
+        if (span.hooked) {
+            throw SimulatorException("atomic operation on I/O register 0x" + int_to_hex(addr));
+        }
+        return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(span.data));
+    }
+
+    void HartControl::run(Hart &hart) {
+        Simulator::hart_id = hart.id;
+        bool running = true;
+        while (running && !this->stopping.load(std::memory_order_relaxed)) {
+            unsigned int executed = 0;
+            while (executed < SLICE && (running = this->sim.step(hart.state))) {
+                executed++;
+            }
+            // A HALT retires, but a fault does not
+            this->instructions_retired.add(executed + hart.state.halted);
+        }
+        if (hart.state.fault) {
+            const Fault &fault = *hart.state.fault;
+            if (fault.phase == FaultPhase::FETCH) {
+                logger.error << "Hart " << hart.id << " faulted fetching from x" << std::hex << std::setw(8) << std::setfill('0') << fault.pc << ": " << fault.describe();
+            } else {
+                logger.error << "Hart " << hart.id << " faulted at x" << std::hex << std::setw(8) << std::setfill('0') << fault.pc
+                             << " (" << Instruction(fault.instruction) << "): " << fault.describe();
+            }
+            this->any_faulted = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->lock);
+            hart.running = false;
+        }
+        this->hart_stopped.notify_all();
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <any>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "iodevice.hpp"
+#include "metrics.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Starts extra harts on host threads, and gives every hart atomics
+     *
+     * Hart 0 is the simulator's own. The others each have their own
+     * `HartState`, which `Simulator::step` runs on their own host thread over
+     * the shared `Memory`, without the scheduler. Their loads
+     * and stores are not ordered against each other's beyond what the host
+     * gives aligned words, so harts should synchronize through the atomic
+     * operations and joins.
+     *
+     * Devices other than this one are not thread-safe, so only hart 0 can
+     * use them or make TRAPs other than HALT, BREAK, and CRASH. An extra hart
+     * that tries faults instead. The video buffer is plain memory, which any
+     * hart can draw into. Faults of extra harts are logged when they happen,
+     * and joining a hart that faulted gives HART_NONE.
+     *
+     * Extra harts are stopped when the device is destroyed, which must happen
+     * before the `Simulator` they run on goes away.
+     */
+    class HartControl : public IODevice {
+        private:
+            // Registers a hart sets up before starting, joining, or an atomic operation
+            struct Registers {
+                uint32_t pc = 0;
+                uint32_t sp = 0;
+                uint32_t arg = 0;
+                uint32_t join_result = HART_NONE;
+                uint32_t atomic_addr = 0;
+                uint32_t atomic_expected = 0;
+                uint32_t atomic_value = 0;
+            };
+            struct Hart {
+                uint32_t id;
+                Registers registers;
+                // Only touched by the hart's thread while it is running
+                HartState state;
+                // Guarded by `lock`
+                bool running = false;
+                std::thread thread;
+            };
+
+            Simulator &sim;
+            std::vector<std::unique_ptr<Hart>> harts;
+            std::mutex lock;
+            std::condition_variable hart_stopped;
+            std::atomic<bool> stopping = false;
+            // Set once any extra hart has faulted
+            std::atomic<bool> any_faulted = false;
+            Counter instructions_retired;
+
+            Registers &registers() { return this->harts[Simulator::hart_id]->registers; }
+            uint32_t start();
+            // Waits for hart `id` to stop, and returns its final state, with
+            // its fault if it had one, or nothing if it cannot be joined
+            std::optional<HartState> join(uint32_t id);
+            // The word an atomic operation acts on, as stored
+            std::atomic_ref<uint32_t> atomic_word();
+            void run(Hart &hart);
+
+        public:
+            //! Allows up to `count` harts running at once, including hart 0
+            HartControl(Simulator &sim, unsigned int count);
+            ~HartControl();
+            HartControl(HartControl const&) = delete;
+            void operator=(HartControl const&) = delete;
+
+            //! Whether any extra hart has faulted so far
+            bool faulted() const { return this->any_faulted; }
+
+            std::string get_name() override { return "Hart Control"; };
+            read_handlers get_read_handlers() override;
+            write_handlers get_write_handlers() override;
+            // Atomics on their own are deterministic, and recording or
+            // replaying only ever runs with a single hart
+            bool replayable() override { return true; }
+            bool shared_by_harts() override { return true; }
+            std::any save_state() override {
+                return this->harts[0]->registers;
+            }
+            void restore_state(const std::any &state) override {
+                this->harts[0]->registers = std::any_cast<Registers>(state);
+            }
+    };
+}
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "exceptions.hpp"
+#include "hle.hpp"
+#include "log.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    namespace {
+        constexpr uint8_t NUM_ROUTINES = 8;
+
+        // Words in guest memory are stored little-endian
+        uint32_t word_at(const uint8_t *data) {
+            uint32_t word;
+            std::memcpy(&word, data, sizeof(word));
+            return std::endian::native == std::endian::big ? std::byteswap(word) : word;
+        }
+
+        bool overlaps(uint32_t a, uint64_t a_size, uint32_t b, uint64_t b_size) {
+            return a < b + b_size && b < a + a_size;
+        }
+
+        // Comparisons return a negative, zero, or positive int
+        uint32_t comparison(int value) {
+            return static_cast<uint32_t>((value > 0) - (value < 0));
+        }
+        int sign_of(uint32_t value) {
+            int32_t svalue = static_cast<int32_t>(value);
+            return (svalue > 0) - (svalue < 0);
+        }
+
+        std::string hex(uint32_t value, int width = 8) {
+            std::ostringstream out;
+            out << "x" << std::hex << std::setw(width) << std::setfill('0') << value;
+            return out.str();
+        }
+    }
+
+    HLE::HLE(Simulator &sim, ELFFile &elf) : sim(sim), verify(Config.hle.verify), calls(metrics.counter("hle.calls")),
+                                             verified(metrics.counter("hle.verified")), mismatches(metrics.counter("hle.mismatches")) {
+        bool enabled[NUM_ROUTINES] = {};
+        std::istringstream list(Config.hle.functions);
+        std::string function;
+        while (std::getline(list, function, ',')) {
+            function.erase(0, function.find_first_not_of(" \t"));
+            function.erase(function.find_last_not_of(" \t") + 1);
+            if (function.empty()) {
+                continue;
+            }
+            if (function == "all") {
+                std::fill(std::begin(enabled), std::end(enabled), true);
+                continue;
+            }
+            bool known = false;
+            for (uint8_t r = 0; r < NUM_ROUTINES; r++) {
+                if (function == name(static_cast<Routine>(r))) {
+                    enabled[r] = known = true;
+                }
+            }
+            if (!known) {
+                throw SimulatorException("Cannot run " + function + " natively, expected memcpy, memmove, memset, memcmp, strlen, strcmp, strcpy, strchr, or all");
+            }
+        }
+
+        for (const elf_symbol &symbol : elf.get_function_symbols()) {
+            for (uint8_t r = 0; r < NUM_ROUTINES; r++) {
+                if (enabled[r] && symbol.name == name(static_cast<Routine>(r))) {
+                    this->sim.mem.add_intercept(symbol.value);
+                    this->routines[symbol.value] = static_cast<Routine>(r);
+                    logger.info << (this->verify ? "Verifying " : "Running ") << symbol.name << " @ " << hex(symbol.value) << " natively";
+                }
+            }
+        }
+        if (this->routines.empty()) {
+            logger.warn << "None of the routines to run natively are in the program's symbol table";
+        }
+    }
+
+    HLE::~HLE() {
+        for (const auto &[addr, routine] : this->routines) {
+            this->sim.mem.remove_intercept(addr);
+        }
+        if (this->pending) {
+            this->sim.mem.remove_intercept(this->pending->return_addr);
+        }
+    }
+
+    const char *HLE::name(Routine routine) {
+        switch (routine) {
+            case Routine::MEMCPY: return "memcpy";
+            case Routine::MEMMOVE: return "memmove";
+            case Routine::MEMSET: return "memset";
+            case Routine::MEMCMP: return "memcmp";
+            case Routine::STRLEN: return "strlen";
+            case Routine::STRCMP: return "strcmp";
+            case Routine::STRCPY: return "strcpy";
+            case Routine::STRCHR: return "strchr";
+        }
+        return "unknown";
+    }
+
+    std::optional<HLE::Call> HLE::evaluate(Routine routine) {
+        Memory &mem = this->sim.mem;
+        // Anything the guest would see differently through hooks or
+        // watchpoints is left to it
+        auto usable = [&mem](uint32_t addr, const GuestSpan &span, uint64_t size) {
+            return !span.hooked && !mem.has_watchpoints(addr, static_cast<uint64_t>(addr) + size);
+        };
+        // Spans and strings throw where the guest would fault, in which case
+        // interpreting the routine faults at the right instruction
+        try {
+            uint32_t sp = this->sim.regs[6];
+            uint32_t arg_count = routine == Routine::STRLEN ? 1 : (routine == Routine::STRCMP || routine == Routine::STRCPY || routine == Routine::STRCHR) ? 2 : 3;
+            if (sp % 4 != 0) {
+                return std::nullopt;
+            }
+            GuestSpan args = mem.span(sp, arg_count * 4);
+            if (!usable(sp, args, args.size)) {
+                return std::nullopt;
+            }
+            uint32_t a = word_at(args.data);
+            uint32_t b = arg_count > 1 ? word_at(args.data + 4) : 0;
+            uint32_t n = arg_count > 2 ? word_at(args.data + 8) : 0;
+
+            switch (routine) {
+                case Routine::MEMCPY:
+                case Routine::MEMMOVE: {
+                    if (n == 0) {
+                        return Call{a};
+                    }
+                    GuestSpan dst = mem.span(a, n);
+                    GuestSpan src = mem.span(b, n);
+                    // Forward copies of overlapping ranges depend on how the guest copies
+                    if (!usable(a, dst, n) || !usable(b, src, n) || (routine == Routine::MEMCPY && overlaps(a, n, b, n))) {
+                        return std::nullopt;
+                    }
+                    return Call{a, false, a, n, src.data};
+                }
+                case Routine::MEMSET: {
+                    if (n == 0) {
+                        return Call{a};
+                    }
+                    GuestSpan dst = mem.span(a, n);
+                    if (!usable(a, dst, n)) {
+                        return std::nullopt;
+                    }
+                    return Call{a, false, a, n, nullptr, static_cast<uint8_t>(b)};
+                }
+                case Routine::MEMCMP: {
+                    if (n == 0) {
+                        return Call{0, true};
+                    }
+                    GuestSpan x = mem.span(a, n);
+                    GuestSpan y = mem.span(b, n);
+                    if (!usable(a, x, n) || !usable(b, y, n)) {
+                        return std::nullopt;
+                    }
+                    return Call{comparison(std::memcmp(x.data, y.data, n)), true};
+                }
+                case Routine::STRLEN: {
+                    GuestSpan s = mem.string_at(a);
+                    if (!usable(a, s, s.size + 1)) {
+                        return std::nullopt;
+                    }
+                    return Call{static_cast<uint32_t>(s.size)};
+                }
+                case Routine::STRCMP: {
+                    GuestSpan x = mem.string_at(a);
+                    GuestSpan y = mem.string_at(b);
+                    if (!usable(a, x, x.size + 1) || !usable(b, y, y.size + 1)) {
+                        return std::nullopt;
+                    }
+                    // Up to and including the shorter one's terminator
+                    return Call{comparison(std::memcmp(x.data, y.data, std::min(x.size, y.size) + 1)), true};
+                }
+                case Routine::STRCPY: {
+                    GuestSpan src = mem.string_at(b);
+                    uint32_t size = static_cast<uint32_t>(src.size + 1);
+                    GuestSpan dst = mem.span(a, size);
+                    if (!usable(a, dst, size) || !usable(b, src, size) || overlaps(a, size, b, size)) {
+                        return std::nullopt;
+                    }
+                    return Call{a, false, a, size, src.data};
+                }
+                case Routine::STRCHR: {
+                    GuestSpan s = mem.string_at(a);
+                    if (!usable(a, s, s.size + 1)) {
+                        return std::nullopt;
+                    }
+                    // Searching for the terminator finds it
+                    const void *found = std::memchr(s.data, static_cast<uint8_t>(b), s.size + 1);
+                    return Call{found ? a + static_cast<uint32_t>(static_cast<const uint8_t*>(found) - s.data) : 0};
+                }
+            }
+        } catch (const SimulatorException &e) {}
+        return std::nullopt;
+    }
+
+    void HLE::check(const Pending &pending) {
+        this->verified.add();
+        std::string where = std::string(name(pending.routine)) + " called from " + hex(pending.caller);
+        bool matches = true;
+        uint32_t result = this->sim.regs[0];
+        if (pending.sign_only ? sign_of(result) != sign_of(pending.result) : result != pending.result) {
+            logger.error << "HLE mismatch in " << where << ": returned " << hex(result) << ", but natively " << hex(pending.result);
+            matches = false;
+        }
+        if (this->sim.regs[6] != pending.sp) {
+            logger.error << "HLE mismatch in " << where << ": returned with R6 " << hex(this->sim.regs[6]) << ", but was called with " << hex(pending.sp);
+            matches = false;
+        }
+        if (!pending.expected.empty()) {
+            const uint8_t *actual = this->sim.mem.span(pending.dst, pending.expected.size()).data;
+            auto [differs, expected] = std::mismatch(actual, actual + pending.expected.size(), pending.expected.begin());
+            if (expected != pending.expected.end()) {
+                logger.error << "HLE mismatch in " << where << ": wrote " << hex(*differs, 2) << " to " << hex(pending.dst + static_cast<uint32_t>(differs - actual))
+                             << ", but natively " << hex(*expected, 2);
+                matches = false;
+            }
+        }
+        if (!matches) {
+            this->mismatches.add();
+        }
+    }
+
+    bool HLE::enter(uint32_t pc) noexcept {
+        try {
+            return this->handle(pc);
+        } catch (const std::exception &e) {
+            // Nothing has been written yet, so the routine can still be interpreted
+            logger.warn << "Interpreting the call at " << hex(pc) << ": " << e.what();
+        } catch (...) {
+            logger.warn << "Interpreting the call at " << hex(pc) << ": Unknown error";
+        }
+        return false;
+    }
+
+    bool HLE::handle(uint32_t pc) {
+        if (this->pending && pc == this->pending->return_addr) {
+            // Finished with before checking, so a check that throws is not repeated
+            Pending done = std::move(*this->pending);
+            this->pending.reset();
+            if (!this->routines.contains(pc)) {
+                this->sim.mem.remove_intercept(pc);
+            }
+            this->check(done);
+        }
+        auto routine = this->routines.find(pc);
+        // Calls made while verifying another are only interpreted
+        if (routine == this->routines.end() || this->pending) {
+            return false;
+        }
+        std::optional<Call> call = this->evaluate(routine->second);
+        if (!call) {
+            return false;
+        }
+
+        uint32_t return_addr = this->sim.regs[7];
+        if (this->verify) {
+            Pending pending{routine->second, return_addr - 2, return_addr, this->sim.regs[6], call->result, call->sign_only, call->dst, {}};
+            if (call->src) {
+                pending.expected.assign(call->src, call->src + call->size);
+            } else {
+                pending.expected.assign(call->size, call->fill);
+            }
+            try {
+                this->sim.mem.add_intercept(return_addr);
+            } catch (const SimulatorException &e) {
+                // Returning will fault, so there is nothing to check
+                return false;
+            }
+            this->pending = std::move(pending);
+            return false;
+        }
+
+        if (call->size != 0) {
+            uint8_t *dst = this->sim.mem.span(call->dst, call->size).data;
+            if (call->src) {
+                std::memmove(dst, call->src, call->size);
+            } else {
+                std::memset(dst, call->fill, call->size);
+            }
+        }
+        this->sim.regs[0] = call->result;
+        this->sim.pc = return_addr;
+        this->calls.add();
+        return true;
+    }
+}
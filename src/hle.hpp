@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "elf_file.hpp"
+#include "metrics.hpp"
+
+namespace lc32sim {
+    class Simulator;
+
+    /*!
+     * \brief Runs libc memory and string routines natively
+     *
+     * The routines named in `hle.functions` are looked up in the program's
+     * symbol table, and their entry points are intercepted. When the PC
+     * reaches one, the arguments are read from the stack, starting at R6,
+     * and the routine is done with the host's libc. The result goes in R0,
+     * and the PC goes back to R7, so the whole call retires as a single
+     * instruction. Other registers are left alone.
+     *
+     * A call is only run natively when every byte the routine could touch
+     * is in user space, and none of it is an I/O register or watched.
+     * Otherwise, including when `memcpy` or `strcpy` are given overlapping
+     * ranges, the routine is interpreted as usual, so it faults or triggers
+     * watchpoints exactly where it would have anyway.
+     *
+     * With `hle.verify`, every call is interpreted, and the native result
+     * is worked out beforehand and checked when the routine returns. Only
+     * the sign of `memcmp` and `strcmp` results is compared. Mismatches are
+     * logged as errors.
+     */
+    class HLE {
+        private:
+            enum class Routine : uint8_t {
+                MEMCPY,
+                MEMMOVE,
+                MEMSET,
+                MEMCMP,
+                STRLEN,
+                STRCMP,
+                STRCPY,
+                STRCHR,
+            };
+            // What a call does: its result, and the `size` bytes it writes
+            // at `dst`, copied from `src`, or set to `fill` if `src` is null
+            struct Call {
+                uint32_t result;
+                // Whether only the sign of the result is meaningful
+                bool sign_only = false;
+                uint32_t dst = 0;
+                uint32_t size = 0;
+                const uint8_t *src = nullptr;
+                uint8_t fill = 0;
+            };
+            // A call being interpreted, to be checked when it returns
+            struct Pending {
+                Routine routine;
+                // Where the routine was called from
+                uint32_t caller;
+                uint32_t return_addr;
+                uint32_t sp;
+                uint32_t result;
+                bool sign_only;
+                uint32_t dst;
+                std::vector<uint8_t> expected;
+            };
+
+            Simulator &sim;
+            bool verify;
+            std::unordered_map<uint32_t, Routine> routines;
+            std::optional<Pending> pending;
+            Counter calls;
+            Counter verified;
+            Counter mismatches;
+
+            static const char *name(Routine routine);
+            // Works out what a call would do, or nothing if it has to be interpreted
+            std::optional<Call> evaluate(Routine routine);
+            void check(const Pending &pending);
+            // Does the work of `enter`, which may throw
+            bool handle(uint32_t pc);
+
+        public:
+            /*!
+             * \brief Intercepts the routines in `hle.functions`
+             * \throws SimulatorException if one of them is not supported
+             */
+            HLE(Simulator &sim, ELFFile &elf);
+            ~HLE();
+            HLE(HLE const&) = delete;
+            void operator=(HLE const&) = delete;
+
+            /*!
+             * \brief Handles a fetch from an intercepted address
+             *
+             * If anything fails along the way, such as an allocation, the
+             * call is left to be interpreted.
+             *
+             * \return Whether the call was run natively, in which case the
+             *         simulator has already returned from it. If not, the
+             *         instruction at the PC should be executed as usual.
+             */
+            bool enter(uint32_t pc) noexcept;
+    };
+}
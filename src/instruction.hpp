@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 
@@ -10,6 +11,7 @@ namespace lc32sim {
         RTI, LSHF, RSHFL, RSHFA,
         STB, STH, STW, TRAP, XOR
     };
+    const size_t NUM_INSTRUCTION_TYPES = static_cast<size_t>(InstructionType::XOR) + 1;
     enum class TrapVector : uint8_t {
         // Note that PUTSP is not defined. This is because we're on a
         // byte-addressible architecture, so packing bytes into memory words
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <any>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <vector>
@@ -33,8 +35,93 @@ namespace lc32sim {
     // Returns a random number on read
     const uint32_t RNG_ADDR = 0xF000001C;
 
-    // Others
+    // Filesystem device
+    //
+    // The low half of the control register holds the mode and the high half
+    // the file descriptor. Arguments go in the three data registers after it.
+    //
+    // Setting FS_MODE_ASYNC in the mode queues the operation on an I/O thread
+    // instead of running it immediately. The status register then reads
+    // FS_STATUS_BUSY until the operation finishes, after which it reads
+    // FS_STATUS_DONE and the result register holds what the synchronous
+    // operation would have returned. Only one asynchronous operation runs at a
+    // time; submitting another waits for the previous one to finish.
+    //
+    // The mmap mode maps a range of an open file copy-on-write at a guest
+    // address, given as (address, length, file offset) in the data registers.
+    // It returns the number of bytes mapped. Only whole pages are mapped, and
+    // a last partial page of the file is copied instead. The munmap mode takes
+    // (address, length) of a mapping made by mmap, which it must cover, and
+    // replaces the mapped pages with fresh memory. Both always complete
+    // before the write to the control register returns, even with
+    // FS_MODE_ASYNC set.
     const uint32_t FS_CONTROLLER_ADDR = 0xF0000020;
+    const uint32_t FS_STATUS_ADDR = 0xF0000030;
+    const uint32_t FS_RESULT_ADDR = 0xF0000034;
+    const uint16_t FS_MODE_ASYNC = 0x8000;
+    const uint32_t FS_STATUS_IDLE = 0;
+    const uint32_t FS_STATUS_BUSY = 1;
+    const uint32_t FS_STATUS_DONE = 2;
+
+    // Console input device
+    //
+    // Non-blocking access to the same input as the GETC and IN TRAPs. The
+    // status register has CONSOLE_STATUS_READY set while a character is
+    // waiting, and CONSOLE_STATUS_EOF set once input has run out and nothing
+    // is left. Reading the data register takes the next character, or returns
+    // -1 if none is waiting.
+    const uint32_t CONSOLE_STATUS_ADDR = 0xF0000040;
+    const uint32_t CONSOLE_DATA_ADDR = 0xF0000044;
+    const uint32_t CONSOLE_STATUS_READY = 1;
+    const uint32_t CONSOLE_STATUS_EOF = 2;
+
+    // Performance counter device
+    //
+    // Read-only 64-bit counters for programs to time themselves with. Each
+    // has its low word at the given address and its high word right after.
+    // Reading has no side effects, so the high word can change between the
+    // two loads. To read a counter whole, read the high word, then the low
+    // word, then the high word again, and retry if the two high words differ.
+    //
+    // PERF_INSTRET counts instructions executed, including the load reading
+    // it. PERF_CYCLES counts cycles, with each instruction costing what the
+    // `perf` config gives its kind. PERF_FRAMES counts frames the video timing
+    // has finished. PERF_HOST_NS is a monotonic host clock, in nanoseconds.
+    const uint32_t PERF_INSTRET_ADDR = 0xF0000050;
+    const uint32_t PERF_CYCLES_ADDR = 0xF0000058;
+    const uint32_t PERF_FRAMES_ADDR = 0xF0000060;
+    const uint32_t PERF_HOST_NS_ADDR = 0xF0000068;
+
+    // Hart control device
+    //
+    // Starts more harts, each running on its own host thread over the same
+    // memory. To start one, write its entry point, stack pointer, and
+    // argument to HART_PC, HART_SP, and HART_ARG, then read HART_START. The
+    // new hart begins at that PC, with the stack pointer in R6 and R5 and the
+    // argument in R0, and the read returns its id, or HART_NONE if
+    // `harts.count` harts are already running. A hart stops at HALT, or when
+    // it faults. Writing a hart's id to HART_JOIN waits for it to stop, after
+    // which reading HART_JOIN gives the R0 it halted with, or HART_NONE if it
+    // faulted. HART_ID reads as the id of the hart reading it, which is 0 for
+    // the one the program started on.
+    //
+    // Reading ATOMIC_CAS stores ATOMIC_VALUE to the word at ATOMIC_ADDR if it
+    // holds ATOMIC_EXPECTED, and reading ATOMIC_ADD adds ATOMIC_VALUE to it.
+    // Both happen atomically and return the word's old value. Every hart has
+    // its own copy of the registers written before a start, join, or atomic
+    // operation, so harts do not need a lock around them.
+    const uint32_t HART_PC_ADDR = 0xF0000070;
+    const uint32_t HART_SP_ADDR = 0xF0000074;
+    const uint32_t HART_ARG_ADDR = 0xF0000078;
+    const uint32_t HART_START_ADDR = 0xF000007C;
+    const uint32_t HART_JOIN_ADDR = 0xF0000080;
+    const uint32_t HART_ID_ADDR = 0xF0000084;
+    const uint32_t ATOMIC_ADDR_ADDR = 0xF0000088;
+    const uint32_t ATOMIC_EXPECTED_ADDR = 0xF000008C;
+    const uint32_t ATOMIC_VALUE_ADDR = 0xF0000090;
+    const uint32_t ATOMIC_CAS_ADDR = 0xF0000094;
+    const uint32_t ATOMIC_ADD_ADDR = 0xF0000098;
+    const uint32_t HART_NONE = 0xFFFFFFFF;
 
     using read_handler = std::function<uint32_t(uint32_t)>;
     using write_handler = std::function<uint32_t(uint32_t, uint32_t)>;
@@ -46,5 +133,26 @@ namespace lc32sim {
             virtual std::string get_name() = 0;
             virtual read_handlers get_read_handlers() { return {}; };
             virtual write_handlers get_write_handlers() { return {}; };
+
+            /*
+             * Devices whose behavior depends only on guest memory and their
+             * own state can have that state saved and restored, so they are
+             * simply run again when recorded execution is replayed. Anything
+             * else is treated as outside input: reads from it are replayed
+             * from a log, and writes to it are not repeated.
+             */
+            virtual bool replayable() { return false; }
+            /*
+             * Whether write handlers also store to the device's other
+             * registers, which a recording then has to keep as well
+             */
+            virtual bool writes_registers() { return false; }
+            /*
+             * Whether harts other than hart 0 can use the device's registers,
+             * which its handlers then have to allow from any thread
+             */
+            virtual bool shared_by_harts() { return false; }
+            virtual std::any save_state() { return {}; }
+            virtual void restore_state(const std::any &state) {}
     };
 }
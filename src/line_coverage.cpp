@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+#include "exceptions.hpp"
+#include "line_coverage.hpp"
+#include "line_table.hpp"
+
+namespace lc32sim {
+    LineCoverage::LineCoverage(ELFFile &elf) {
+        std::tie(this->base, this->size) = elf.get_executable_range();
+        // A bit per halfword, 64 to a word
+        this->executed.resize((static_cast<uint64_t>(this->size) + 127) / 128);
+    }
+
+    bool LineCoverage::executed_any(uint32_t start, uint32_t end) const {
+        for (uint64_t addr = start & ~UINT32_C(1); addr < end; addr += 2) {
+            uint64_t offset = addr - this->base;
+            if (addr < this->base || offset >= this->size) {
+                continue;
+            }
+            uint64_t index = offset >> 1;
+            if (this->executed[index >> 6] & (UINT64_C(1) << (index & 63))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void LineCoverage::write_lcov(ELFFile &elf, const std::string &path) const {
+        LineTable table(elf);
+        const std::vector<std::string> &files = table.get_files();
+
+        // Whether each line ran, by file path, for output in a stable order
+        std::map<std::string, std::map<uint32_t, bool>> lines;
+        for (const LineTable::Range &range : table.get_ranges()) {
+            bool &hit = lines[files[range.file]][range.line];
+            hit = hit || this->executed_any(range.start, range.end);
+        }
+
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            throw SimulatorException("Could not open coverage report " + path);
+        }
+        out << "TN:\n";
+        for (const auto &[file, file_lines] : lines) {
+            out << "SF:" << file << "\n";
+            size_t hit_count = 0;
+            for (auto [line, hit] : file_lines) {
+                out << "DA:" << line << "," << (hit ? 1 : 0) << "\n";
+                hit_count += hit;
+            }
+            out << "LF:" << file_lines.size() << "\n";
+            out << "LH:" << hit_count << "\n";
+            out << "end_of_record\n";
+        }
+        if (!out) {
+            throw SimulatorException("Could not write coverage report " + path);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elf_file.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Records which instructions ran, for a source line coverage report
+     *
+     * There is a bit for every halfword of the program's executable
+     * segments, so marking an instruction is a bounds check and a bit set.
+     * Instructions outside those segments are not recorded. At the end, the
+     * bits are matched up with `.debug_line` and written out in lcov's
+     * tracefile format. Only whether a line ran is known, so hit counts are
+     * 0 or 1.
+     */
+    class LineCoverage {
+        private:
+            uint32_t base = 0;
+            // Bytes covered, starting at `base`
+            uint32_t size = 0;
+            std::vector<uint64_t> executed;
+
+            // Whether any instruction from `start` up to `end` ran
+            bool executed_any(uint32_t start, uint32_t end) const;
+
+        public:
+            LineCoverage(ELFFile &elf);
+
+            //! Marks the instruction at `pc` as executed
+            inline void mark(uint32_t pc) {
+                uint32_t offset = pc - this->base;
+                if (offset < this->size) {
+                    uint32_t index = offset >> 1;
+                    this->executed[index >> 6] |= UINT64_C(1) << (index & 63);
+                }
+            }
+
+            /*!
+             * \brief Writes an lcov tracefile with a record for every source file
+             * \throws ELFParsingException if the line table cannot be read
+             * \throws SimulatorException if the file cannot be written
+             */
+            void write_lcov(ELFFile &elf, const std::string &path) const;
+    };
+}
@@ -0,0 +1,372 @@
+#include <bit>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+
+#include "exceptions.hpp"
+#include "line_table.hpp"
+
+namespace lc32sim {
+    namespace {
+        // Standard opcodes
+        const uint8_t DW_LNS_copy = 1;
+        const uint8_t DW_LNS_advance_pc = 2;
+        const uint8_t DW_LNS_advance_line = 3;
+        const uint8_t DW_LNS_set_file = 4;
+        const uint8_t DW_LNS_const_add_pc = 8;
+        const uint8_t DW_LNS_fixed_advance_pc = 9;
+        // Extended opcodes
+        const uint8_t DW_LNE_end_sequence = 1;
+        const uint8_t DW_LNE_set_address = 2;
+        const uint8_t DW_LNE_define_file = 3;
+
+        // Entry formats in DWARF 5 headers
+        const uint64_t DW_LNCT_path = 1;
+        const uint64_t DW_LNCT_directory_index = 2;
+        const uint64_t DW_FORM_data2 = 0x05;
+        const uint64_t DW_FORM_data4 = 0x06;
+        const uint64_t DW_FORM_data8 = 0x07;
+        const uint64_t DW_FORM_string = 0x08;
+        const uint64_t DW_FORM_block = 0x09;
+        const uint64_t DW_FORM_block1 = 0x0a;
+        const uint64_t DW_FORM_data1 = 0x0b;
+        const uint64_t DW_FORM_sdata = 0x0d;
+        const uint64_t DW_FORM_strp = 0x0e;
+        const uint64_t DW_FORM_udata = 0x0f;
+        const uint64_t DW_FORM_data16 = 0x1e;
+        const uint64_t DW_FORM_line_strp = 0x1f;
+
+        // Reads DWARF encodings from one section, checking every access
+        class Cursor {
+            private:
+                const std::vector<uint8_t> &data;
+                bool swap;
+
+                void need(size_t n) const {
+                    if (this->end - this->pos < n) {
+                        throw ELFParsingException("Unexpected end of .debug_line");
+                    }
+                }
+
+            public:
+                size_t pos = 0;
+                size_t end;
+
+                Cursor(const std::vector<uint8_t> &data, bool swap) : data(data), swap(swap), end(data.size()) {}
+
+                template<typename T> T fixed() {
+                    this->need(sizeof(T));
+                    T val;
+                    std::memcpy(&val, &this->data[this->pos], sizeof(T));
+                    this->pos += sizeof(T);
+                    if constexpr (sizeof(T) > 1) {
+                        if (this->swap) {
+                            val = std::byteswap(val);
+                        }
+                    }
+                    return val;
+                }
+                // Addresses and offsets, whose size depends on the unit
+                uint64_t sized(size_t size) {
+                    switch (size) {
+                        case 1: return this->fixed<uint8_t>();
+                        case 2: return this->fixed<uint16_t>();
+                        case 4: return this->fixed<uint32_t>();
+                        case 8: return this->fixed<uint64_t>();
+                        default: throw ELFParsingException("Unsupported address size " + std::to_string(size) + " in .debug_line");
+                    }
+                }
+                uint64_t uleb() {
+                    uint64_t val = 0;
+                    for (unsigned int shift = 0;; shift += 7) {
+                        uint8_t byte = this->fixed<uint8_t>();
+                        if (shift < 64) {
+                            val |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                        }
+                        if (!(byte & 0x80)) {
+                            return val;
+                        }
+                    }
+                }
+                int64_t sleb() {
+                    int64_t val = 0;
+                    unsigned int shift = 0;
+                    uint8_t byte;
+                    do {
+                        byte = this->fixed<uint8_t>();
+                        if (shift < 64) {
+                            val |= static_cast<int64_t>(byte & 0x7f) << shift;
+                        }
+                        shift += 7;
+                    } while (byte & 0x80);
+                    if (shift < 64 && (byte & 0x40)) {
+                        val |= -(INT64_C(1) << shift);
+                    }
+                    return val;
+                }
+                std::string string() {
+                    const uint8_t *start = this->data.data() + this->pos;
+                    const void *nul = std::memchr(start, '\0', this->end - this->pos);
+                    if (!nul) {
+                        throw ELFParsingException("Unterminated string in .debug_line");
+                    }
+                    std::string str(reinterpret_cast<const char*>(start));
+                    this->pos += str.size() + 1;
+                    return str;
+                }
+                void skip(uint64_t n) {
+                    this->need(n);
+                    this->pos += n;
+                }
+        };
+
+        // A string from a string section, like `.debug_line_str`
+        std::string string_at(const std::optional<std::vector<uint8_t>> &section, const char *name, uint64_t offset) {
+            if (!section || offset >= section->size()) {
+                throw ELFParsingException("String offset " + std::to_string(offset) + " is outside " + name);
+            }
+            const uint8_t *start = section->data() + offset;
+            if (!std::memchr(start, '\0', section->size() - offset)) {
+                throw ELFParsingException(std::string("Unterminated string in ") + name);
+            }
+            return std::string(reinterpret_cast<const char*>(start));
+        }
+
+        std::string join_path(const std::string &dir, const std::string &name) {
+            if (dir.empty() || name.empty() || name.front() == '/') {
+                return name;
+            }
+            return dir.back() == '/' ? dir + name : dir + "/" + name;
+        }
+
+        struct Entry {
+            std::string path;
+            uint64_t directory = 0;
+        };
+
+        // A list of directories or files in a DWARF 5 header
+        std::vector<Entry> read_entries(Cursor &cur, size_t offset_size, const std::optional<std::vector<uint8_t>> &line_str, const std::optional<std::vector<uint8_t>> &str) {
+            std::vector<std::pair<uint64_t, uint64_t>> formats(cur.fixed<uint8_t>());
+            for (auto &[content, form] : formats) {
+                content = cur.uleb();
+                form = cur.uleb();
+            }
+            uint64_t count = cur.uleb();
+            // Every entry takes at least a byte for each format
+            if (!formats.empty() && count > cur.end - cur.pos) {
+                throw ELFParsingException("Too many entries in .debug_line header");
+            }
+            std::vector<Entry> entries(count);
+            for (Entry &entry : entries) {
+                for (auto [content, form] : formats) {
+                    std::string text;
+                    uint64_t number = 0;
+                    switch (form) {
+                        case DW_FORM_string: text = cur.string(); break;
+                        case DW_FORM_line_strp: text = string_at(line_str, ".debug_line_str", cur.sized(offset_size)); break;
+                        case DW_FORM_strp: text = string_at(str, ".debug_str", cur.sized(offset_size)); break;
+                        case DW_FORM_udata: number = cur.uleb(); break;
+                        case DW_FORM_sdata: number = cur.sleb(); break;
+                        case DW_FORM_data1: number = cur.fixed<uint8_t>(); break;
+                        case DW_FORM_data2: number = cur.fixed<uint16_t>(); break;
+                        case DW_FORM_data4: number = cur.fixed<uint32_t>(); break;
+                        case DW_FORM_data8: number = cur.fixed<uint64_t>(); break;
+                        case DW_FORM_data16: cur.skip(16); break;
+                        case DW_FORM_block: cur.skip(cur.uleb()); break;
+                        case DW_FORM_block1: cur.skip(cur.fixed<uint8_t>()); break;
+                        default:
+                            throw ELFParsingException("Unsupported form 0x" + int_to_hex(form) + " in .debug_line header");
+                    }
+                    if (content == DW_LNCT_path) {
+                        entry.path = text;
+                    } else if (content == DW_LNCT_directory_index) {
+                        entry.directory = number;
+                    }
+                }
+            }
+            return entries;
+        }
+    }
+
+    LineTable::LineTable(ELFFile &elf) {
+        std::optional<std::vector<uint8_t>> section = elf.read_section(".debug_line");
+        if (!section) {
+            throw ELFParsingException("No .debug_line section; was the program built with debug info?");
+        }
+        std::optional<std::vector<uint8_t>> line_str = elf.read_section(".debug_line_str");
+        std::optional<std::vector<uint8_t>> str = elf.read_section(".debug_str");
+        std::unordered_map<std::string, uint32_t> file_indices;
+
+        Cursor cur(*section, elf.byte_swapped());
+        while (cur.pos < section->size()) {
+            // Unit header
+            size_t offset_size = 4;
+            uint64_t unit_length = cur.fixed<uint32_t>();
+            if (unit_length == 0xffffffff) {
+                offset_size = 8;
+                unit_length = cur.fixed<uint64_t>();
+            }
+            if (unit_length > section->size() - cur.pos) {
+                throw ELFParsingException("Line program unit extends past the end of .debug_line");
+            }
+            size_t unit_end = cur.pos + unit_length;
+            cur.end = unit_end;
+
+            uint16_t version = cur.fixed<uint16_t>();
+            if (version < 2 || version > 5) {
+                throw ELFParsingException("Unsupported .debug_line version " + std::to_string(version));
+            }
+            size_t address_size = 0;
+            if (version >= 5) {
+                address_size = cur.fixed<uint8_t>();
+                cur.skip(1); // segment selector size
+            }
+            uint64_t header_length = cur.sized(offset_size);
+            if (header_length > unit_end - cur.pos) {
+                throw ELFParsingException("Line program header extends past its unit");
+            }
+            size_t program_start = cur.pos + header_length;
+            uint8_t min_inst_length = cur.fixed<uint8_t>();
+            if (version >= 4) {
+                cur.skip(1); // maximum operations per instruction, only for VLIW
+            }
+            cur.skip(1); // whether rows start statements by default
+            int8_t line_base = cur.fixed<int8_t>();
+            uint8_t line_range = cur.fixed<uint8_t>();
+            uint8_t opcode_base = cur.fixed<uint8_t>();
+            if (line_range == 0 || opcode_base == 0) {
+                throw ELFParsingException("Invalid line program header");
+            }
+            std::vector<uint8_t> opcode_lengths(opcode_base - 1);
+            for (uint8_t &length : opcode_lengths) {
+                length = cur.fixed<uint8_t>();
+            }
+
+            // Global file index for each of this unit's file numbers
+            std::vector<std::optional<uint32_t>> unit_files;
+            auto add_file = [&](const std::string &path) {
+                auto [it, inserted] = file_indices.try_emplace(path, this->files.size());
+                if (inserted) {
+                    this->files.push_back(path);
+                }
+                unit_files.push_back(it->second);
+            };
+            std::vector<std::string> directories;
+            if (version >= 5) {
+                // Directory 0 is the compilation directory, and others are
+                // relative to it
+                for (const Entry &dir : read_entries(cur, offset_size, line_str, str)) {
+                    directories.push_back(directories.empty() ? dir.path : join_path(directories.front(), dir.path));
+                }
+                for (const Entry &file : read_entries(cur, offset_size, line_str, str)) {
+                    add_file(join_path(file.directory < directories.size() ? directories[file.directory] : "", file.path));
+                }
+            } else {
+                // Directory 0 is the compilation directory, which is only
+                // in .debug_info, and files are numbered from 1
+                directories.emplace_back();
+                for (std::string dir = cur.string(); !dir.empty(); dir = cur.string()) {
+                    directories.push_back(dir);
+                }
+                unit_files.push_back(std::nullopt);
+                for (std::string name = cur.string(); !name.empty(); name = cur.string()) {
+                    uint64_t dir = cur.uleb();
+                    cur.uleb(); // modification time
+                    cur.uleb(); // length
+                    add_file(join_path(dir < directories.size() ? directories[dir] : "", name));
+                }
+            }
+
+            // Line program. Only the registers that matter for coverage are
+            // tracked; columns, discriminators, and the like are skipped.
+            cur.pos = program_start;
+            uint64_t address = 0;
+            uint64_t file = 1;
+            int64_t line = 1;
+            // The last row in the current sequence, waiting for its end
+            struct Row {
+                uint64_t address;
+                uint64_t file;
+                int64_t line;
+            };
+            std::optional<Row> last;
+            auto emit = [&](bool end_sequence) {
+                if (last && address > last->address && last->line > 0 && last->file < unit_files.size() && unit_files[last->file]) {
+                    this->ranges.push_back(Range{
+                        static_cast<uint32_t>(last->address), static_cast<uint32_t>(address),
+                        *unit_files[last->file], static_cast<uint32_t>(last->line)
+                    });
+                }
+                if (end_sequence) {
+                    last.reset();
+                    address = 0;
+                    file = 1;
+                    line = 1;
+                } else {
+                    last = Row{address, file, line};
+                }
+            };
+            while (cur.pos < unit_end) {
+                uint8_t opcode = cur.fixed<uint8_t>();
+                if (opcode >= opcode_base) {
+                    uint8_t adjusted = opcode - opcode_base;
+                    address += (adjusted / line_range) * min_inst_length;
+                    line += line_base + adjusted % line_range;
+                    emit(false);
+                    continue;
+                }
+                switch (opcode) {
+                    case 0: {
+                        uint64_t length = cur.uleb();
+                        if (length == 0) {
+                            break;
+                        }
+                        size_t next = cur.pos + length;
+                        uint8_t extended = cur.fixed<uint8_t>();
+                        if (extended == DW_LNE_end_sequence) {
+                            emit(true);
+                        } else if (extended == DW_LNE_set_address) {
+                            address = cur.sized(address_size ? address_size : length - 1);
+                        } else if (extended == DW_LNE_define_file && version < 5) {
+                            std::string name = cur.string();
+                            uint64_t dir = cur.uleb();
+                            add_file(join_path(dir < directories.size() ? directories[dir] : "", name));
+                        }
+                        if (next > unit_end) {
+                            throw ELFParsingException("Extended opcode extends past its unit");
+                        }
+                        cur.pos = next;
+                        break;
+                    }
+                    case DW_LNS_copy:
+                        emit(false);
+                        break;
+                    case DW_LNS_advance_pc:
+                        address += cur.uleb() * min_inst_length;
+                        break;
+                    case DW_LNS_advance_line:
+                        line += cur.sleb();
+                        break;
+                    case DW_LNS_set_file:
+                        file = cur.uleb();
+                        break;
+                    case DW_LNS_const_add_pc:
+                        address += ((255 - opcode_base) / line_range) * min_inst_length;
+                        break;
+                    case DW_LNS_fixed_advance_pc:
+                        address += cur.fixed<uint16_t>();
+                        break;
+                    default:
+                        // Includes opcodes newer than this reader, whose
+                        // operand counts are in the header
+                        for (uint8_t i = 0; i < opcode_lengths[opcode - 1]; i++) {
+                            cur.uleb();
+                        }
+                        break;
+                }
+            }
+            cur.pos = unit_end;
+            cur.end = section->size();
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elf_file.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Maps addresses to source lines, from an ELF file's `.debug_line`
+     *
+     * Every line program in the section is run, for DWARF versions 2 through
+     * 5, and the rows it produces are turned into address ranges. Each range
+     * covers the instructions from one row up to the next one in the same
+     * sequence. Rows for line 0, which belong to no line, are left out.
+     */
+    class LineTable {
+        public:
+            struct Range {
+                // Covers `start` up to, but not including, `end`
+                uint32_t start;
+                uint32_t end;
+                // Index into `get_files()`
+                uint32_t file;
+                uint32_t line;
+            };
+
+        private:
+            std::vector<std::string> files;
+            std::vector<Range> ranges;
+
+        public:
+            /*!
+             * \brief Reads the line table of an ELF file
+             * \throws ELFParsingException if the file has no `.debug_line`
+             *         section, or it is malformed
+             */
+            LineTable(ELFFile &elf);
+
+            //! Source file paths, joined with their directories where known
+            const std::vector<std::string> &get_files() const { return this->files; }
+            const std::vector<Range> &get_ranges() const { return this->ranges; }
+    };
+}
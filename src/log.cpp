@@ -1,4 +1,13 @@
 #include <boost/algorithm/string/predicate.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "config.hpp"
 #include "log.hpp"
@@ -12,15 +21,289 @@ namespace lc32sim {
         throw std::invalid_argument("Invalid log level: " + str);
     }
 
+    namespace {
+        /*
+         * Single-producer, single-consumer ring of records. Each record is its
+         * payload size, its level, and then the payload. Positions only ever
+         * increase and are reduced modulo `CAPACITY` when indexing.
+         */
+        struct LogRing {
+            static constexpr uint64_t CAPACITY = static_cast<uint64_t>(1) << 20;
+            std::unique_ptr<char[]> data = std::make_unique<char[]>(CAPACITY);
+            std::atomic<uint64_t> head = 0; // written by the owning thread
+            std::atomic<uint64_t> tail = 0; // written by the formatter
+
+            void copy_in(uint64_t pos, const void *src, size_t size) {
+                uint64_t offset = pos & (CAPACITY - 1);
+                size_t first = std::min<uint64_t>(size, CAPACITY - offset);
+                std::memcpy(this->data.get() + offset, src, first);
+                std::memcpy(this->data.get(), static_cast<const char*>(src) + first, size - first);
+            }
+            void copy_out(uint64_t pos, void *dst, size_t size) const {
+                uint64_t offset = pos & (CAPACITY - 1);
+                size_t first = std::min<uint64_t>(size, CAPACITY - offset);
+                std::memcpy(dst, this->data.get() + offset, first);
+                std::memcpy(static_cast<char*>(dst) + first, this->data.get(), size - first);
+            }
+        };
+        const size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(LogLevel);
+
+        void format_record(std::ostringstream &out, LogLevel level, const char *payload, size_t size) {
+            out.str("");
+            out.clear();
+            out.flags(std::ios_base::dec | std::ios_base::skipws);
+            out.fill(' ');
+            out.width(0);
+            out.precision(6);
+
+            #define write_prefix(level_name, lower, stream) case LogLevel::level_name: out << "["#level_name"] "; break;
+            switch (level) {
+                FOR_EACH_LOG_LEVEL(write_prefix)
+                default: break;
+            }
+            #undef write_prefix
+
+            const char *p = payload;
+            const char *end = payload + size;
+            auto take = [&p]<typename T>() {
+                T val;
+                std::memcpy(&val, p, sizeof(T));
+                p += sizeof(T);
+                return val;
+            };
+            while (p < end) {
+                LogArg tag = static_cast<LogArg>(*p++);
+                switch (tag) {
+                    case LogArg::BOOL: out << take.operator()<bool>(); break;
+                    case LogArg::CHAR: out << take.operator()<char>(); break;
+                    case LogArg::I16: out << take.operator()<int16_t>(); break;
+                    case LogArg::I32: out << take.operator()<int32_t>(); break;
+                    case LogArg::I64: out << take.operator()<int64_t>(); break;
+                    case LogArg::U16: out << take.operator()<uint16_t>(); break;
+                    case LogArg::U32: out << take.operator()<uint32_t>(); break;
+                    case LogArg::U64: out << take.operator()<uint64_t>(); break;
+                    case LogArg::DOUBLE: out << take.operator()<double>(); break;
+                    case LogArg::STRING: {
+                        uint32_t len = take.operator()<uint32_t>();
+                        out << std::string_view(p, len);
+                        p += len;
+                        break;
+                    }
+                    case LogArg::FLAGS: out << take.operator()<log_detail::FlagsManipulator>(); break;
+                    case LogArg::SETW: out.width(take.operator()<int32_t>()); break;
+                    case LogArg::SETFILL: out.fill(take.operator()<char>()); break;
+                }
+            }
+        }
+
+        std::ostream &stream_for(LogLevel level) {
+            #define select_stream(level_name, lower, stream) case LogLevel::level_name: return stream;
+            switch (level) {
+                FOR_EACH_LOG_LEVEL(select_stream)
+                default: return std::cerr;
+            }
+            #undef select_stream
+        }
+
+        /*
+         * Owns every thread's ring and the thread that formats them. Rings are
+         * drained every `POLL_INTERVAL`, or sooner when a producer asks.
+         */
+        class LogBackend {
+            private:
+                static constexpr std::chrono::milliseconds POLL_INTERVAL{10};
+
+                std::mutex lock;
+                std::condition_variable wake;
+                std::condition_variable drained;
+                std::vector<std::shared_ptr<LogRing>> rings;
+                std::thread formatter;
+                bool stopping = false;
+                bool drain_requested = false;
+                bool draining = false;
+                uint64_t passes = 0;
+
+                void formatter_loop() {
+                    std::ostringstream out;
+                    std::vector<char> payload;
+                    std::unique_lock<std::mutex> guard(this->lock);
+                    while (true) {
+                        this->wake.wait_for(guard, POLL_INTERVAL, [this]() { return this->stopping || this->drain_requested; });
+                        bool stop = this->stopping;
+                        this->drain_requested = false;
+                        this->draining = true;
+                        std::vector<std::shared_ptr<LogRing>> snapshot = this->rings;
+                        guard.unlock();
+
+                        bool wrote_cout = false, wrote_cerr = false;
+                        for (auto &ring : snapshot) {
+                            uint64_t pos = ring->tail.load(std::memory_order_relaxed);
+                            uint64_t end = ring->head.load(std::memory_order_acquire);
+                            while (pos < end) {
+                                uint32_t size;
+                                LogLevel level;
+                                ring->copy_out(pos, &size, sizeof(size));
+                                ring->copy_out(pos + sizeof(size), &level, sizeof(level));
+                                payload.resize(size);
+                                ring->copy_out(pos + RECORD_HEADER_SIZE, payload.data(), size);
+                                pos += RECORD_HEADER_SIZE + size;
+
+                                format_record(out, level, payload.data(), size);
+                                std::ostream &stream = stream_for(level);
+                                stream << out.view() << '\n';
+                                (&stream == &std::cout ? wrote_cout : wrote_cerr) = true;
+                            }
+                            ring->tail.store(end, std::memory_order_release);
+                        }
+                        if (wrote_cout) {
+                            std::cout.flush();
+                        }
+                        if (wrote_cerr) {
+                            std::cerr.flush();
+                        }
+                        snapshot.clear();
+
+                        guard.lock();
+                        // Forget rings whose threads have exited once they are empty
+                        std::erase_if(this->rings, [](const std::shared_ptr<LogRing> &ring) {
+                            return ring.use_count() == 1 && ring->tail.load() == ring->head.load();
+                        });
+                        this->draining = false;
+                        this->passes++;
+                        this->drained.notify_all();
+                        if (stop) {
+                            return;
+                        }
+                    }
+                }
+
+            public:
+                void add(std::shared_ptr<LogRing> ring) {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->rings.push_back(std::move(ring));
+                    if (!this->formatter.joinable() && !this->stopping) {
+                        this->formatter = std::thread(&LogBackend::formatter_loop, this);
+                    }
+                }
+
+                // Set once the formatter has shut down for good
+                std::atomic<bool> stopped = false;
+
+                // Waits for a full pass over the rings that started after this call
+                void flush() {
+                    std::unique_lock<std::mutex> guard(this->lock);
+                    if (!this->formatter.joinable() || this->stopping || std::this_thread::get_id() == this->formatter.get_id()) {
+                        return;
+                    }
+                    uint64_t target = this->passes + (this->draining ? 2 : 1);
+                    this->drain_requested = true;
+                    this->wake.notify_one();
+                    this->drained.wait(guard, [this, target]() { return this->passes >= target || this->stopping; });
+                }
+
+                void stop() {
+                    {
+                        std::lock_guard<std::mutex> guard(this->lock);
+                        this->stopping = true;
+                    }
+                    this->wake.notify_all();
+                    // The last pass picks up everything still queued
+                    if (this->formatter.joinable()) {
+                        this->formatter.join();
+                    }
+                    this->stopped.store(true, std::memory_order_release);
+                }
+        };
+        LogBackend backend;
+
+        struct ThreadLog {
+            std::shared_ptr<LogRing> ring;
+            // One buffer per nested `Line`, in case formatting an argument logs
+            std::vector<std::string> records;
+            size_t depth = 0;
+        };
+        thread_local ThreadLog thread_log;
+    }
+
+    std::string *begin_record() {
+        if (thread_log.depth == thread_log.records.size()) {
+            thread_log.records.emplace_back();
+        }
+        std::string *record = &thread_log.records[thread_log.depth++];
+        record->clear();
+        return record;
+    }
+
+    void commit_record(LogLevel level) {
+        std::string &record = thread_log.records[--thread_log.depth];
+        uint64_t total = RECORD_HEADER_SIZE + record.size();
+
+        if (total > LogRing::CAPACITY || backend.stopped.load(std::memory_order_acquire)) {
+            // Too big for the ring, or the formatter is gone, so write it out
+            // directly behind everything before it
+            backend.flush();
+            std::ostringstream out;
+            format_record(out, level, record.data(), record.size());
+            stream_for(level) << out.view() << std::endl;
+            return;
+        }
+
+        if (!thread_log.ring) {
+            thread_log.ring = std::make_shared<LogRing>();
+            backend.add(thread_log.ring);
+        }
+        LogRing &ring = *thread_log.ring;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        while (LogRing::CAPACITY - (head - ring.tail.load(std::memory_order_acquire)) < total) {
+            backend.flush();
+        }
+
+        uint32_t size = record.size();
+        ring.copy_in(head, &size, sizeof(size));
+        ring.copy_in(head + sizeof(size), &level, sizeof(level));
+        ring.copy_in(head + RECORD_HEADER_SIZE, record.data(), size);
+        ring.head.store(head + total, std::memory_order_release);
+
+        // Errors are written out before the caller moves on
+        if (LogLevel::ERROR <= level) {
+            backend.flush();
+        }
+    }
+
     void Logger::initialize(std::string log_level_string) {
         LogLevel log_level = LogLevelFromString(log_level_string);
-        #define initialize_log(level, lower, stream) lower = log_level <= LogLevel::level ? Log(&stream, "["#level"] ") : Log();
+        #define initialize_log(level, lower, stream) set_enabled(lower, log_level <= LogLevel::level);
         FOR_EACH_LOG_LEVEL(initialize_log)
         #undef initialize_log
+
+        if (!(MIN_LOG_LEVEL <= log_level)) {
+            this->warn << "Log level " << log_level_string << " is below the minimum level compiled in; lower levels are unavailable";
+        }
+    }
+
+    void Logger::flush() {
+        backend.flush();
+    }
+
+    void Logger::stop_formatter() {
+        backend.stop();
     }
 
     Logger::Logger() {
         initialize(DEFAULT_LOG_LEVEL);
+
+        // Get queued lines out before an uncaught exception kills the process
+        static std::terminate_handler previous = std::set_terminate([]() {
+            backend.flush();
+            if (previous) {
+                previous();
+            }
+            std::abort();
+        });
+    }
+
+    Logger::~Logger() {
+        backend.stop();
     }
 
     Logger logger;
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 
 #include "config.hpp"
@@ -18,6 +23,12 @@
     X(ERROR, error, std::cerr) \
     X(FATAL, fatal, std::cerr)
 
+// Levels below this are compiled out entirely. Set through the CMake cache
+// variable of the same name.
+#ifndef LC32SIM_MIN_LOG_LEVEL
+#define LC32SIM_MIN_LOG_LEVEL TRACE
+#endif
+
 namespace lc32sim {
     enum class LogLevel {
         #define initialize_enum(level, lower, stream) level,
@@ -25,61 +36,166 @@ namespace lc32sim {
         #undef initialize_enum
         NUM_LOG_LEVELS
     };
-    inline bool operator<=(LogLevel a, LogLevel b) {
+    constexpr bool operator<=(LogLevel a, LogLevel b) {
         return std::to_underlying(a) <= std::to_underlying(b);
     }
+    constexpr LogLevel MIN_LOG_LEVEL = LogLevel::LC32SIM_MIN_LOG_LEVEL;
+
+    /*
+     * Log lines are not formatted by the thread that writes them. Each line is
+     * recorded as its level followed by every argument as a one-byte tag and
+     * its raw value, and a background thread formats it later. Arguments that
+     * are not primitives, strings, or one of the manipulators below are
+     * formatted into a string on the spot.
+     */
+    enum class LogArg : uint8_t {
+        BOOL, CHAR, I16, I32, I64, U16, U32, U64, DOUBLE, STRING,
+        FLAGS, // a manipulator like `std::hex`
+        SETW,
+        SETFILL,
+    };
+
+    namespace log_detail {
+        using FlagsManipulator = std::ios_base &(*)(std::ios_base &);
+        using Setw = decltype(std::setw(0));
+        using Setfill = decltype(std::setfill('0'));
+
+        template<typename T> inline void put(std::string &record, LogArg tag, T val) {
+            record.push_back(static_cast<char>(tag));
+            record.append(reinterpret_cast<const char*>(&val), sizeof(val));
+        }
+        inline void put_string(std::string &record, std::string_view str) {
+            put(record, LogArg::STRING, static_cast<uint32_t>(str.size()));
+            record.append(str);
+        }
+        // The standard does not say what is inside `std::setw` and
+        // `std::setfill`, so read the values back off a scratch stream
+        inline std::ostream &scratch() {
+            thread_local std::ostringstream stream;
+            return stream;
+        }
+
+        template<typename T> inline void encode(std::string &record, const T &t) {
+            if constexpr (std::is_same_v<T, bool>) {
+                put(record, LogArg::BOOL, t);
+            } else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>) {
+                put(record, LogArg::CHAR, static_cast<char>(t));
+            } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+                if constexpr (sizeof(T) <= 2) {
+                    put(record, LogArg::I16, static_cast<int16_t>(t));
+                } else if constexpr (sizeof(T) <= 4) {
+                    put(record, LogArg::I32, static_cast<int32_t>(t));
+                } else {
+                    put(record, LogArg::I64, static_cast<int64_t>(t));
+                }
+            } else if constexpr (std::is_integral_v<T>) {
+                if constexpr (sizeof(T) <= 2) {
+                    put(record, LogArg::U16, static_cast<uint16_t>(t));
+                } else if constexpr (sizeof(T) <= 4) {
+                    put(record, LogArg::U32, static_cast<uint32_t>(t));
+                } else {
+                    put(record, LogArg::U64, static_cast<uint64_t>(t));
+                }
+            } else if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+                put(record, LogArg::DOUBLE, static_cast<double>(t));
+            } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                put_string(record, std::string_view(t));
+            } else if constexpr (std::is_function_v<T> && std::is_convertible_v<const T&, FlagsManipulator>) {
+                put(record, LogArg::FLAGS, static_cast<FlagsManipulator>(t));
+            } else if constexpr (std::is_same_v<T, Setw>) {
+                scratch() << t;
+                put(record, LogArg::SETW, static_cast<int32_t>(scratch().width(0)));
+            } else if constexpr (std::is_same_v<T, Setfill>) {
+                scratch() << t;
+                put(record, LogArg::SETFILL, scratch().fill());
+            } else {
+                std::ostringstream formatted;
+                formatted << t;
+                put_string(record, formatted.view());
+            }
+        }
+    }
+
+    // Hand out and take back the calling thread's record buffer
+    std::string *begin_record();
+    void commit_record(LogLevel level);
 
     class Line {
         private:
-            std::ostream *out;
-            std::ios_base::fmtflags flags;
+            LogLevel level;
+            // Null if the level is disabled at runtime
+            std::string *record;
         public:
-            Line(std::ostream *out, std::ios_base::fmtflags flags) : out(out), flags(flags) {}
+            template<typename T> Line(LogLevel level, bool enabled, const T& t) : level(level), record(enabled ? begin_record() : nullptr) {
+                *this << t;
+            }
             ~Line() {
-                if (out) {
-                    *out << std::endl;
-                    out->flags(flags);
+                if (record) {
+                    commit_record(level);
                 }
             }
+            Line(Line const&) = delete;
+            void operator=(Line const&) = delete;
             template<typename T> inline Line &operator<<(const T& t) {
-                if (out) {
-                    *out << t;
+                if (record) {
+                    log_detail::encode(*record, t);
                 }
                 return *this;
             }
     };
     class Log {
         private:
-            std::ostream *out;
-            std::string prefix;
+            LogLevel level;
+            bool on = false;
         public:
-            Log() : out(nullptr), prefix("") {}
-            Log(std::string prefix) : out(nullptr), prefix(prefix) {}
-            Log(std::ostream *out) : out(out), prefix("") {}
-            Log(std::ostream *out, std::string prefix) : out(out), prefix(prefix) {}
-            bool enabled() {
-                return out != nullptr;
+            constexpr Log(LogLevel level) : level(level) {}
+            bool enabled() const {
+                return on;
             }
-            template<typename T> inline Line operator<<(const T& t) {
-                if (!out) {
-                    return Line(nullptr, std::ios_base::fmtflags());
-                }
-                std::ios_base::fmtflags flags = out->flags();
-                *out << prefix << t;
-                return Line(out, flags);
+            template<typename T> inline Line operator<<(const T& t) const {
+                return Line(level, on, t);
             }
             friend class Logger;
     };
+    //! Stands in for a `Log` whose level is below `LC32SIM_MIN_LOG_LEVEL`
+    class DisabledLog {
+        public:
+            constexpr DisabledLog(LogLevel level) {}
+            static constexpr bool enabled() {
+                return false;
+            }
+            template<typename T> constexpr const DisabledLog &operator<<(const T& t) const {
+                return *this;
+            }
+    };
+    template<LogLevel level> using LogFor = std::conditional_t<MIN_LOG_LEVEL <= level, Log, DisabledLog>;
 
     class Logger {
+        private:
+            template<typename L> static void set_enabled(L &log, bool on) {
+                if constexpr (std::is_same_v<L, Log>) {
+                    log.on = on;
+                }
+            }
+
         public:
-            #define declare_log(level, lower, stream) Log lower;
+            #define declare_log(level, lower, stream) LogFor<LogLevel::level> lower{LogLevel::level};
             FOR_EACH_LOG_LEVEL(declare_log)
             #undef declare_log
 
             void initialize(std::string log_level_string);
+            //! Blocks until everything logged so far by this thread is written out
+            void flush();
+            /*!
+             * \brief Writes out everything queued and stops the background thread
+             *
+             * Lines logged afterwards are written out directly by the thread
+             * logging them. This makes it safe to fork.
+             */
+            void stop_formatter();
             Logger();
+            ~Logger();
 
     };
     extern Logger logger;
-}
\ No newline at end of file
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <argparse/argparse.hpp>
 #include <bitset>
 #include <chrono>
@@ -5,18 +6,33 @@
 #include <exception>
 #include <functional>
 #include <iostream>
+#include <optional>
+#include <thread>
 
+#include "cache_model.hpp"
 #include "clock.hpp"
 #include "display.hpp"
 #include "dma_controller.hpp"
 #include "config.hpp"
 #include "elf_file.hpp"
 #include "filesystem.hpp"
+#include "frame_hash.hpp"
+#include "fuzzer.hpp"
+#include "gdb_stub.hpp"
+#include "hart_control.hpp"
+#include "hle.hpp"
 #include "instruction.hpp"
+#include "line_coverage.hpp"
 #include "log.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
+#include "perf_counters.hpp"
+#include "recorder.hpp"
 #include "rng.hpp"
+#include "scheduler.hpp"
 #include "sim.hpp"
+#include "simpoint.hpp"
+#include "video_timing.hpp"
 
 using lc32sim::logger;
 using lc32sim::Config;
@@ -30,6 +46,33 @@ int main(int argc, char *argv[]) {
     program.add_argument("-s", "--software-rendering").help("disable hardware-accelerated rendering, even if enabled in config").default_value(false).implicit_value(true);
     program.add_argument("-l", "--log-level").help("set minimum log level to be displayed; lower levels are suppressed").default_value(std::string("use-config"));
     program.add_argument("-H", "--headless").help("run simulator without a display").default_value(false).implicit_value(true);
+    program.add_argument("-t", "--turbo").help("run as fast as possible instead of locking to the configured framerate").default_value(false).implicit_value(true);
+    program.add_argument("--fast-forward").help("run at a multiple of the configured framerate").scan<'g', double>();
+    program.add_argument("--frame-skip").help("present one frame, then skip this many").scan<'u', unsigned int>();
+    program.add_argument("--console-flush").help("when to write out guest output: newline, size, interval, or halt");
+    program.add_argument("--capture-output").help("also write everything the guest prints to the given file");
+    program.add_argument("-i", "--input").help("read console input from the given file instead of standard input");
+    program.add_argument("--metrics").help("write runtime metrics as JSON to the given file at exit and on SIGUSR1");
+    program.add_argument("--metrics-interval").help("also write metrics every given number of milliseconds").scan<'u', unsigned int>();
+    program.add_argument("--frame-hashes").help("write a hash of the framebuffer at every VBlank to the given file");
+    program.add_argument("--watch").help("report guest writes to ADDR[:LEN], 4 bytes by default").append();
+    program.add_argument("--rwatch").help("report guest reads of ADDR[:LEN]").append();
+    program.add_argument("--awatch").help("report guest reads of and writes to ADDR[:LEN]").append();
+    program.add_argument("--watch-stop").help("stop the program at the first watchpoint hit").default_value(false).implicit_value(true);
+    program.add_argument("--gdb").help("wait for a debugger on the given Unix socket before running");
+    program.add_argument("--reverse").help("record execution so the debugger can run it backwards").default_value(false).implicit_value(true);
+    program.add_argument("--checkpoint-interval").help("instructions between reverse execution checkpoints").scan<'u', uint64_t>();
+    program.add_argument("--reverse-memory").help("memory budget for reverse execution, in MiB").scan<'u', uint64_t>();
+    program.add_argument("--fuzz").help("run as an AFL fork server, starting each test case where the program first reads input").default_value(false).implicit_value(true);
+    program.add_argument("--simpoint").help("estimate cache behaviour from representative intervals, measured in parallel, and write a JSON report to the given file");
+    program.add_argument("--simpoint-interval").help("instructions in each interval profiled for --simpoint").scan<'u', uint64_t>();
+    program.add_argument("--fuzz-budget").help("instructions a test case may run before it counts as a hang").scan<'u', uint64_t>();
+    program.add_argument("--coverage").help("write source line coverage to the given lcov tracefile when the program ends");
+    program.add_argument("--cache-report").help("model caches and a TLB, and write their hits and misses as JSON to the given file when the program ends");
+    program.add_argument("--harts").help("most harts the program can run at once, or one per host core if 0").scan<'u', unsigned int>();
+    program.add_argument("--hle").help("run the given comma-separated libc routines natively, or all of them");
+    program.add_argument("--hle-verify").help("interpret the routines given to --hle, checking each call against running it natively").default_value(false).implicit_value(true);
+    program.add_argument("--golden-frame-hashes").help("compare framebuffer hashes against the given file, stopping at the first divergent frame");
 
     try {
         program.parse_args(argc, argv);
@@ -48,7 +91,30 @@ int main(int argc, char *argv[]) {
         std::cout << program;
         exit(0);
     }
-    bool headless = program.get<bool>("--headless");
+    bool fuzz = program.get<bool>("--fuzz");
+    auto simpoint_report = program.present("--simpoint");
+    if (fuzz && simpoint_report) {
+        logger.warn << "--simpoint cannot be used with --fuzz, ignoring";
+        simpoint_report.reset();
+    }
+    // Windows and their threads cannot be forked
+    bool headless = program.get<bool>("--headless") || fuzz || simpoint_report;
+    auto frame_hashes = program.present("--frame-hashes");
+    auto golden_frame_hashes = program.present("--golden-frame-hashes");
+    auto gdb_socket = program.present("--gdb");
+    if (fuzz && gdb_socket) {
+        logger.warn << "--gdb cannot be used with --fuzz, ignoring";
+        gdb_socket.reset();
+    }
+    if (simpoint_report && gdb_socket) {
+        logger.warn << "--gdb cannot be used with --simpoint, ignoring";
+        gdb_socket.reset();
+    }
+    bool reverse = program.get<bool>("--reverse");
+    if (reverse && !gdb_socket) {
+        logger.warn << "--reverse needs --gdb, ignoring";
+        reverse = false;
+    }
 
     lc32sim::config_instance.load_config(program);
 
@@ -58,53 +124,156 @@ int main(int argc, char *argv[]) {
     sim.mem.load_elf(elf);
     sim.pc = elf.get_header().entry;
 
-    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-    uint64_t instructions_executed = 0;
+    std::optional<lc32sim::LineCoverage> line_coverage;
+    if (!Config.coverage.output_file.empty() && !fuzz && !simpoint_report) {
+        line_coverage.emplace(elf);
+        sim.line_coverage = &*line_coverage;
+    }
+    std::optional<lc32sim::CacheModel> cache_model;
+    if (!Config.cache.output_file.empty() && !fuzz && !simpoint_report) {
+        cache_model.emplace(elf);
+        sim.cache_model = &*cache_model;
+    }
+    // Both need to see every access the routines make
+    std::optional<lc32sim::HLE> hle;
+    if (!Config.hle.functions.empty()) {
+        if (cache_model || simpoint_report) {
+            logger.warn << "--hle cannot be used with --cache-report or --simpoint, ignoring";
+        } else {
+            hle.emplace(sim, elf);
+            sim.hle = &*hle;
+        }
+    }
+    auto write_reports = [&]() {
+        if (line_coverage) {
+            try {
+                line_coverage->write_lcov(elf, Config.coverage.output_file);
+            } catch (const std::exception &e) {
+                logger.error << "Could not write coverage report: " << e.what();
+            }
+        }
+        if (cache_model) {
+            try {
+                cache_model->write_report(elf, Config.cache.output_file);
+            } catch (const std::exception &e) {
+                logger.error << "Could not write cache report: " << e.what();
+            }
+        }
+    };
 
-    uint64_t vsyncs = 0;
+    bool watch_stop = program.get<bool>("--watch-stop");
+    bool watching = false;
+    for (auto [option, kind] : {std::pair{"--watch", lc32sim::WatchKind::WRITE}, std::pair{"--rwatch", lc32sim::WatchKind::READ}, std::pair{"--awatch", lc32sim::WatchKind::ACCESS}}) {
+        auto specs = program.present<std::vector<std::string>>(option);
+        for (const std::string &spec : specs.value_or(std::vector<std::string>())) {
+            try {
+                size_t colon = spec.find(':');
+                uint32_t start = std::stoul(spec.substr(0, colon), nullptr, 0);
+                uint32_t length = colon == std::string::npos ? 4 : std::stoul(spec.substr(colon + 1), nullptr, 0);
+                sim.mem.add_watchpoint(lc32sim::Watchpoint{start, length, kind, watch_stop});
+                watching = true;
+            } catch (const std::exception &e) {
+                logger.error << "Invalid watchpoint " << spec << ": " << e.what();
+                exit(1);
+            }
+        }
+    }
 
-    sim.register_io_device(new lc32sim::DMAController(sim.mem));
-    sim.register_io_device(new lc32sim::Filesystem(sim.mem));
+    // Display timing is emulated even when headless, since guests may
+    // wait on VBlank or use deferred DMA
+    lc32sim::VideoTiming timing(sim.scheduler);
+    sim.register_io_device(timing);
+
+    sim.register_io_device(new lc32sim::DMAController(sim.mem, timing));
+    lc32sim::Filesystem *filesystem = new lc32sim::Filesystem(sim.mem);
+    // Recording needs filesystem operations to land at a deterministic
+    // point, and forking leaves the I/O thread behind
+    filesystem->synchronous = reverse || fuzz || simpoint_report;
+    sim.register_io_device(filesystem);
     sim.register_io_device(new lc32sim::Clock());
     sim.register_io_device(new lc32sim::RNG());
-
-    if (headless) {
-        while (sim.step()) {
-            instructions_executed++;
+    sim.register_io_device(new lc32sim::PerfCounters(sim, timing));
+    // Forking, recording, debugging, and watchpoints all follow a single
+    // thread, and natively run routines change intercepts as they go
+    unsigned int hart_count = Config.harts.count ? Config.harts.count : std::max(1u, std::thread::hardware_concurrency());
+    if (fuzz || simpoint_report || gdb_socket || watching || hle) {
+        if (Config.harts.count > 1) {
+            logger.warn << "Extra harts cannot be used with --fuzz, --simpoint, --gdb, --hle, or watchpoints, ignoring";
         }
-        instructions_executed++;
-    } else {
-        unsigned int scanline_max = Config.display.height + Config.display.vblank_length;
-        if (scanline_max > std::numeric_limits<uint16_t>().max()) {
-            logger.error << "Display height + vblank length exceeds range of uint16_t";
-            exit(1);
-        }
-        uint16_t scanline = 0;
-        lc32sim::Display display = lc32sim::Display(scanline);
-
-        sim.register_io_device(display);
-        
-        while (true) {
-            for (scanline = 0; scanline < scanline_max; scanline++) {
-                for (unsigned int instruction = 0; instruction < Config.display.instructions_per_scanline; instruction++) {
-                    instructions_executed++;
-                    if (!sim.step()) {
-                        goto done;
-                    }
-                }
-                
-                if (!display.update(sim)) {
-                    goto done;
+        hart_count = 1;
+    }
+    // Declared after the simulator, so extra harts stop before it goes
+    lc32sim::HartControl harts(sim, hart_count);
+    sim.register_io_device(harts);
+
+    std::optional<lc32sim::Display> display;
+    if (!headless) {
+        display.emplace(timing.scanline);
+        sim.register_io_device(*display);
+        timing.on_hblank.push_back([&]() {
+            if (!display->update(sim)) {
+                sim.scheduler.stop();
+            }
+        });
+    }
+
+    std::optional<lc32sim::FrameHasher> hasher;
+    if (frame_hashes || golden_frame_hashes) {
+        hasher.emplace(frame_hashes, golden_frame_hashes);
+        timing.on_vblank.push_back([&]() {
+            if (!hasher->check(timing.frame, sim.mem.get_video_buffer())) {
+                sim.scheduler.stop();
+            }
+        });
+    }
+
+    if (fuzz) {
+        // Exits once fuzzing is done
+        lc32sim::Fuzzer(sim).run();
+    }
+    if (simpoint_report) {
+        lc32sim::SimPoint(sim, elf).run(*simpoint_report);
+        return 0;
+    }
+
+    lc32sim::metrics.start_exporter(Config.metrics.output_file, Config.metrics.interval_ms);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    try {
+        if (gdb_socket) {
+            std::optional<lc32sim::Recorder> recorder;
+            if (reverse) {
+                recorder.emplace(sim, Config.reverse.checkpoint_interval, Config.reverse.max_memory_mb << 20);
+            }
+            lc32sim::GDBStub(sim, *gdb_socket).serve();
+        } else {
+            sim.run();
+            if (sim.watch_hit) {
+                logger.info << "Stopped at a watchpoint";
+            }
+            if (sim.fault) {
+                const lc32sim::Fault &fault = *sim.fault;
+                if (fault.phase == lc32sim::FaultPhase::FETCH) {
+                    logger.error << "Program faulted fetching from x" << std::hex << std::setw(8) << std::setfill('0') << fault.pc << ": " << fault.describe();
+                } else if (fault.phase == lc32sim::FaultPhase::EVENT) {
+                    logger.error << "Device failed before x" << std::hex << std::setw(8) << std::setfill('0') << fault.pc << ": " << fault.describe();
+                } else {
+                    logger.error << "Program faulted at x" << std::hex << std::setw(8) << std::setfill('0') << fault.pc
+                                 << " (" << lc32sim::Instruction(fault.instruction) << "): " << fault.describe();
                 }
             }
-            vsyncs++;
         }
+    } catch (...) {
+        // Programs that fault get their reports too
+        write_reports();
+        throw;
     }
-
-    done:
+    write_reports();
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    lc32sim::metrics.stop_exporter();
     std::chrono::duration<double> elapsed = end - start;
+    uint64_t instructions_executed = sim.scheduler.now;
+    uint64_t vsyncs = timing.frame;
     logger.info << "Executed " << instructions_executed << " instructions in " << elapsed.count() << " seconds (" << instructions_executed / elapsed.count() << " Hz)";
     logger.info << "Vsyncs: " << vsyncs << ", Vsyncs/second " << vsyncs / elapsed.count();
-    return 0;
+    return (sim.fault || harts.faulted()) ? 1 : 0;
 }
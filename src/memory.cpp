@@ -1,8 +1,17 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
+#include <utility>
 
 #include "display.hpp"
 #include "exceptions.hpp"
@@ -12,7 +21,7 @@
 #define NUM_PAGES (((Config.memory.size - 1) / Config.memory.simulator_page_size) + 1)
 
 namespace lc32sim {
-    Memory::Memory(unsigned int seed) : seed(seed), read_hooks(), write_hooks() {
+    Memory::Memory(unsigned int seed) : seed(seed), read_hooks(), write_hooks(), pages_initialized(metrics.counter("memory.pages_initialized")) {
         if (Config.memory.size > (1_u64 << 32)) {
             throw SimulatorException("memory size must be <= 4 GiB");
         }
@@ -32,9 +41,18 @@ namespace lc32sim {
             throw SimulatorException("I/O space must be <= memory size");
         }
 
-        data = std::make_unique_for_overwrite<uint8_t[]>(Config.memory.size);
-        page_initialized = std::make_unique<bool[]>(NUM_PAGES);
+        // Reserve address space only; pages are allocated as they are touched
+        void *mapping = mmap(nullptr, Config.memory.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw SimulatorException("could not reserve " + std::to_string(Config.memory.size) + " bytes of guest memory");
+        }
+        data = std::unique_ptr<uint8_t[], MappingDeleter>(static_cast<uint8_t*>(mapping), MappingDeleter{Config.memory.size});
+        page_flags = std::make_unique<uint8_t[]>(NUM_PAGES);
     };
+    void MappingDeleter::operator()(uint8_t *ptr) const {
+        munmap(ptr, this->size);
+    }
+
     Memory::Memory() : Memory(0) {}
     Memory::~Memory() {}
 
@@ -44,7 +62,14 @@ namespace lc32sim {
 
     void Memory::init_page(uint32_t page_num) {
         assert(page_num < NUM_PAGES);
-        assert(!page_initialized[page_num]);
+        // Harts can race to initialize the same page, and only the first
+        // may fill it, or it could clobber what the first has since stored
+        std::lock_guard<std::mutex> lock(this->init_lock);
+        std::atomic_ref<uint8_t> flags(this->page_flags[page_num]);
+        if (flags.load(std::memory_order_acquire) & PAGE_INITIALIZED) {
+            return;
+        }
+        this->pages_initialized.add();
         srand(seed ^ page_num);
         for (uint64_t i = 0; i < Config.memory.simulator_page_size; i++) {
             uint64_t addr = (page_num * Config.memory.simulator_page_size) + i;
@@ -53,7 +78,303 @@ namespace lc32sim {
             }
             data[addr] = static_cast<uint8_t>(rand());
         }
-        page_initialized[page_num] = true;
+        flags.fetch_or(PAGE_INITIALIZED, std::memory_order_release);
+    }
+
+    thread_local std::optional<MemoryFault> Memory::fault;
+    thread_local bool Memory::intercepted = false;
+
+    void Memory::throw_fault() const {
+        if (this->fault->kind == FaultKind::UNALIGNED_ACCESS) {
+            throw UnalignedMemoryAccessException(this->fault->addr, this->fault->size);
+        }
+        throw SegmentationFaultException(this->fault->addr);
+    }
+
+    bool Memory::check_breakpoint(uint32_t addr) {
+        if (this->breakpoint_skip == addr) {
+            this->breakpoint_skip.reset();
+            return false;
+        }
+        return this->breakpoints.contains(addr);
+    }
+
+    void Memory::add_breakpoint(uint32_t addr) {
+        if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) {
+            throw SegmentationFaultException(addr);
+        }
+        this->breakpoints.insert(addr);
+        this->page_flags[addr / Config.memory.simulator_page_size] |= PAGE_BREAKPOINT;
+    }
+
+    void Memory::remove_breakpoint(uint32_t addr) {
+        if (!this->breakpoints.erase(addr)) {
+            return;
+        }
+        // Keep the page flagged while other breakpoints remain on it
+        uint32_t page = addr / Config.memory.simulator_page_size;
+        for (uint32_t other : this->breakpoints) {
+            if (other / Config.memory.simulator_page_size == page) {
+                return;
+            }
+        }
+        this->page_flags[page] &= ~PAGE_BREAKPOINT;
+    }
+
+    bool Memory::has_breakpoint(uint32_t addr) const {
+        return this->breakpoints.contains(addr);
+    }
+
+    void Memory::clear_breakpoints() {
+        for (uint32_t addr : this->breakpoints) {
+            this->page_flags[addr / Config.memory.simulator_page_size] &= ~PAGE_BREAKPOINT;
+        }
+        this->breakpoints.clear();
+        this->breakpoint_skip.reset();
+    }
+
+    void Memory::step_over_breakpoint(uint32_t addr) {
+        this->breakpoint_skip = addr;
+    }
+
+    void Memory::add_intercept(uint32_t addr) {
+        if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) {
+            throw SegmentationFaultException(addr);
+        }
+        this->intercepts.insert(addr);
+        this->page_flags[addr / Config.memory.simulator_page_size] |= PAGE_INTERCEPT;
+    }
+
+    void Memory::remove_intercept(uint32_t addr) {
+        if (!this->intercepts.erase(addr)) {
+            return;
+        }
+        uint32_t page = addr / Config.memory.simulator_page_size;
+        for (uint32_t other : this->intercepts) {
+            if (other / Config.memory.simulator_page_size == page) {
+                return;
+            }
+        }
+        this->page_flags[page] &= ~PAGE_INTERCEPT;
+    }
+
+    void Memory::flag_watched_pages(uint32_t start, uint32_t length) {
+        uint32_t first = start / Config.memory.simulator_page_size;
+        uint32_t last = (start + (length - 1)) / Config.memory.simulator_page_size;
+        for (uint32_t page = first; page <= last; page++) {
+            this->page_flags[page] |= PAGE_WATCH;
+        }
+    }
+
+    void Memory::add_watchpoint(Watchpoint watchpoint) {
+        if (watchpoint.length == 0) {
+            throw SimulatorException("Watchpoint must cover at least one byte");
+        }
+        uint64_t end = static_cast<uint64_t>(watchpoint.start) + watchpoint.length - 1;
+        if (watchpoint.start < Config.memory.user_space_min || end > Config.memory.user_space_max) {
+            throw SegmentationFaultException(watchpoint.start);
+        }
+        this->watchpoints.push_back(watchpoint);
+        this->flag_watched_pages(watchpoint.start, watchpoint.length);
+    }
+
+    bool Memory::remove_watchpoint(uint32_t start, uint32_t length, WatchKind kind) {
+        auto it = std::find_if(this->watchpoints.begin(), this->watchpoints.end(), [&](const Watchpoint &w) {
+            return w.start == start && w.length == length && w.kind == kind;
+        });
+        if (it == this->watchpoints.end()) {
+            return false;
+        }
+        this->watchpoints.erase(it);
+
+        // Unflag the range, then flag whatever the remaining watchpoints still cover
+        uint32_t first = start / Config.memory.simulator_page_size;
+        uint32_t last = (start + (length - 1)) / Config.memory.simulator_page_size;
+        for (uint32_t page = first; page <= last; page++) {
+            this->page_flags[page] &= ~PAGE_WATCH;
+        }
+        for (const Watchpoint &w : this->watchpoints) {
+            this->flag_watched_pages(w.start, w.length);
+        }
+        return true;
+    }
+
+    void Memory::clear_watchpoints() {
+        for (const Watchpoint &w : this->watchpoints) {
+            uint32_t first = w.start / Config.memory.simulator_page_size;
+            uint32_t last = (w.start + (w.length - 1)) / Config.memory.simulator_page_size;
+            for (uint32_t page = first; page <= last; page++) {
+                this->page_flags[page] &= ~PAGE_WATCH;
+            }
+        }
+        this->watchpoints.clear();
+    }
+
+    void Memory::set_watch_handler(watch_handler handler) {
+        this->on_watch = std::move(handler);
+    }
+
+    void Memory::check_watchpoints(uint32_t addr, uint8_t size, bool write, uint32_t old_value, uint32_t new_value) {
+        WatchKind kind = write ? WatchKind::WRITE : WatchKind::READ;
+        // Copied, since the handler may add or remove watchpoints
+        std::vector<Watchpoint> hits;
+        for (const Watchpoint &w : this->watchpoints) {
+            bool overlaps = addr < static_cast<uint64_t>(w.start) + w.length && w.start < static_cast<uint64_t>(addr) + size;
+            if (overlaps && (static_cast<uint8_t>(w.kind) & static_cast<uint8_t>(kind))) {
+                hits.push_back(w);
+            }
+        }
+        for (const Watchpoint &w : hits) {
+            if (this->on_watch) {
+                this->on_watch(WatchHit{w, addr, size, write, old_value, new_value});
+            }
+        }
+    }
+
+    void Memory::save_page(uint32_t page_num) {
+        this->page_flags[page_num] &= ~PAGE_SAVE;
+        SavedPage saved{page_num, nullptr};
+        if (this->page_flags[page_num] & PAGE_INITIALIZED) {
+            uint64_t start = page_num * Config.memory.simulator_page_size;
+            uint64_t size = std::min(Config.memory.simulator_page_size, Config.memory.size - start);
+            saved.data = std::make_unique_for_overwrite<uint8_t[]>(size);
+            std::memcpy(saved.data.get(), &this->data[start], size);
+        }
+        this->undo_log.push_back(std::move(saved));
+    }
+
+    // Saves every page in the range that still needs it, and reports the
+    // range as changed to a span capture
+    void Memory::save_range(uint32_t addr, uint64_t size) {
+        uint32_t start_page = addr / Config.memory.simulator_page_size;
+        uint32_t end_page = (addr + size - 1) / Config.memory.simulator_page_size;
+        for (uint32_t page = start_page; page <= end_page; page++) {
+            if (this->page_flags[page] & PAGE_SAVE) {
+                this->save_page(page);
+            }
+        }
+        if (this->captured_spans) {
+            this->captured_spans->emplace_back(addr, size);
+        }
+    }
+
+    void Memory::start_undo_log() {
+        this->undo_log.clear();
+        uint8_t *flags = this->page_flags.get();
+        for (uint64_t page = 0; page < NUM_PAGES; page++) {
+            flags[page] |= PAGE_SAVE;
+        }
+        for (const auto &[addr, hook] : this->read_hooks) {
+            if (this->page_flags[addr / Config.memory.simulator_page_size] & PAGE_SAVE) {
+                this->save_page(addr / Config.memory.simulator_page_size);
+            }
+        }
+        for (const auto &[addr, hook] : this->write_hooks) {
+            if (this->page_flags[addr / Config.memory.simulator_page_size] & PAGE_SAVE) {
+                this->save_page(addr / Config.memory.simulator_page_size);
+            }
+        }
+    }
+
+    void Memory::stop_undo_log() {
+        this->undo_log.clear();
+        uint8_t *flags = this->page_flags.get();
+        for (uint64_t page = 0; page < NUM_PAGES; page++) {
+            flags[page] &= ~PAGE_SAVE;
+        }
+    }
+
+    std::vector<SavedPage> Memory::take_undo_log() {
+        return std::exchange(this->undo_log, {});
+    }
+
+    void Memory::undo(const std::vector<SavedPage> &pages) {
+        for (const SavedPage &saved : pages) {
+            if (!saved.data) {
+                // Initialization is deterministic, so it can simply happen again
+                this->page_flags[saved.page] &= ~PAGE_INITIALIZED;
+                continue;
+            }
+            uint64_t start = saved.page * Config.memory.simulator_page_size;
+            uint64_t size = std::min(Config.memory.simulator_page_size, Config.memory.size - start);
+            std::memcpy(&this->data[start], saved.data.get(), size);
+            this->page_flags[saved.page] |= PAGE_INITIALIZED;
+        }
+    }
+
+    void Memory::start_span_capture() {
+        this->captured_spans.emplace();
+    }
+
+    std::vector<std::pair<uint32_t, uint64_t>> Memory::end_span_capture() {
+        std::vector<std::pair<uint32_t, uint64_t>> spans = std::move(this->captured_spans).value_or(std::vector<std::pair<uint32_t, uint64_t>>());
+        this->captured_spans.reset();
+        return spans;
+    }
+
+    GuestSpan Memory::span(uint32_t addr, uint64_t size) {
+        if (size == 0) {
+            return GuestSpan{&this->data[addr], 0, false};
+        }
+        uint64_t end = static_cast<uint64_t>(addr) + size;
+        if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) {
+            throw SegmentationFaultException(addr);
+        }
+        if (end - 1 > Config.memory.user_space_max) {
+            throw SegmentationFaultException(Config.memory.user_space_max + 1);
+        }
+        return this->prepare_span(addr, size);
+    }
+
+    GuestSpan Memory::device_span(uint32_t addr, uint64_t size) {
+        if (size == 0) {
+            return GuestSpan{&this->data[addr], 0, false};
+        }
+        if (static_cast<uint64_t>(addr) + size > Config.memory.size) {
+            throw SegmentationFaultException(std::max<uint64_t>(addr, Config.memory.size));
+        }
+        return this->prepare_span(addr, size);
+    }
+
+    GuestSpan Memory::prepare_span(uint32_t addr, uint64_t size) {
+        uint64_t end = static_cast<uint64_t>(addr) + size;
+        uint32_t start_page = addr / Config.memory.simulator_page_size;
+        uint32_t end_page = (end - 1) / Config.memory.simulator_page_size;
+        for (uint32_t page = start_page; page <= end_page; page++) {
+            // Whoever asked may write through the span
+            if (this->page_flags[page] & PAGE_SAVE) {
+                this->save_page(page);
+            }
+            if (!(this->page_flags[page] & PAGE_INITIALIZED)) {
+                this->init_page(page);
+            }
+        }
+        if (this->captured_spans) {
+            this->captured_spans->emplace_back(addr, size);
+        }
+        return GuestSpan{&this->data[addr], size, this->has_hooks(addr, end)};
+    }
+
+    GuestSpan Memory::string_at(uint32_t addr) {
+        uint64_t cur = addr;
+        while (true) {
+            if (cur < Config.memory.user_space_min || cur > Config.memory.user_space_max) {
+                throw SegmentationFaultException(cur);
+            }
+            uint32_t page = cur / Config.memory.simulator_page_size;
+            if (!(this->page_flags[page] & PAGE_INITIALIZED)) {
+                this->init_page(page);
+            }
+
+            // Search up to the end of this page
+            uint64_t page_end = std::min((page + 1_u64) * Config.memory.simulator_page_size, Config.memory.user_space_max + 1);
+            const void *nul = std::memchr(&this->data[cur], '\0', page_end - cur);
+            if (nul) {
+                size_t size = static_cast<const uint8_t*>(nul) - &this->data[addr];
+                return GuestSpan{&this->data[addr], size, this->has_hooks(addr, addr + size + 1)};
+            }
+            cur = page_end;
+        }
     }
 
     void Memory::load_elf(ELFFile& elf) {
@@ -64,7 +385,7 @@ namespace lc32sim {
                 uint32_t start_page = ph.vaddr / Config.memory.simulator_page_size;
                 uint32_t end_page = (ph.vaddr + ph.memsz - 1) / Config.memory.simulator_page_size;
                 for (uint32_t page = start_page; page <= end_page; page++) {
-                    if (!this->page_initialized[page]) {
+                    if (!(this->page_flags[page] & PAGE_INITIALIZED)) {
                         this->init_page(page);
                     }
                 }
@@ -95,4 +416,114 @@ namespace lc32sim {
         }
         this->write_hooks[addr] = hook;
     }
+
+    bool Memory::has_hooks(uint32_t start, uint64_t end) const {
+        if (end <= Config.memory.io_space_min) {
+            return false;
+        }
+        // Hooks are keyed on a single address, but act on the whole word
+        auto overlaps = [start, end](uint32_t addr) {
+            uint64_t word = addr & ~0x3_u32;
+            return word < end && word + 4 > start;
+        };
+        for (const auto &[addr, hook] : this->read_hooks) {
+            if (overlaps(addr)) {
+                return true;
+            }
+        }
+        for (const auto &[addr, hook] : this->write_hooks) {
+            if (overlaps(addr)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Memory::has_watchpoints(uint32_t start, uint64_t end) const {
+        return std::any_of(this->watchpoints.begin(), this->watchpoints.end(), [start, end](const Watchpoint &w) {
+            return w.start < end && start < static_cast<uint64_t>(w.start) + w.length;
+        });
+    }
+
+    // Alignment needed for both host mappings and page initialization
+    static uint64_t mapping_granularity() {
+        uint64_t host_page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        return std::max(host_page_size, Config.memory.simulator_page_size);
+    }
+
+    uint32_t Memory::map_file(uint32_t addr, uint32_t length, int fd, uint64_t offset) {
+        uint64_t granularity = mapping_granularity();
+        if (length == 0 || addr % granularity != 0 || offset % granularity != 0) {
+            return 0;
+        }
+        uint64_t end = static_cast<uint64_t>(addr) + length;
+        if (addr < Config.memory.user_space_min || end - 1 > Config.memory.user_space_max || this->has_hooks(addr, end)) {
+            return 0;
+        }
+        // Mappings cannot overlap, so each can be unmapped on its own
+        auto next = this->mappings.lower_bound(addr);
+        if ((next != this->mappings.end() && next->first < end)
+            || (next != this->mappings.begin() && std::prev(next)->first + std::prev(next)->second > addr)) {
+            return 0;
+        }
+
+        // Touching pages wholly past the end of the file would raise SIGBUS,
+        // so only map what the file covers
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) <= offset) {
+            return 0;
+        }
+        uint64_t file_length = std::min<uint64_t>(length, st.st_size - offset);
+        // Only whole pages are mapped. The rest of the file is copied, so
+        // memory past it in the last page is left alone.
+        uint64_t map_length = (file_length / granularity) * granularity;
+        uint64_t tail_length = file_length - map_length;
+        if (tail_length != 0) {
+            GuestSpan tail = this->span(addr + map_length, tail_length);
+            if (pread(fd, tail.data, tail_length, offset + map_length) != static_cast<ssize_t>(tail_length)) {
+                return 0;
+            }
+        }
+        if (map_length == 0) {
+            return static_cast<uint32_t>(file_length);
+        }
+
+        this->save_range(addr, map_length);
+        if (mmap(&this->data[addr], map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+            return 0;
+        }
+        this->mappings[addr] = map_length;
+
+        uint32_t start_page = addr / Config.memory.simulator_page_size;
+        uint32_t end_page = (addr + map_length - 1) / Config.memory.simulator_page_size;
+        for (uint32_t page = start_page; page <= end_page; page++) {
+            this->page_flags[page] |= PAGE_INITIALIZED;
+        }
+        return static_cast<uint32_t>(file_length);
+    }
+
+    bool Memory::unmap_file(uint32_t addr, uint32_t length) {
+        // Only a whole mapping made by `map_file` can be unmapped
+        auto mapping = this->mappings.find(addr);
+        if (mapping == this->mappings.end() || length < mapping->second) {
+            return false;
+        }
+        uint64_t map_length = mapping->second;
+        if (this->has_hooks(addr, addr + map_length)) {
+            return false;
+        }
+
+        this->save_range(addr, map_length);
+        if (mmap(&this->data[addr], map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            return false;
+        }
+        this->mappings.erase(mapping);
+
+        uint32_t start_page = addr / Config.memory.simulator_page_size;
+        uint32_t end_page = (addr + map_length - 1) / Config.memory.simulator_page_size;
+        for (uint32_t page = start_page; page <= end_page; page++) {
+            this->page_flags[page] &= ~PAGE_INITIALIZED;
+        }
+        return true;
+    }
 }
\ No newline at end of file
@@ -1,30 +1,166 @@
 #pragma once
+#include <atomic>
 #include <bit>
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "config.hpp"
 #include "elf_file.hpp"
 #include "exceptions.hpp"
+#include "fault.hpp"
 #include "iodevice.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 #include "utils.hpp"
 
 namespace lc32sim {
     static_assert(std::endian::native == std::endian::little || std::endian::native == std::endian::big, "mixed-endian architectures are not supported");
 
+    /*!
+     * \brief A validated range of guest memory, usable as host memory
+     *
+     * Guest memory is a single host mapping, so a range is always contiguous
+     * on the host. By the time a span is handed out, the range has been
+     * checked against user space and all of its pages are initialized.
+     */
+    struct GuestSpan {
+        uint8_t *data;
+        size_t size;
+        // Whether a hooked I/O register lies in the range. Bulk access
+        // bypasses hooks, so callers that care should fall back to
+        // `Memory::read` and `Memory::write` when this is set.
+        bool hooked;
+    };
+
+    //! Which accesses a watchpoint triggers on
+    enum class WatchKind : uint8_t {
+        READ = 1,
+        WRITE = 2,
+        ACCESS = READ | WRITE
+    };
+
+    struct Watchpoint {
+        uint32_t start;
+        uint32_t length;
+        WatchKind kind;
+        // Whether execution should stop when the watchpoint triggers
+        bool stop;
+    };
+
+    //! A guest access that triggered a watchpoint
+    struct WatchHit {
+        Watchpoint watchpoint;
+        uint32_t addr;
+        uint8_t size;
+        bool write;
+        // Both are the value read for reads
+        uint32_t old_value;
+        uint32_t new_value;
+    };
+    using watch_handler = std::function<void(const WatchHit&)>;
+
+    //! A page's contents before it was changed, or none if it was uninitialized
+    struct SavedPage {
+        uint32_t page;
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    //! Why a guest access failed, see `Memory::load`
+    struct MemoryFault {
+        FaultKind kind;
+        uint32_t addr;
+        uint8_t size;
+    };
+
+    // Releases the host mapping backing guest memory
+    struct MappingDeleter {
+        uint64_t size;
+        void operator()(uint8_t *ptr) const;
+    };
+
     class Memory {
         private:
-            std::unique_ptr<bool[]> page_initialized;
+            // Per-page state, so that the fast paths only need one test to
+            // know a page is initialized and has nothing else to check
+            static const uint8_t PAGE_INITIALIZED = 1;
+            static const uint8_t PAGE_BREAKPOINT = 2;
+            static const uint8_t PAGE_WATCH = 4;
+            // Contents are saved before the page next changes, see `start_undo_log`
+            static const uint8_t PAGE_SAVE = 8;
+            // Fetches from an intercepted address stop, see `add_intercept`
+            static const uint8_t PAGE_INTERCEPT = 16;
+            // The flags each kind of access cares about. Any of them being
+            // set, other than `PAGE_INITIALIZED`, sends it down the slow path.
+            static const uint8_t READ_FLAGS = PAGE_INITIALIZED | PAGE_WATCH;
+            static const uint8_t WRITE_FLAGS = PAGE_INITIALIZED | PAGE_WATCH | PAGE_SAVE;
+            static const uint8_t FETCH_FLAGS = PAGE_INITIALIZED | PAGE_BREAKPOINT | PAGE_INTERCEPT;
+            std::unique_ptr<uint8_t[]> page_flags;
+            // Other harts can set `PAGE_INITIALIZED` at any time, so the fast
+            // paths read flags atomically, pairing with the release in `init_page`
+            forceinline uint8_t flags_of(uint32_t page_num) {
+                return std::atomic_ref<uint8_t>(this->page_flags[page_num]).load(std::memory_order_acquire);
+            }
+            std::unordered_set<uint32_t> breakpoints;
+            // A fetch from here ignores its breakpoint once, see `step_over_breakpoint`
+            std::optional<uint32_t> breakpoint_skip;
+            bool check_breakpoint(uint32_t addr);
+            std::unordered_set<uint32_t> intercepts;
+            std::vector<Watchpoint> watchpoints;
+            watch_handler on_watch;
+            void check_watchpoints(uint32_t addr, uint8_t size, bool write, uint32_t old_value, uint32_t new_value);
+            void flag_watched_pages(uint32_t start, uint32_t length);
+            std::vector<SavedPage> undo_log;
+            void save_page(uint32_t page_num);
+            void save_range(uint32_t addr, uint64_t size);
+            // Ranges handed out by `span` since `start_span_capture`, if capturing
+            std::optional<std::vector<std::pair<uint32_t, uint64_t>>> captured_spans;
+            // Pages mapped by `map_file`, as start and length
+            std::map<uint32_t, uint64_t> mappings;
+
+            // Reads memory as stored, without checks or hooks
+            template<typename T>
+            T peek(uint32_t addr) {
+                T val = *reinterpret_cast<T*>(&this->data[addr]);
+                if constexpr (sizeof(T) > 1 && std::endian::native == std::endian::big) {
+                    val = std::byteswap(val);
+                }
+                return val;
+            }
             unsigned int seed;
-            std::unique_ptr<uint8_t[]> data;
+            // Guest memory is a single anonymous host mapping, so that files
+            // can be mapped directly over parts of it
+            std::unique_ptr<uint8_t[], MappingDeleter> data;
+            // Does nothing if another hart initialized the page first
             void init_page(uint32_t page_num);
+            std::mutex init_lock;
+            // Records why a guest access failed, and returns false
+            [[gnu::cold]] bool record_fault(FaultKind kind, uint32_t addr, uint8_t size) {
+                this->fault = MemoryFault{kind, addr, size};
+                return false;
+            }
+            // Throws the exception for `fault`
+            [[noreturn]] void throw_fault() const;
+            // Initializes the pages of a range already checked to be in bounds
+            GuestSpan prepare_span(uint32_t addr, uint64_t size);
             std::unordered_map<uint32_t, read_handler> read_hooks;
             std::unordered_map<uint32_t, write_handler> write_hooks;
+            Counter pages_initialized;
 
         public:
+            // Why the last failed `load`, `store`, or `fetch` on this thread
+            // failed, kept per thread since harts fault independently
+            static thread_local std::optional<MemoryFault> fault;
+            // Set by a `fetch` that stopped at an intercepted address
+            static thread_local bool intercepted;
+
             Memory(unsigned int seed);
             Memory();
             ~Memory();
@@ -36,22 +172,46 @@ namespace lc32sim {
             // It is the caller's responsibility to check these manually
             template<typename T, bool unsafe = false>
             T read(uint32_t addr) {
+                T val = 0;
+                if (!this->load<T, unsafe>(addr, val)) [[unlikely]] {
+                    this->throw_fault();
+                }
+                return val;
+            }
+
+            /*!
+             * \brief Reads guest memory for a guest instruction
+             *
+             * This is `read`, except that a segmentation fault or unaligned
+             * access is reported by returning false, with the reason left in
+             * `fault`, instead of by throwing. `val` is then unchanged.
+             */
+            template<typename T, bool unsafe = false>
+            bool load(uint32_t addr, T &val) {
                 static_assert(sizeof(T) <= 4);
                 uint32_t page_num = addr / Config.memory.simulator_page_size;
 
                 if constexpr (!unsafe) {
-                    if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) {
-                        throw SegmentationFaultException(addr);
+                    if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) [[unlikely]] {
+                        return this->record_fault(FaultKind::SEGMENTATION_FAULT, addr, sizeof(T));
                     }
 
                     if constexpr (sizeof(T) > 1) {
-                        if (addr % sizeof(T) != 0) {
-                            throw UnalignedMemoryAccessException(addr, sizeof(T));
+                        if (addr % sizeof(T) != 0) [[unlikely]] {
+                            return this->record_fault(FaultKind::UNALIGNED_ACCESS, addr, sizeof(T));
                         }
                     }
 
-                    if (!this->page_initialized[page_num]) {
-                        this->init_page(page_num);
+                    uint8_t flags = this->flags_of(page_num);
+                    if ((flags & READ_FLAGS) != PAGE_INITIALIZED) [[unlikely]] {
+                        if (!(flags & PAGE_INITIALIZED)) {
+                            this->init_page(page_num);
+                        }
+                        if (flags & PAGE_WATCH) {
+                            this->load<T, true>(addr, val);
+                            this->check_watchpoints(addr, sizeof(T), false, val, val);
+                            return true;
+                        }
                     }
                 }
 
@@ -70,30 +230,142 @@ namespace lc32sim {
                 }
 
                 if (std::endian::native == std::endian::little) {
-                    return ret >> (offset * 8);
+                    val = ret >> (offset * 8);
                 } else {
-                    return ret << (offset * 8);
+                    val = ret << (offset * 8);
                 }
+                return true;
             }
             
+            /*!
+             * \brief Reads the instruction at `addr` for execution
+             *
+             * This is `load<uint16_t>`, except that it also returns false,
+             * with `fault` cleared, if a breakpoint is set at `addr`, or
+             * with `intercepted` also set if `addr` is intercepted and has
+             * no breakpoint. Both share the page flag test with page
+             * initialization, so pages without any cost nothing extra.
+             */
+            forceinline bool fetch(uint32_t addr, uint16_t &bits) {
+                uint32_t page_num = addr / Config.memory.simulator_page_size;
+                if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) [[unlikely]] {
+                    return this->record_fault(FaultKind::SEGMENTATION_FAULT, addr, sizeof(uint16_t));
+                }
+                if (addr % sizeof(uint16_t) != 0) [[unlikely]] {
+                    return this->record_fault(FaultKind::UNALIGNED_ACCESS, addr, sizeof(uint16_t));
+                }
+                uint8_t flags = this->flags_of(page_num);
+                if ((flags & FETCH_FLAGS) != PAGE_INITIALIZED) [[unlikely]] {
+                    if (!(flags & PAGE_INITIALIZED)) {
+                        this->init_page(page_num);
+                    }
+                    if ((flags & PAGE_BREAKPOINT) && this->check_breakpoint(addr)) {
+                        this->fault.reset();
+                        return false;
+                    }
+                    if ((flags & PAGE_INTERCEPT) && this->intercepts.contains(addr)) {
+                        this->fault.reset();
+                        this->intercepted = true;
+                        return false;
+                    }
+                }
+                this->load<uint16_t, true>(addr, bits);
+                return true;
+            }
+
+            void add_breakpoint(uint32_t addr);
+            void remove_breakpoint(uint32_t addr);
+            bool has_breakpoint(uint32_t addr) const;
+            void clear_breakpoints();
+            //! Lets the next fetch from `addr` through, to resume from a breakpoint
+            void step_over_breakpoint(uint32_t addr);
+
+            /*!
+             * \brief Stops fetches from `addr`, like a breakpoint
+             *
+             * This is for the simulator itself to take over at an address,
+             * as `HLE` does at the routines it runs natively. A breakpoint at
+             * the same address comes first.
+             */
+            void add_intercept(uint32_t addr);
+            void remove_intercept(uint32_t addr);
+
+            /*!
+             * \brief Watches guest accesses to `length` bytes from `start`
+             *
+             * Pages holding a watched byte are flagged, so accesses to any
+             * other page take the same fast path as without watchpoints.
+             * Only accesses made by guest instructions through `read` and
+             * `write` are watched; bulk accesses through `span` are not.
+             * Hits are passed to the handler given to `set_watch_handler`.
+             */
+            void add_watchpoint(Watchpoint watchpoint);
+            //! Removes the watchpoint with the same range and kind, if any
+            bool remove_watchpoint(uint32_t start, uint32_t length, WatchKind kind);
+            void clear_watchpoints();
+            void set_watch_handler(watch_handler handler);
+
+            /*!
+             * \brief Starts saving each page's contents before it next changes
+             *
+             * Every page is flagged, and the first write to each, or the
+             * first `span` over it, saves it to the undo log. Pages holding
+             * I/O registers are saved right away, since devices update them
+             * directly. Any pages already in the log are discarded.
+             */
+            void start_undo_log();
+            void stop_undo_log();
+            //! Hands over the pages saved so far, leaving the log empty
+            std::vector<SavedPage> take_undo_log();
+            //! Puts saved pages back, as they were when saved
+            void undo(const std::vector<SavedPage> &pages);
+            /*!
+             * \brief Starts recording the ranges handed out by `span`
+             *
+             * Devices write to guest memory through spans, so this tells what
+             * a device may have changed.
+             */
+            void start_span_capture();
+            std::vector<std::pair<uint32_t, uint64_t>> end_span_capture();
+
             template <typename T, bool unsafe = false>
             void write(uint32_t addr, T val) {
+                if (!this->store<T, unsafe>(addr, val)) [[unlikely]] {
+                    this->throw_fault();
+                }
+            }
+
+            //! Writes guest memory for a guest instruction, like `load`
+            template <typename T, bool unsafe = false>
+            bool store(uint32_t addr, T val) {
                 static_assert(sizeof(T) <= 4);
                 uint32_t page_num = addr / Config.memory.simulator_page_size;
 
                 if constexpr (!unsafe) {
-                    if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) {
-                        throw SegmentationFaultException(addr);
+                    if (addr < Config.memory.user_space_min || addr > Config.memory.user_space_max) [[unlikely]] {
+                        return this->record_fault(FaultKind::SEGMENTATION_FAULT, addr, sizeof(T));
                     }
 
                     if constexpr (sizeof(T) > 1) {
-                        if (addr % sizeof(T) != 0) {
-                            throw UnalignedMemoryAccessException(addr, sizeof(T));
+                        if (addr % sizeof(T) != 0) [[unlikely]] {
+                            return this->record_fault(FaultKind::UNALIGNED_ACCESS, addr, sizeof(T));
                         }
                     }
 
-                    if (!this->page_initialized[page_num]) {
-                        this->init_page(page_num);
+                    uint8_t flags = this->flags_of(page_num);
+                    if ((flags & WRITE_FLAGS) != PAGE_INITIALIZED) [[unlikely]] {
+                        if (flags & PAGE_SAVE) {
+                            this->save_page(page_num);
+                        }
+                        if (!(flags & PAGE_INITIALIZED)) {
+                            this->init_page(page_num);
+                        }
+                        if (flags & PAGE_WATCH) {
+                            T old_value = this->peek<T>(addr);
+                            this->store<T, true>(addr, val);
+                            this->check_watchpoints(addr, sizeof(T), true, old_value, this->peek<T>(addr));
+                            return true;
+                        }
                     }
                 }
 
@@ -120,15 +392,67 @@ namespace lc32sim {
 
                         uint32_t final_data = (hook->second)(old_data, new_data);
                         *reinterpret_cast<uint32_t*>(&this->data[aligned_addr]) = final_data;
-                        return;
+                        return true;
                     }
                 } 
                 *reinterpret_cast<T*>(&this->data[addr]) = val;
+                return true;
             }
 
             // Functions to allow I/O devices to "hook" into certain memory addresses, mimicing MMIO
             void add_read_hook(uint32_t addr, read_handler hook);
             void add_write_hook(uint32_t addr, write_handler hook);
+            /*!
+             * \brief Maps part of a host file over guest memory, copy-on-write
+             *
+             * Guest writes to the mapped range are private and never reach the
+             * file. Both `addr` and `offset` must be aligned to the larger of
+             * the host and simulator page sizes, and the range cannot overlap
+             * another mapping. Only whole pages are mapped; a last partial
+             * page of the file is copied in instead. Any part of the range
+             * past the end of the file is left alone.
+             *
+             * \return The number of bytes mapped from the file, or zero if the
+             *         mapping could not be made
+             */
+            uint32_t map_file(uint32_t addr, uint32_t length, int fd, uint64_t offset);
+            /*!
+             * \brief Replaces the pages mapped from `addr` with fresh,
+             * uninitialized memory
+             *
+             * `addr` must be the start of a mapping made by `map_file`, and
+             * `length` must cover all of it. A partial page copied in after
+             * it is left as it is.
+             */
+            bool unmap_file(uint32_t addr, uint32_t length);
+
+            // Whether any hooked register lies in the half-open range [start, end)
+            bool has_hooks(uint32_t start, uint64_t end) const;
+            // Whether any watchpoint covers part of the half-open range [start, end)
+            bool has_watchpoints(uint32_t start, uint64_t end) const;
+
+            /*!
+             * \brief Validates and initializes `size` bytes starting at `addr`
+             *
+             * This is meant for devices and TRAPs that access guest memory in
+             * bulk. It throws `SegmentationFaultException` if any part of the
+             * range lies outside user space.
+             */
+            GuestSpan span(uint32_t addr, uint64_t size);
+            /*!
+             * \brief `span` for devices that can reach all of memory, like DMA
+             *
+             * The range only has to lie within `memory.size`, rather than in
+             * user space.
+             */
+            GuestSpan device_span(uint32_t addr, uint64_t size);
+            /*!
+             * \brief Finds the NUL-terminated string starting at `addr`
+             *
+             * Pages are validated and initialized as the terminator is
+             * searched for. The returned span excludes the terminator.
+             */
+            GuestSpan string_at(uint32_t addr);
 
             template<typename T>
             inline T *ptr_to(uint32_t addr) {
@@ -140,6 +464,5 @@ namespace lc32sim {
                 return reinterpret_cast<uint16_t*>(&this->data[VIDEO_BUFFER_ADDR]);
             }
 
-        friend class DMAController;
     };
 }
\ No newline at end of file
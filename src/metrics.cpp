@@ -0,0 +1,222 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+namespace lc32sim {
+    Metrics metrics;
+
+    /*
+     * Folds a thread's values into the retired totals when it exits, so
+     * counts from short-lived threads are not lost.
+     */
+    struct ThreadRetirer {
+        metrics_detail::ThreadSlots *slots = nullptr;
+        ~ThreadRetirer() {
+            if (!this->slots) {
+                return;
+            }
+            std::lock_guard<std::mutex> guard(metrics.lock);
+            for (uint32_t i = 0; i < metrics_detail::MAX_SLOTS; i++) {
+                metrics.retired[i] += this->slots->values[i].load(std::memory_order_relaxed);
+            }
+            std::erase(metrics.threads, this->slots);
+            metrics_detail::current = nullptr;
+            delete this->slots;
+        }
+    };
+
+    namespace metrics_detail {
+        constinit thread_local ThreadSlots *current = nullptr;
+
+        ThreadSlots *register_thread() {
+            static thread_local ThreadRetirer retirer;
+            ThreadSlots *slots = new ThreadSlots();
+            {
+                std::lock_guard<std::mutex> guard(metrics.lock);
+                metrics.threads.push_back(slots);
+            }
+            retirer.slots = slots;
+            current = slots;
+            return slots;
+        }
+    }
+
+    namespace {
+        // Write end of the exporter's wake pipe, for the signal handler
+        volatile sig_atomic_t signal_pipe = -1;
+
+        void handle_sigusr1(int) {
+            if (signal_pipe >= 0) {
+                char c = 0;
+                [[maybe_unused]] ssize_t ret = ::write(signal_pipe, &c, 1);
+            }
+        }
+    }
+
+    Metrics::Metrics() : retired(metrics_detail::MAX_SLOTS, 0) {}
+
+    Metrics::~Metrics() {
+        this->stop_exporter();
+    }
+
+    uint32_t Metrics::allocate(const std::string &name, bool histogram, uint32_t slots) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        auto it = this->by_name.find(name);
+        if (it != this->by_name.end()) {
+            const Entry &entry = this->entries[it->second];
+            if (entry.histogram != histogram) {
+                throw SimulatorException("Metric " + name + " registered as both a counter and a histogram");
+            }
+            return entry.first_slot;
+        }
+        if (this->next_slot + slots > metrics_detail::MAX_SLOTS) {
+            throw SimulatorException("Too many metrics registered");
+        }
+        uint32_t first_slot = this->next_slot;
+        this->next_slot += slots;
+        this->by_name.emplace(name, this->entries.size());
+        this->entries.push_back({name, first_slot, histogram});
+        return first_slot;
+    }
+
+    Counter Metrics::counter(const std::string &name) {
+        return Counter(this->allocate(name, false, 1));
+    }
+
+    Histogram Metrics::histogram(const std::string &name) {
+        return Histogram(this->allocate(name, true, Histogram::BUCKETS + 2));
+    }
+
+    std::string Metrics::to_json() {
+        std::vector<Entry> entries;
+        std::vector<uint64_t> totals;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            entries = this->entries;
+            totals = this->retired;
+            for (metrics_detail::ThreadSlots *slots : this->threads) {
+                for (uint32_t i = 0; i < this->next_slot; i++) {
+                    totals[i] += slots->values[i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.name < b.name; });
+
+        std::ostringstream out;
+        out << "{\n    \"counters\": {";
+        bool first = true;
+        for (const Entry &e : entries) {
+            if (e.histogram) {
+                continue;
+            }
+            out << (first ? "\n" : ",\n") << "        \"" << json_escape(e.name) << "\": " << totals[e.first_slot];
+            first = false;
+        }
+        out << "\n    },\n    \"histograms\": {";
+        first = true;
+        for (const Entry &e : entries) {
+            if (!e.histogram) {
+                continue;
+            }
+            out << (first ? "\n" : ",\n") << "        \"" << json_escape(e.name) << "\": {"
+                << "\"count\": " << totals[e.first_slot + Histogram::BUCKETS]
+                << ", \"sum\": " << totals[e.first_slot + Histogram::BUCKETS + 1]
+                << ", \"buckets\": {";
+            // Keyed by the exclusive upper bound of each non-empty bucket
+            bool first_bucket = true;
+            for (uint32_t b = 0; b < Histogram::BUCKETS; b++) {
+                if (totals[e.first_slot + b] == 0) {
+                    continue;
+                }
+                out << (first_bucket ? "" : ", ") << "\"" << (1_u64 << b) << "\": " << totals[e.first_slot + b];
+                first_bucket = false;
+            }
+            out << "}}";
+            first = false;
+        }
+        out << "\n    }\n}\n";
+        return out.str();
+    }
+
+    void Metrics::write(const std::string &path) {
+        std::string json = this->to_json();
+        if (path.empty()) {
+            std::fwrite(json.data(), 1, json.size(), stderr);
+            return;
+        }
+        std::string tmp = path + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "w");
+        if (!f) {
+            logger.warn << "Could not write metrics to " << path;
+            return;
+        }
+        std::fwrite(json.data(), 1, json.size(), f);
+        std::fclose(f);
+        if (std::rename(tmp.c_str(), path.c_str())) {
+            logger.warn << "Could not write metrics to " << path;
+        }
+    }
+
+    void Metrics::start_exporter(const std::string &path, unsigned int interval_ms) {
+        if (this->exporter.joinable()) {
+            return;
+        }
+        if (pipe(this->wake_pipe)) {
+            throw SimulatorException("Could not create metrics pipe");
+        }
+        // The signal handler must never block on a full pipe
+        fcntl(this->wake_pipe[1], F_SETFL, O_NONBLOCK);
+        this->output_file = path;
+        this->stopping = false;
+        signal_pipe = this->wake_pipe[1];
+        std::signal(SIGUSR1, handle_sigusr1);
+        this->exporter = std::thread(&Metrics::exporter_loop, this, interval_ms);
+    }
+
+    void Metrics::stop_exporter() {
+        if (!this->exporter.joinable()) {
+            return;
+        }
+        std::signal(SIGUSR1, SIG_DFL);
+        signal_pipe = -1;
+        this->stopping = true;
+        char c = 0;
+        [[maybe_unused]] ssize_t ret = ::write(this->wake_pipe[1], &c, 1);
+        this->exporter.join();
+        ::close(this->wake_pipe[0]);
+        ::close(this->wake_pipe[1]);
+        if (!this->output_file.empty()) {
+            this->write(this->output_file);
+        }
+    }
+
+    void Metrics::exporter_loop(unsigned int interval_ms) {
+        int timeout = interval_ms ? static_cast<int>(interval_ms) : -1;
+        while (true) {
+            struct pollfd fd = { this->wake_pipe[0], POLLIN, 0 };
+            int ready = ::poll(&fd, 1, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (ready > 0) {
+                char buf[64];
+                [[maybe_unused]] ssize_t ret = ::read(this->wake_pipe[0], buf, sizeof(buf));
+            }
+            if (this->stopping) {
+                return;
+            }
+            this->write(this->output_file);
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace lc32sim {
+    namespace metrics_detail {
+        // Counters and histogram buckets share one flat space of slots
+        constexpr uint32_t MAX_SLOTS = 2048;
+
+        /*
+         * One thread's values for every slot. Only the owning thread writes
+         * them and the exporter only reads them, so they are updated with a
+         * relaxed load and store instead of a locked read-modify-write.
+         */
+        struct ThreadSlots {
+            std::atomic<uint64_t> values[MAX_SLOTS] = {};
+        };
+        extern constinit thread_local ThreadSlots *current;
+        ThreadSlots *register_thread();
+
+        forceinline void add(uint32_t slot, uint64_t n) {
+            ThreadSlots *slots = current;
+            if (!slots) [[unlikely]] {
+                slots = register_thread();
+            }
+            std::atomic<uint64_t> &value = slots->values[slot];
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    }
+
+    /*!
+     * \brief Handle to a named, monotonically increasing count
+     *
+     * Handles are cheap to copy. Every handle for the same name adds to the
+     * same total, which is summed across threads only when exported.
+     */
+    class Counter {
+        private:
+            uint32_t slot = 0;
+            explicit Counter(uint32_t slot) : slot(slot) {}
+            friend class Metrics;
+        public:
+            Counter() = default;
+            forceinline void add(uint64_t n = 1) const {
+                metrics_detail::add(this->slot, n);
+            }
+    };
+
+    /*!
+     * \brief Handle to a named distribution of values
+     *
+     * Values are counted in power-of-two buckets: bucket `i` holds values
+     * below `2^i` and at least `2^(i-1)`. The count and sum are kept too.
+     */
+    class Histogram {
+        public:
+            static constexpr uint32_t BUCKETS = 40;
+        private:
+            // Buckets, then the count, then the sum
+            uint32_t first_slot = 0;
+            explicit Histogram(uint32_t first_slot) : first_slot(first_slot) {}
+            friend class Metrics;
+        public:
+            Histogram() = default;
+            forceinline void record(uint64_t value) const {
+                uint32_t bucket = std::min<uint32_t>(std::bit_width(value), BUCKETS - 1);
+                metrics_detail::add(this->first_slot + bucket, 1);
+                metrics_detail::add(this->first_slot + BUCKETS, 1);
+                metrics_detail::add(this->first_slot + BUCKETS + 1, value);
+            }
+    };
+
+    /*!
+     * \brief Process-wide registry of counters and histograms
+     *
+     * Registering is done once, up front, by whoever records the metric,
+     * and returns a handle. Recording through a handle never locks. The
+     * registry can be written out as JSON at exit, periodically, and
+     * whenever the process receives `SIGUSR1`.
+     */
+    class Metrics {
+        private:
+            struct Entry {
+                std::string name;
+                uint32_t first_slot;
+                bool histogram;
+            };
+
+            // Guards the registry and the list of live threads
+            std::mutex lock;
+            std::vector<Entry> entries;
+            std::unordered_map<std::string, size_t> by_name;
+            // Slot 0 absorbs writes through default-constructed handles
+            uint32_t next_slot = 1;
+            std::vector<metrics_detail::ThreadSlots*> threads;
+            // Totals from threads that have exited
+            std::vector<uint64_t> retired;
+
+            uint32_t allocate(const std::string &name, bool histogram, uint32_t slots);
+
+            // Periodic and on-demand export, see `start_exporter`
+            std::thread exporter;
+            std::atomic<bool> stopping = false;
+            int wake_pipe[2] = {-1, -1};
+            std::string output_file;
+            void exporter_loop(unsigned int interval_ms);
+
+            friend metrics_detail::ThreadSlots *metrics_detail::register_thread();
+            friend struct ThreadRetirer;
+
+        public:
+            Metrics();
+            ~Metrics();
+            Metrics(Metrics const&) = delete;
+            void operator=(Metrics const&) = delete;
+
+            Counter counter(const std::string &name);
+            Histogram histogram(const std::string &name);
+
+            //! Sums every thread's values and formats them as JSON
+            std::string to_json();
+            /*!
+             * \brief Writes `to_json()` to `path`, or standard error if empty
+             *
+             * Files are replaced atomically, so readers never see a partial
+             * export.
+             */
+            void write(const std::string &path);
+
+            /*!
+             * \brief Starts writing to `path` every `interval_ms` and on `SIGUSR1`
+             *
+             * An interval of zero only exports on the signal. With an empty
+             * `path`, exports go to standard error. `stop_exporter` writes one
+             * last export if there is a file to write it to.
+             */
+            void start_exporter(const std::string &path, unsigned int interval_ms);
+            void stop_exporter();
+    };
+    extern Metrics metrics;
+}
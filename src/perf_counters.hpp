@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "iodevice.hpp"
+#include "sim.hpp"
+#include "video_timing.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Exposes 64-bit performance counters for guests to time themselves
+     *
+     * Every counter is read straight from where the simulator already keeps
+     * it, so reads have no side effects and cost nothing until made. The
+     * host clock makes this a device outside the simulation, so it is not
+     * replayable.
+     */
+    class PerfCounters : public IODevice {
+        private:
+            Simulator &sim;
+            VideoTiming &timing;
+
+            // Maps the low and high words of a counter
+            static void add_counter(read_handlers &handlers, uint32_t addr, std::function<uint64_t()> counter) {
+                handlers.emplace_back(addr, [counter](uint32_t val) -> uint32_t {
+                    return static_cast<uint32_t>(counter());
+                });
+                handlers.emplace_back(addr + 4, [counter](uint32_t val) -> uint32_t {
+                    return static_cast<uint32_t>(counter() >> 32);
+                });
+            }
+
+        public:
+            PerfCounters(Simulator &sim, VideoTiming &timing) : sim(sim), timing(timing) {}
+
+            std::string get_name() override { return "Performance Counters"; };
+            read_handlers get_read_handlers() override {
+                read_handlers handlers;
+                add_counter(handlers, PERF_INSTRET_ADDR, [this]() { return this->sim.scheduler.now; });
+                add_counter(handlers, PERF_CYCLES_ADDR, [this]() { return this->sim.cycles; });
+                add_counter(handlers, PERF_FRAMES_ADDR, [this]() { return this->timing.frame; });
+                add_counter(handlers, PERF_HOST_NS_ADDR, []() -> uint64_t {
+                    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+                    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+                });
+                return handlers;
+            };
+    };
+}
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cstring>
+
+#include "exceptions.hpp"
+#include "log.hpp"
+#include "recorder.hpp"
+
+namespace lc32sim {
+    Recorder::Recorder(Simulator &sim, uint64_t checkpoint_interval, uint64_t max_memory) : sim(sim), max_memory(max_memory), frontier(sim.scheduler.now) {
+        if (checkpoint_interval == 0) {
+            throw SimulatorException("Checkpoint interval must be positive");
+        }
+        if (sim.recorder) {
+            throw SimulatorException("Simulator is already being recorded");
+        }
+        for (IODevice *dev : sim.get_devices()) {
+            if (dev->replayable()) {
+                this->devices.push_back(dev);
+            }
+        }
+        sim.recorder = this;
+        this->checkpoint_event = sim.scheduler.schedule(checkpoint_interval, [this]() { this->checkpoint(); }, checkpoint_interval);
+        this->checkpoint();
+    }
+
+    Recorder::~Recorder() {
+        this->sim.scheduler.cancel(this->checkpoint_event);
+        this->sim.mem.stop_undo_log();
+        this->sim.recorder = nullptr;
+    }
+
+    void Recorder::checkpoint() {
+        if (!this->checkpoints.empty()) {
+            Checkpoint &last = this->checkpoints.back();
+            last.undo = this->sim.mem.take_undo_log();
+            for (const SavedPage &saved : last.undo) {
+                last.undo_bytes += sizeof(SavedPage) + (saved.data ? Config.memory.simulator_page_size : 0);
+            }
+            this->checkpoint_bytes += last.undo_bytes;
+        }
+
+        Checkpoint &cp = this->checkpoints.emplace_back();
+        cp.pc = this->sim.pc;
+        std::copy(std::begin(this->sim.regs), std::end(this->sim.regs), std::begin(cp.regs));
+        cp.cond = this->sim.cond;
+        cp.cycles = this->sim.cycles;
+        cp.halted = this->sim.halted;
+        cp.scheduler = this->sim.scheduler.snapshot();
+        for (IODevice *dev : this->devices) {
+            cp.devices.push_back(dev->save_state());
+        }
+        cp.log_position = this->log_cursor;
+        this->sim.mem.start_undo_log();
+
+        // Replays only bring back checkpoints that fit before, so leave them be
+        while (!this->replaying() && this->checkpoint_bytes + this->log_bytes > this->max_memory && this->checkpoints.size() > 1) {
+            this->drop_oldest();
+        }
+    }
+
+    void Recorder::drop_oldest() {
+        this->checkpoint_bytes -= this->checkpoints.front().undo_bytes;
+        this->checkpoints.pop_front();
+        // Nothing before the oldest checkpoint can be replayed any more
+        while (this->log_base < this->checkpoints.front().log_position) {
+            for (const MemoryDelta &delta : this->log.front().deltas) {
+                this->log_bytes -= delta.bytes.size();
+            }
+            this->log_bytes -= sizeof(LogEntry);
+            this->log.pop_front();
+            this->log_base++;
+        }
+    }
+
+    void Recorder::restore(size_t index) {
+        this->frontier = std::max(this->frontier, this->sim.scheduler.now);
+
+        // Newest first, so each page ends up as it was at the checkpoint
+        this->sim.mem.undo(this->sim.mem.take_undo_log());
+        for (size_t i = this->checkpoints.size(); i-- > index;) {
+            this->sim.mem.undo(this->checkpoints[i].undo);
+        }
+        while (this->checkpoints.size() > index + 1) {
+            this->checkpoint_bytes -= this->checkpoints.back().undo_bytes;
+            this->checkpoints.pop_back();
+        }
+        Checkpoint &cp = this->checkpoints.back();
+        this->checkpoint_bytes -= cp.undo_bytes;
+        cp.undo.clear();
+        cp.undo_bytes = 0;
+        this->sim.mem.start_undo_log();
+
+        this->sim.pc = cp.pc;
+        std::copy(std::begin(cp.regs), std::end(cp.regs), std::begin(this->sim.regs));
+        this->sim.cond = cp.cond;
+        this->sim.cycles = cp.cycles;
+        this->sim.halted = cp.halted;
+        this->sim.at_breakpoint = false;
+        this->sim.watch_hit.reset();
+        this->sim.fault.reset();
+        this->sim.scheduler.restore(cp.scheduler);
+        this->sim.scheduler.resume();
+        for (size_t i = 0; i < this->devices.size(); i++) {
+            this->devices[i]->restore_state(cp.devices[i]);
+        }
+        this->log_cursor = cp.log_position;
+    }
+
+    void Recorder::run_to(uint64_t target, std::vector<Hit> *hits) {
+        Scheduler &scheduler = this->sim.scheduler;
+        this->hits = hits;
+        this->sim.mem.set_watch_handler([this](const WatchHit &hit) {
+            // The access happens during the instruction, so stop before it
+            if (this->hits && hit.watchpoint.stop) {
+                this->hits->push_back(Hit{this->sim.scheduler.now - 1, hit});
+            }
+        });
+
+        try {
+            while (!this->sim.halted) {
+                if (scheduler.now >= scheduler.next_deadline()) {
+                    scheduler.dispatch();
+                    // Only reaching the target ends a replay
+                    if (scheduler.stop_requested()) {
+                        scheduler.resume();
+                    }
+                    continue;
+                }
+                if (scheduler.now >= target) {
+                    break;
+                }
+                scheduler.now++;
+                if (!this->sim.step()) {
+                    if (this->sim.fault) {
+                        // The recording ended in this fault, so the replay does too
+                        break;
+                    }
+                    if (this->sim.at_breakpoint) {
+                        scheduler.now--;
+                        this->sim.at_breakpoint = false;
+                        if (hits) {
+                            hits->push_back(Hit{scheduler.now, std::nullopt});
+                        }
+                        this->sim.mem.step_over_breakpoint(this->sim.pc);
+                    }
+                }
+            }
+        } catch (const SimulatorException &e) {
+            // So does one in a scheduled device event
+        }
+
+        this->hits = nullptr;
+        this->sim.watch_hit.reset();
+        this->sim.mem.set_watch_handler([this](const WatchHit &hit) { this->sim.report_watchpoint(hit); });
+    }
+
+    Recorder::LogEntry *Recorder::replay_entry() {
+        if (this->log_cursor == this->log_base + this->log.size()) {
+            return nullptr;
+        }
+        LogEntry &entry = this->log[this->log_cursor - this->log_base];
+        if (entry.time != this->sim.scheduler.now) {
+            throw SimulatorException("Replay diverged from the recording at instruction " + std::to_string(this->sim.scheduler.now));
+        }
+        this->log_cursor++;
+        return &entry;
+    }
+
+    void Recorder::append(LogEntry entry) {
+        this->log_bytes += sizeof(LogEntry);
+        for (const MemoryDelta &delta : entry.deltas) {
+            this->log_bytes += delta.bytes.size();
+        }
+        this->log.push_back(std::move(entry));
+        this->log_cursor++;
+    }
+
+    uint32_t Recorder::external_read(const std::function<uint32_t()> &read) {
+        if (LogEntry *entry = this->replay_entry()) {
+            return entry->value;
+        }
+        uint32_t value = read();
+        this->append(LogEntry{this->sim.scheduler.now, value, {}});
+        return value;
+    }
+
+    uint32_t Recorder::external_write(uint32_t addr, bool writes_registers, const std::function<uint32_t()> &write) {
+        if (LogEntry *entry = this->replay_entry()) {
+            for (const MemoryDelta &delta : entry->deltas) {
+                GuestSpan span = this->sim.mem.span(delta.addr, delta.bytes.size());
+                std::memcpy(span.data, delta.bytes.data(), delta.bytes.size());
+            }
+            return entry->value;
+        }
+
+        this->sim.mem.start_span_capture();
+        uint32_t value;
+        try {
+            value = write();
+        } catch (...) {
+            this->sim.mem.end_span_capture();
+            throw;
+        }
+        std::vector<std::pair<uint32_t, uint64_t>> spans = this->sim.mem.end_span_capture();
+        // The register written comes back as the value, so only devices that
+        // store to their other registers need the page holding it
+        if (writes_registers) {
+            uint32_t page_start = addr - addr % Config.memory.simulator_page_size;
+            spans.emplace_back(page_start, std::min<uint64_t>(Config.memory.simulator_page_size, Config.memory.user_space_max + 1 - page_start));
+        }
+
+        LogEntry entry{this->sim.scheduler.now, value, {}};
+        for (auto [start, size] : spans) {
+            GuestSpan span = this->sim.mem.span(start, size);
+            entry.deltas.push_back(MemoryDelta{start, std::vector<uint8_t>(span.data, span.data + span.size)});
+        }
+        this->append(std::move(entry));
+        return value;
+    }
+
+    void Recorder::diverge() {
+        this->log.resize(this->log_cursor - this->log_base);
+        this->log_bytes = 0;
+        for (const LogEntry &entry : this->log) {
+            this->log_bytes += sizeof(LogEntry);
+            for (const MemoryDelta &delta : entry.deltas) {
+                this->log_bytes += delta.bytes.size();
+            }
+        }
+        this->frontier = this->sim.scheduler.now;
+    }
+
+    bool Recorder::step_back() {
+        uint64_t now = this->sim.scheduler.now;
+        if (now <= this->earliest()) {
+            return false;
+        }
+        uint64_t target = now - 1;
+        size_t index = this->checkpoints.size() - 1;
+        while (this->checkpoints[index].time() > target) {
+            index--;
+        }
+        this->restore(index);
+        this->run_to(target, nullptr);
+        return true;
+    }
+
+    Recorder::ReverseStop Recorder::continue_back() {
+        uint64_t end = this->sim.scheduler.now;
+        // Search back one checkpoint interval at a time, for the last hit
+        // before where execution started
+        for (size_t i = this->checkpoints.size(); i-- > 0;) {
+            if (this->checkpoints[i].time() >= end) {
+                continue;
+            }
+            std::vector<Hit> found;
+            this->restore(i);
+            this->run_to(end, &found);
+            if (!found.empty()) {
+                Hit last = *std::max_element(found.begin(), found.end(), [](const Hit &a, const Hit &b) { return a.position < b.position; });
+                this->restore(i);
+                this->run_to(last.position, nullptr);
+                return ReverseStop{true, last.watch_hit};
+            }
+            end = this->checkpoints[i].time();
+        }
+        this->restore(0);
+        return ReverseStop{false, std::nullopt};
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <any>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Records execution so that it can be run backwards
+     *
+     * A checkpoint of the registers, the scheduler, and replayable devices is
+     * taken every `checkpoint_interval` instructions. Memory is not copied
+     * wholesale: each page is saved the first time it changes after a
+     * checkpoint, using the same per-page flags as breakpoints and
+     * watchpoints, so pages that are only read cost nothing. Everything read
+     * from other devices is logged, along with the memory they change, so
+     * execution from any checkpoint replays exactly. Going back restores the
+     * nearest earlier checkpoint and replays forward to the target.
+     *
+     * The oldest checkpoints are dropped to stay within `max_memory` bytes,
+     * which limits how far back execution can go.
+     */
+    class Recorder {
+        public:
+            //! Where a reverse continue stopped
+            struct ReverseStop {
+                // False if the start of the recording was reached first
+                bool found;
+                // The watchpoint hit stopped at, if it was not a breakpoint
+                std::optional<WatchHit> watch_hit;
+            };
+
+        private:
+            struct Checkpoint {
+                uint32_t pc;
+                uint32_t regs[8];
+                uint8_t cond;
+                uint64_t cycles;
+                bool halted;
+                Scheduler::Snapshot scheduler;
+                std::vector<std::any> devices;
+                // Position in the log of the first entry after this checkpoint
+                uint64_t log_position;
+                // Pages changed between this checkpoint and the next
+                std::vector<SavedPage> undo;
+                uint64_t undo_bytes = 0;
+
+                uint64_t time() const { return this->scheduler.now; }
+            };
+
+            // Guest memory a device changed, as it was afterwards
+            struct MemoryDelta {
+                uint32_t addr;
+                std::vector<uint8_t> bytes;
+            };
+            struct LogEntry {
+                uint64_t time;
+                uint32_t value;
+                std::vector<MemoryDelta> deltas;
+            };
+
+            // Somewhere a reverse continue could stop, as an instruction count
+            struct Hit {
+                uint64_t position;
+                std::optional<WatchHit> watch_hit;
+            };
+
+            Simulator &sim;
+            uint64_t max_memory;
+            Scheduler::event_id checkpoint_event;
+            std::vector<IODevice*> devices;
+
+            std::deque<Checkpoint> checkpoints;
+            std::deque<LogEntry> log;
+            // Absolute positions, which survive dropping old entries
+            uint64_t log_base = 0;
+            uint64_t log_cursor = 0;
+            uint64_t log_bytes = 0;
+            uint64_t checkpoint_bytes = 0;
+            // Instructions up to here have been recorded, and are replayed
+            uint64_t frontier;
+            // Where hits go while searching backwards, if searching
+            std::vector<Hit> *hits = nullptr;
+
+            void checkpoint();
+            void drop_oldest();
+            void restore(size_t index);
+            void run_to(uint64_t target, std::vector<Hit> *hits);
+            LogEntry *replay_entry();
+            void append(LogEntry entry);
+
+        public:
+            Recorder(Simulator &sim, uint64_t checkpoint_interval, uint64_t max_memory);
+            ~Recorder();
+            Recorder(Recorder const&) = delete;
+            void operator=(Recorder const&) = delete;
+
+            //! Whether the instruction being executed was executed before
+            bool replaying() const { return this->sim.scheduler.now <= this->frontier; }
+
+            /*!
+             * \brief Reads from outside the simulation, or from the log
+             *
+             * When replaying, `read` is not called and the value logged the
+             * first time is returned instead.
+             */
+            uint32_t external_read(const std::function<uint32_t()> &read);
+            /*!
+             * \brief Writes to a device that is not replayable
+             *
+             * The value stored to the register written, `addr`, is logged,
+             * along with the memory the device changes through spans and,
+             * if `writes_registers` is set, the page holding `addr`. When
+             * replaying, they are put back instead of calling `write` again.
+             */
+            uint32_t external_write(uint32_t addr, bool writes_registers, const std::function<uint32_t()> &write);
+
+            /*!
+             * \brief Forgets everything recorded after this point
+             *
+             * Called when the state is changed by hand, for instance from a
+             * debugger, after which the recording no longer applies.
+             */
+            void diverge();
+
+            //! Goes back one instruction, unless at the start of the recording
+            bool step_back();
+            /*!
+             * \brief Goes back to the last breakpoint or stopping watchpoint hit
+             *
+             * Watchpoints stop just before the instruction that made the
+             * access. Without any hits, this goes back to the start of the
+             * recording.
+             */
+            ReverseStop continue_back();
+            //! Instruction count of the earliest point execution can go back to
+            uint64_t earliest() const { return this->checkpoints.front().time(); }
+    };
+}
@@ -0,0 +1,55 @@
+#include <algorithm>
+
+#include "scheduler.hpp"
+
+namespace lc32sim {
+    void Scheduler::update_deadline() {
+        this->deadline = std::numeric_limits<uint64_t>::max();
+        for (const Event &e : this->events) {
+            this->deadline = std::min(this->deadline, e.deadline);
+        }
+    }
+
+    Scheduler::event_id Scheduler::schedule(uint64_t delay, event_handler handler, uint64_t period) {
+        event_id id = this->next_id++;
+        this->events.push_back(Event{this->now + delay, period, id, std::move(handler)});
+        this->deadline = std::min(this->deadline, this->now + delay);
+        return id;
+    }
+
+    void Scheduler::cancel(event_id id) {
+        std::erase_if(this->events, [id](const Event &e) { return e.id == id; });
+        this->update_deadline();
+    }
+
+    void Scheduler::dispatch() {
+        while (this->deadline <= this->now && !this->stopped) {
+            // Earliest deadline first, ties broken by scheduling order
+            auto it = std::min_element(this->events.begin(), this->events.end(), [](const Event &a, const Event &b) {
+                return a.deadline < b.deadline || (a.deadline == b.deadline && a.id < b.id);
+            });
+
+            // The handler may schedule or cancel events, so take it out first
+            event_handler handler = it->handler;
+            if (it->period != 0) {
+                it->deadline += it->period;
+            } else {
+                this->events.erase(it);
+            }
+            this->update_deadline();
+
+            handler();
+        }
+    }
+
+    Scheduler::Snapshot Scheduler::snapshot() const {
+        return Snapshot{this->now, this->next_id, this->events};
+    }
+
+    void Scheduler::restore(const Snapshot &snapshot) {
+        this->now = snapshot.now;
+        this->next_id = snapshot.next_id;
+        this->events = snapshot.events;
+        this->update_deadline();
+    }
+}
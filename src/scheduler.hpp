@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace lc32sim {
+    using event_handler = std::function<void()>;
+
+    /*!
+     * \brief Central timeline for all timed hardware
+     *
+     * Time is measured in retired instructions. The run loop only needs to
+     * compare `now` against `next_deadline()`, and call `dispatch()` once it
+     * is reached. Only a handful of events are ever live at once, so they
+     * are kept in a flat vector and scanned linearly.
+     */
+    class Scheduler {
+        public:
+            using event_id = uint64_t;
+
+        private:
+            struct Event {
+                uint64_t deadline;
+                uint64_t period;
+                event_id id;
+                event_handler handler;
+            };
+            std::vector<Event> events;
+            event_id next_id = 1;
+            uint64_t deadline = std::numeric_limits<uint64_t>::max();
+            bool stopped = false;
+
+            void update_deadline();
+
+        public:
+            //! The clock and pending events, for rewinding execution
+            struct Snapshot {
+                uint64_t now;
+                event_id next_id;
+                std::vector<Event> events;
+            };
+
+            // Number of instructions retired so far
+            uint64_t now = 0;
+
+            /*!
+             * \brief Schedules `handler` to run `delay` instructions from now
+             *
+             * If `period` is non-zero, the event is rescheduled that many
+             * instructions after each time it fires, until cancelled.
+             */
+            event_id schedule(uint64_t delay, event_handler handler, uint64_t period = 0);
+            void cancel(event_id id);
+
+            forceinline uint64_t next_deadline() const { return deadline; }
+            //! Runs every event that is due, in deadline order
+            void dispatch();
+
+            Snapshot snapshot() const;
+            /*!
+             * \brief Puts the clock and events back as they were
+             *
+             * Events cancelled since the snapshot come back, and ones
+             * scheduled since are dropped, so owners of events must outlive
+             * any snapshot that holds them.
+             */
+            void restore(const Snapshot &snapshot);
+
+            /*!
+             * \brief Asks the run loop to return after the current event or
+             * instruction
+             *
+             * The deadline is pulled in to `now`, so the run loop leaves its
+             * inner loop without an extra test per instruction.
+             */
+            void stop() {
+                stopped = true;
+                deadline = std::min(deadline, now);
+            }
+            bool stop_requested() const { return stopped; }
+            //! Clears a stop request so the run loop can be entered again
+            void resume() {
+                stopped = false;
+                update_deadline();
+            }
+    };
+}
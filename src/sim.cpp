@@ -4,230 +4,494 @@
 #include <functional>
 #include <iostream>
 #include <iomanip>
-#include <termios.h>
-#include <unistd.h>
+#include <sstream>
+#include <utility>
 
 #include "exceptions.hpp"
+#include "fuzzer.hpp"
+#include "hle.hpp"
 #include "instruction.hpp"
 #include "log.hpp"
+#include "recorder.hpp"
 #include "sim.hpp"
+#include "simpoint.hpp"
 #include "utils.hpp"
 
 namespace lc32sim {
-    Simulator::Simulator(unsigned int seed) : halted(false), pc(0x30000000), mem() {
+    namespace {
+        uint32_t cycle_cost(InstructionType type) {
+            switch (type) {
+                case InstructionType::LDB:
+                case InstructionType::LDH:
+                case InstructionType::LDW:
+                case InstructionType::STB:
+                case InstructionType::STH:
+                case InstructionType::STW:
+                    return Config.perf.memory_cycles;
+                case InstructionType::BR:
+                case InstructionType::JMP:
+                case InstructionType::JSR:
+                case InstructionType::JSRR:
+                case InstructionType::RTI:
+                    return Config.perf.control_cycles;
+                case InstructionType::TRAP:
+                    return Config.perf.trap_cycles;
+                default:
+                    return Config.perf.alu_cycles;
+            }
+        }
+
+        inline void setcc(HartState &hart, uint32_t val) {
+            int32_t sval = static_cast<int32_t>(val);
+            hart.cond = (sval < 0) ? 0b100 : (sval == 0) ? 0b010 : 0b001;
+        }
+    }
+
+    thread_local uint32_t Simulator::hart_id = 0;
+
+    Simulator::Simulator(unsigned int seed) : instructions_retired(metrics.counter("sim.instructions_retired")), mem() {
+        this->pc = 0x30000000;
         std::srand(seed);
         this->cond = std::rand() & 0b111;
         for (size_t i = 0; i < sizeof(this->regs)/sizeof(this->regs[0]); i++) {
             this->regs[i] = std::rand();
         }
         mem.set_seed(std::rand());
+        for (size_t i = 0; i < NUM_INSTRUCTION_TYPES; i++) {
+            this->cycle_costs[i] = cycle_cost(static_cast<InstructionType>(i));
+        }
 
-        // Need to turn of ECHO and ICANON on the terminal
-        // GETC and IN assumes that characters are not echoed and that input is
-        // not line buffered.
-        {
-            // Get the terminal information
-            struct termios ti;
-            if (tcgetattr(STDIN_FILENO, &ti))
-                throw TerminalConfigurationException("Could not retrieve terminal configuration");
-            // Disable
-            ti.c_lflag &= ~(ECHO | ICANON);
-            if (tcsetattr(STDIN_FILENO, TCSANOW, &ti))
-                throw TerminalConfigurationException("Could not disable ECHO");
+        this->register_io_device(this->input);
+        this->mem.set_watch_handler([this](const WatchHit &hit) { this->report_watchpoint(hit); });
+    }
+
+    void Simulator::report_watchpoint(const WatchHit &hit) {
+        // Accesses happen while executing, after the PC has moved past the instruction
+        uint32_t pc = this->pc - 2;
+        Instruction i(this->mem.read<uint16_t, true>(pc));
+        auto hex = [](uint32_t value, int width) {
+            std::ostringstream out;
+            out << "x" << std::hex << std::setw(width) << std::setfill('0') << value;
+            return out.str();
+        };
+        if (hit.write) {
+            logger.info << "Watchpoint: " << static_cast<int>(hit.size) << "-byte write to " << hex(hit.addr, 8) << " by " << i << " @ " << hex(pc, 8)
+                        << ", " << hex(hit.old_value, hit.size * 2) << " -> " << hex(hit.new_value, hit.size * 2);
+        } else {
+            logger.info << "Watchpoint: " << static_cast<int>(hit.size) << "-byte read of " << hex(hit.addr, 8) << " by " << i << " @ " << hex(pc, 8)
+                        << ", value " << hex(hit.new_value, hit.size * 2);
+        }
+        if (hit.watchpoint.stop) {
+            this->watch_hit = hit;
+            this->scheduler.stop();
         }
     }
-    Simulator::~Simulator() {
-        // We turned ECHO and ICANON off in the constructor, so turn it back on
-        // Don't fail if this doesn't work - we're dead anyway
-        {
-            // Get the terminal information
-            struct termios ti;
-            tcgetattr(STDIN_FILENO, &ti);
-            // Enable
-            ti.c_lflag |= ECHO | ICANON;
-            tcsetattr(STDIN_FILENO, TCSANOW, &ti);
+
+    bool Simulator::replaying() const {
+        return this->recorder && this->recorder->replaying();
+    }
+
+    int Simulator::read_input() {
+        if (this->fuzzer) {
+            this->fuzzer->start();
+        }
+        if (this->recorder) {
+            return static_cast<int>(this->recorder->external_read([this]() { return static_cast<uint32_t>(this->input.get()); }));
         }
+        return this->input.get();
     }
 
-    inline void Simulator::setcc(uint32_t val) {
-        int32_t sval = static_cast<int32_t>(val);
-        cond = (sval < 0) ? 0b100 : (sval == 0) ? 0b010 : 0b001;
+    inline void Simulator::record_edge() {
+        uint16_t cur = static_cast<uint16_t>((this->pc * 0x9e3779b1u) >> 16);
+        this->coverage[cur ^ this->coverage_prev]++;
+        this->coverage_prev = cur >> 1;
     }
 
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wterminate"
-    bool Simulator::step() noexcept {
+    bool Simulator::raise_fault(HartState &hart, Fault fault) {
+        hart.pc = fault.pc;
+        hart.fault = std::move(fault);
+        return false;
+    }
+
+    bool Simulator::memory_fault(HartState &hart, uint32_t pc, uint16_t bits, bool fetching) {
+        const MemoryFault &fault = *Memory::fault;
+        return raise_fault(hart, Fault{fault.kind, pc, bits, fault.addr, fault.size, "", fetching ? FaultPhase::FETCH : FaultPhase::EXECUTE});
+    }
+
+    template<bool primary> bool Simulator::execute(HartState &hart) noexcept {
         Instruction i;
-        if (this->halted) {
-            throw SimulatorException("Simulator HALTed");
+        if (hart.halted) {
+            return false;
         }
 
         // FETCH/DECODE
-        i = Instruction(mem.read<uint16_t>(pc));
+        uint16_t bits = 0;
+        if (!mem.fetch(hart.pc, bits)) [[unlikely]] {
+            if (Memory::fault) {
+                return memory_fault(hart, hart.pc, 0, true);
+            }
+            if constexpr (primary) {
+                if (!std::exchange(Memory::intercepted, false)) {
+                    this->at_breakpoint = true;
+                    return false;
+                }
+                if (this->hle && this->hle->enter(hart.pc)) {
+                    // It returned like a JMP R7 would have
+                    hart.cycles += this->cycle_costs[static_cast<size_t>(InstructionType::JMP)];
+                    return true;
+                }
+            } else {
+                // Breakpoints are for the debugger, which only follows hart
+                // 0, and intercepted routines only run natively on hart 0
+                Memory::intercepted = false;
+            }
+            bits = mem.read<uint16_t, true>(hart.pc);
+        }
+        if constexpr (primary) {
+            if (this->line_coverage) {
+                this->line_coverage->mark(hart.pc);
+            }
+            if (this->cache_model) {
+                this->cache_model->fetch(hart.pc);
+            }
+        }
+        i = Instruction(bits);
         if (logger.debug.enabled()) {
-            logger.debug << "Executing instruction " << i << " @ x" << std::hex << std::setw(8) << std::setfill('0') << pc;
+            logger.debug << "Executing instruction " << i << " @ x" << std::hex << std::setw(8) << std::setfill('0') << hart.pc;
         }
-        pc += 2;
+        hart.pc += 2;
+        hart.cycles += this->cycle_costs[static_cast<size_t>(i.type)];
 
         // EXECUTE
         uint32_t val2; // represents the second value in arithmetic instructions
-        switch (i.type) {
-            case InstructionType::ADD:
-                val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : regs[i.data.arithmetic.sr2];
-                regs[i.data.arithmetic.dr] = regs[i.data.arithmetic.sr1] + val2;
-                setcc(regs[i.data.arithmetic.dr]);
-                break;
-            case InstructionType::AND:
-                val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : regs[i.data.arithmetic.sr2];
-                regs[i.data.arithmetic.dr] = regs[i.data.arithmetic.sr1] & val2;
-                setcc(regs[i.data.arithmetic.dr]);
-                break;
-            case InstructionType::BR:
-                if (cond & i.data.br.cond) {
-                    pc += i.data.br.pcoffset9 * 2;
+        try {
+            switch (i.type) {
+                case InstructionType::ADD:
+                    val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : hart.regs[i.data.arithmetic.sr2];
+                    hart.regs[i.data.arithmetic.dr] = hart.regs[i.data.arithmetic.sr1] + val2;
+                    setcc(hart, hart.regs[i.data.arithmetic.dr]);
+                    break;
+                case InstructionType::AND:
+                    val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : hart.regs[i.data.arithmetic.sr2];
+                    hart.regs[i.data.arithmetic.dr] = hart.regs[i.data.arithmetic.sr1] & val2;
+                    setcc(hart, hart.regs[i.data.arithmetic.dr]);
+                    break;
+                case InstructionType::BR:
+                    if (hart.cond & i.data.br.cond) {
+                        hart.pc += i.data.br.pcoffset9 * 2;
+                    }
+                    if (primary && this->coverage) {
+                        this->record_edge();
+                    }
+                    if (primary && this->simpoint) {
+                        this->simpoint->branch(hart.pc);
+                    }
+                    break;
+                case InstructionType::JMP:
+                    hart.pc = hart.regs[i.data.jmp.baseR];
+                    if (primary && this->coverage) {
+                        this->record_edge();
+                    }
+                    if (primary && this->simpoint) {
+                        this->simpoint->branch(hart.pc);
+                    }
+                    break;
+                case InstructionType::JSR:
+                    hart.regs[7] = hart.pc;
+                    hart.pc += i.data.jsr.pcoffset11 * 2;
+                    if (primary && this->coverage) {
+                        this->record_edge();
+                    }
+                    if (primary && this->simpoint) {
+                        this->simpoint->branch(hart.pc);
+                    }
+                    break;
+                case InstructionType::JSRR:
+                    hart.regs[7] = hart.pc;
+                    hart.pc = hart.regs[i.data.jsrr.baseR];
+                    if (primary && this->coverage) {
+                        this->record_edge();
+                    }
+                    if (primary && this->simpoint) {
+                        this->simpoint->branch(hart.pc);
+                    }
+                    break;
+                case InstructionType::LDB: {
+                    uint32_t addr = hart.regs[i.data.load.baseR] + i.data.load.offset6;
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
+                    }
+                    uint8_t val;
+                    if (!mem.load(addr, val)) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
+                    }
+                    hart.regs[i.data.load.dr] = sext<8, 32>(val);
+                    setcc(hart, hart.regs[i.data.load.dr]);
+                    break;
                 }
-                break;
-            case InstructionType::JMP:
-                pc = regs[i.data.jmp.baseR];
-                break;
-            case InstructionType::JSR:
-                regs[7] = pc;
-                pc += i.data.jsr.pcoffset11 * 2;
-                break;
-            case InstructionType::JSRR:
-                regs[7] = pc;
-                pc = regs[i.data.jsrr.baseR];
-                break;
-            case InstructionType::LDB:
-                regs[i.data.load.dr] = sext<8, 32>(mem.read<uint8_t>(regs[i.data.load.baseR] + i.data.load.offset6));
-                setcc(regs[i.data.load.dr]);
-                break;
-            case InstructionType::LDH:
-                regs[i.data.load.dr] = sext<16, 32>(mem.read<uint16_t>(regs[i.data.load.baseR] + (i.data.load.offset6 * 2)));
-                setcc(regs[i.data.load.dr]);
-                break;
-            case InstructionType::LDW:
-                regs[i.data.load.dr] = mem.read<uint32_t>(regs[i.data.load.baseR] + (i.data.load.offset6 * 4));
-                setcc(regs[i.data.load.dr]);
-                break;
-            case InstructionType::LEA:
-                regs[i.data.lea.dr] = pc + i.data.lea.pcoffset9;
-                break;
-            case InstructionType::RTI:
-                throw SimulatorException("simulate(): RTI not implemented");
-                break;
-            case InstructionType::LSHF:
-                if (i.data.shift.imm)
-                    regs[i.data.shift.dr] = regs[i.data.shift.sr1] << (i.data.shift.amount3 + 1);
-                else
-                    regs[i.data.shift.dr] = regs[i.data.shift.sr1] << regs[i.data.shift.sr2];
-                setcc(regs[i.data.shift.dr]);
+                case InstructionType::LDH: {
+                    uint32_t addr = hart.regs[i.data.load.baseR] + (i.data.load.offset6 * 2);
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
+                    }
+                    uint16_t val;
+                    if (!mem.load(addr, val)) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
+                    }
+                    hart.regs[i.data.load.dr] = sext<16, 32>(val);
+                    setcc(hart, hart.regs[i.data.load.dr]);
                     break;
-            case InstructionType::RSHFL:
-                if (i.data.shift.imm)
-                    regs[i.data.shift.dr] = regs[i.data.shift.sr1] >> (i.data.shift.amount3 + 1);
-                else
-                    regs[i.data.shift.dr] = regs[i.data.shift.sr1] >> regs[i.data.shift.sr2];
-                setcc(regs[i.data.shift.dr]);
-                break;
-            case InstructionType::RSHFA:
-                if (i.data.shift.imm)
-                    regs[i.data.shift.dr] = static_cast<int32_t>(regs[i.data.shift.sr1]) >> (i.data.shift.amount3 + 1);
-                else
-                    regs[i.data.shift.dr] = static_cast<int32_t>(regs[i.data.shift.sr1]) >> regs[i.data.shift.sr2];
-                setcc(regs[i.data.shift.dr]);
-                break;
-            case InstructionType::STB:
-                mem.write<uint8_t>(regs[i.data.store.baseR] + i.data.store.offset6, static_cast<uint8_t>(regs[i.data.store.sr]));
-                break;
-            case InstructionType::STH:
-                mem.write<uint16_t>(regs[i.data.store.baseR] + (i.data.store.offset6 * 2), static_cast<uint16_t>(regs[i.data.store.sr]));
-                break;
-            case InstructionType::STW:
-                mem.write<uint32_t>(regs[i.data.store.baseR] + (i.data.store.offset6 * 4), static_cast<uint32_t>(regs[i.data.store.sr]));
-                break;
-            case InstructionType::TRAP:
-                switch (i.data.trap.trapvect8) {
-                    case TrapVector::GETC: {
-                        char received;
-                        std::cin.get(received);
-                        this->regs[0] = static_cast<uint32_t>(received & 0xff);
-                        break;
+                }
+                case InstructionType::LDW: {
+                    uint32_t addr = hart.regs[i.data.load.baseR] + (i.data.load.offset6 * 4);
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
                     }
-                    case TrapVector::OUT:
-                        std::cout << static_cast<char>(this->regs[0] & 0xff) << std::flush;
-                        break;
-                    case TrapVector::PUTS: {
-                        char c;
-                        for (uint32_t i = regs[0]; (c = mem.read<char>(i)) != '\0'; i++)
-                            std::cout << c;
-                        std::cout << std::flush;
-                        break;
+                    uint32_t val;
+                    if (!mem.load(addr, val)) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
                     }
-                    case TrapVector::IN: {
-                        char received;
-                        std::cout << "> ";
-                        std::cin.get(received);
-                        std::cout << received << std::endl;
-                        this->regs[0] = static_cast<uint32_t>(received & 0xff);
+                    hart.regs[i.data.load.dr] = val;
+                    setcc(hart, hart.regs[i.data.load.dr]);
+                    break;
+                }
+                case InstructionType::LEA:
+                    hart.regs[i.data.lea.dr] = hart.pc + i.data.lea.pcoffset9;
+                    break;
+                case InstructionType::RTI:
+                    return raise_fault(hart, Fault{FaultKind::ILLEGAL_INSTRUCTION, hart.pc - 2, bits, 0, 0, "simulate(): RTI not implemented"});
+                case InstructionType::LSHF:
+                    if (i.data.shift.imm)
+                        hart.regs[i.data.shift.dr] = hart.regs[i.data.shift.sr1] << (i.data.shift.amount3 + 1);
+                    else
+                        hart.regs[i.data.shift.dr] = hart.regs[i.data.shift.sr1] << hart.regs[i.data.shift.sr2];
+                    setcc(hart, hart.regs[i.data.shift.dr]);
                         break;
+                case InstructionType::RSHFL:
+                    if (i.data.shift.imm)
+                        hart.regs[i.data.shift.dr] = hart.regs[i.data.shift.sr1] >> (i.data.shift.amount3 + 1);
+                    else
+                        hart.regs[i.data.shift.dr] = hart.regs[i.data.shift.sr1] >> hart.regs[i.data.shift.sr2];
+                    setcc(hart, hart.regs[i.data.shift.dr]);
+                    break;
+                case InstructionType::RSHFA:
+                    if (i.data.shift.imm)
+                        hart.regs[i.data.shift.dr] = static_cast<int32_t>(hart.regs[i.data.shift.sr1]) >> (i.data.shift.amount3 + 1);
+                    else
+                        hart.regs[i.data.shift.dr] = static_cast<int32_t>(hart.regs[i.data.shift.sr1]) >> hart.regs[i.data.shift.sr2];
+                    setcc(hart, hart.regs[i.data.shift.dr]);
+                    break;
+                case InstructionType::STB: {
+                    uint32_t addr = hart.regs[i.data.store.baseR] + i.data.store.offset6;
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
                     }
-                    case TrapVector::HALT:
-                        this->halted = true;
-                        break;
-                    case TrapVector::BREAK:
-                        // If the user tries to give control to the
-                        // debugger, print a message and dump the state. It
-                        // is *not* an error to execute this instruction.
-                        if (logger.info.enabled()) {
-                            logger.info << "Encountered BREAK:";
-                            this->dump_state(logger.info);
-                            logger.info << "    Continuing execution...";
-                        }
-                        break;
-                    case TrapVector::CRASH:
-                        // This should never happen. If it does, die
-                        throw SimulatorException("simulate(): encountered CRASH");
-                    default:
-                        throw SimulatorException("simulate(): unknown TRAP vector " + std::to_string(static_cast<uint8_t>(i.data.trap.trapvect8)));
+                    if (!mem.store<uint8_t>(addr, static_cast<uint8_t>(hart.regs[i.data.store.sr]))) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
+                    }
+                    break;
                 }
-                break;
-            case InstructionType::XOR:
-                val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : regs[i.data.arithmetic.sr2];
-                regs[i.data.arithmetic.dr] = regs[i.data.arithmetic.sr1] ^ val2;
-                setcc(regs[i.data.arithmetic.dr]);
-                break;
-            default:
-                throw SimulatorException("simulate(): unknown instruction type " + std::to_string(static_cast<std::underlying_type<InstructionType>::type>(i.type)));
-                break;
+                case InstructionType::STH: {
+                    uint32_t addr = hart.regs[i.data.store.baseR] + (i.data.store.offset6 * 2);
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
+                    }
+                    if (!mem.store<uint16_t>(addr, static_cast<uint16_t>(hart.regs[i.data.store.sr]))) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
+                    }
+                    break;
+                }
+                case InstructionType::STW: {
+                    uint32_t addr = hart.regs[i.data.store.baseR] + (i.data.store.offset6 * 4);
+                    if (primary && this->cache_model) {
+                        this->cache_model->data(hart.pc - 2, addr);
+                    }
+                    if (!mem.store<uint32_t>(addr, static_cast<uint32_t>(hart.regs[i.data.store.sr]))) [[unlikely]] {
+                        return memory_fault(hart, hart.pc - 2, bits);
+                    }
+                    break;
+                }
+                case InstructionType::TRAP:
+                    if constexpr (!primary) {
+                        // Console TRAPs use devices, which belong to hart 0
+                        switch (i.data.trap.trapvect8) {
+                            case TrapVector::GETC:
+                            case TrapVector::OUT:
+                            case TrapVector::PUTS:
+                            case TrapVector::IN:
+                                return raise_fault(hart, Fault{FaultKind::DEVICE_ERROR, hart.pc - 2, bits, 0, 0, "TRAP 0x" + int_to_hex(static_cast<uint8_t>(i.data.trap.trapvect8)) + " can only be used by hart 0"});
+                            default:
+                                break;
+                        }
+                    }
+                    switch (i.data.trap.trapvect8) {
+                        case TrapVector::GETC:
+                            // Make sure any prompt is visible before blocking
+                            this->console.flush();
+                            // EOF comes through as -1
+                            hart.regs[0] = static_cast<uint32_t>(this->read_input());
+                            break;
+                        case TrapVector::OUT:
+                            if (!this->replaying()) {
+                                this->console.put(static_cast<char>(hart.regs[0] & 0xff));
+                            }
+                            break;
+                        case TrapVector::PUTS: {
+                            GuestSpan str = mem.string_at(hart.regs[0]);
+                            if (str.hooked) {
+                                // Let the hooks see every read
+                                char c;
+                                bool muted = this->replaying();
+                                for (uint32_t i = hart.regs[0]; ; i++) {
+                                    if (!mem.load(i, c)) {
+                                        return memory_fault(hart, hart.pc - 2, bits);
+                                    }
+                                    if (c == '\0') {
+                                        break;
+                                    }
+                                    if (!muted)
+                                        this->console.put(c);
+                                }
+                            } else if (!this->replaying()) {
+                                this->console.write(reinterpret_cast<const char*>(str.data), str.size);
+                            }
+                            break;
+                        }
+                        case TrapVector::IN: {
+                            bool muted = this->replaying();
+                            if (!muted) {
+                                this->console.write("> ", 2);
+                                this->console.flush();
+                            }
+                            int received = this->read_input();
+                            if (!muted) {
+                                if (received != EOF) {
+                                    this->console.put(static_cast<char>(received));
+                                }
+                                this->console.put('\n');
+                            }
+                            hart.regs[0] = static_cast<uint32_t>(received);
+                            break;
+                        }
+                        case TrapVector::HALT:
+                            hart.halted = true;
+                            if constexpr (primary) {
+                                this->console.flush();
+                            }
+                            break;
+                        case TrapVector::BREAK:
+                            // If the user tries to give control to the
+                            // debugger, print a message and dump the state. It
+                            // is *not* an error to execute this instruction.
+                            if (logger.info.enabled()) {
+                                logger.info << "Encountered BREAK:";
+                                this->dump_state(logger.info, hart);
+                                logger.info << "    Continuing execution...";
+                            }
+                            break;
+                        case TrapVector::CRASH:
+                            // This should never happen. If it does, die
+                            return raise_fault(hart, Fault{FaultKind::CRASH, hart.pc - 2, bits});
+                        default:
+                            return raise_fault(hart, Fault{FaultKind::ILLEGAL_INSTRUCTION, hart.pc - 2, bits, 0, 0, "simulate(): unknown TRAP vector " + std::to_string(static_cast<uint8_t>(i.data.trap.trapvect8))});
+                    }
+                    break;
+                case InstructionType::XOR:
+                    val2 = i.data.arithmetic.imm ? i.data.arithmetic.imm5 : hart.regs[i.data.arithmetic.sr2];
+                    hart.regs[i.data.arithmetic.dr] = hart.regs[i.data.arithmetic.sr1] ^ val2;
+                    setcc(hart, hart.regs[i.data.arithmetic.dr]);
+                    break;
+                default:
+                    return raise_fault(hart, Fault{FaultKind::ILLEGAL_INSTRUCTION, hart.pc - 2, bits, 0, 0, "simulate(): unknown instruction type " + std::to_string(static_cast<std::underlying_type<InstructionType>::type>(i.type))});
+            }
+        } catch (const SegmentationFaultException &e) {
+            // Bulk accesses by TRAPs and devices still throw
+            return raise_fault(hart, Fault{FaultKind::SEGMENTATION_FAULT, hart.pc - 2, bits, e.addr});
+        } catch (const UnalignedMemoryAccessException &e) {
+            return raise_fault(hart, Fault{FaultKind::UNALIGNED_ACCESS, hart.pc - 2, bits, e.addr, static_cast<uint8_t>(e.alignment)});
+        } catch (const std::exception &e) {
+            return raise_fault(hart, Fault{FaultKind::DEVICE_ERROR, hart.pc - 2, bits, 0, 0, e.what()});
+        } catch (...) {
+            return raise_fault(hart, Fault{FaultKind::DEVICE_ERROR, hart.pc - 2, bits, 0, 0, "Unknown error"});
         }
 
         // Print the state of the machine for debugging purposes
         if (logger.trace.enabled()) {
             logger.trace << "Machine state after " << i <<":";
-            this->dump_state(logger.trace);
+            this->dump_state(logger.trace, hart);
         }
 
-        return !this->halted;
+        return !hart.halted;
+    }
+
+    bool Simulator::step() noexcept {
+        return this->execute<true>(*this);
     }
-    #pragma GCC diagnostic pop
 
-    inline void Simulator::dump_state(Log &log) {
+    bool Simulator::step(HartState &hart) noexcept {
+        return this->execute<false>(hart);
+    }
+
+    void Simulator::run() {
+        // Keep startup messages ahead of anything the guest prints
+        logger.flush();
+        this->scheduler.resume();
+        this->at_breakpoint = false;
+        this->watch_hit.reset();
+        this->fault.reset();
+        while (!this->scheduler.stop_requested()) {
+            uint64_t start = this->scheduler.now;
+            // Reloaded every instruction, since a stop pulls the deadline in
+            while (this->scheduler.now < this->scheduler.next_deadline()) {
+                this->scheduler.now++;
+                if (!this->step()) {
+                    if (this->at_breakpoint) {
+                        // The instruction was never executed
+                        this->scheduler.now--;
+                    }
+                    this->instructions_retired.add(this->scheduler.now - start);
+                    this->console.flush();
+                    return;
+                }
+            }
+            this->instructions_retired.add(this->scheduler.now - start);
+            try {
+                this->scheduler.dispatch();
+            } catch (const std::exception &e) {
+                this->fault = Fault{FaultKind::DEVICE_ERROR, this->pc, 0, 0, 0, e.what(), FaultPhase::EVENT};
+                break;
+            } catch (...) {
+                this->fault = Fault{FaultKind::DEVICE_ERROR, this->pc, 0, 0, 0, "Unknown error", FaultPhase::EVENT};
+                break;
+            }
+        }
+        this->console.flush();
+    }
+
+    template<typename L> inline void Simulator::dump_state(L &log, const HartState &hart) {
         log << "    PC: "
             << std::hex << std::setfill('0') << std::setw(8)
-            << this->pc;
+            << hart.pc;
         log << "    CC: "
-            << (this->cond & 0b100 ? "n" : ".")
-            << (this->cond & 0b010 ? "z" : ".")
-            << (this->cond & 0b001 ? "p" : ".");
+            << (hart.cond & 0b100 ? "n" : ".")
+            << (hart.cond & 0b010 ? "z" : ".")
+            << (hart.cond & 0b001 ? "p" : ".");
 
         for (size_t i = 0; i < 8; i++)
             log << "    R" << i << ": "
                 << std::hex << std::setfill('0') << std::setw(8)
-                << this->regs[i];
+                << hart.regs[i];
     }
 
     void Simulator::register_io_device(IODevice &dev) {
+        // Every access through a device's registers is counted
+        Counter reads = metrics.counter("mmio." + dev.get_name() + ".reads");
+        Counter writes = metrics.counter("mmio." + dev.get_name() + ".writes");
+        // While recording, other devices are replayed from the recorder's log
+        bool external = !dev.replayable();
+        bool writes_registers = dev.writes_registers();
+        bool shared = dev.shared_by_harts();
+        this->devices.push_back(&dev);
         for (auto [addr, handler] : dev.get_read_handlers()) {
             if (addr < Config.memory.io_space_min) {
                 logger.error << "IODevice " << dev.get_name() << " read-mapped to address x" << std::hex << std::setw(8) << std::setfill('0') << addr << " which is not in I/O space. Ignoring...";
@@ -236,7 +500,19 @@ namespace lc32sim {
                 logger.error << "IODevice " << dev.get_name() << " read-mapped to address x" << std::hex << std::setw(8) << std::setfill('0') << addr << " which is in supervisor space. Ignoring...";
 
             } else {
-                mem.add_read_hook(addr, handler);
+                mem.add_read_hook(addr, [this, addr, handler, reads, external, shared](uint32_t val) -> uint32_t {
+                    if (!shared && hart_id != 0) [[unlikely]] {
+                        throw SimulatorException("I/O register 0x" + int_to_hex(addr) + " can only be used by hart 0");
+                    }
+                    reads.add();
+                    if (external && this->fuzzer) [[unlikely]] {
+                        this->fuzzer->start();
+                    }
+                    if (external && this->recorder) [[unlikely]] {
+                        return this->recorder->external_read([&]() { return handler(val); });
+                    }
+                    return handler(val);
+                });
             }
         }
         for (auto [addr, handler] : dev.get_write_handlers()) {
@@ -246,7 +522,19 @@ namespace lc32sim {
                 // This is a user-mode simulator, so we don't need to worry about supervisor-space I/O devices
                 logger.error << "IODevice " << dev.get_name() << " write-mapped to address x" << std::hex << std::setw(8) << std::setfill('0') << addr << " which is in supervisor space. Ignoring...";
             } else {
-                mem.add_write_hook(addr, handler);
+                mem.add_write_hook(addr, [this, addr, handler, writes, external, writes_registers, shared](uint32_t old_value, uint32_t value) -> uint32_t {
+                    if (!shared && hart_id != 0) [[unlikely]] {
+                        throw SimulatorException("I/O register 0x" + int_to_hex(addr) + " can only be used by hart 0");
+                    }
+                    writes.add();
+                    if (external && this->fuzzer) [[unlikely]] {
+                        this->fuzzer->start();
+                    }
+                    if (external && this->recorder) [[unlikely]] {
+                        return this->recorder->external_write(addr, writes_registers, [&]() { return handler(old_value, value); });
+                    }
+                    return handler(old_value, value);
+                });
             }
         }
     }
@@ -1,15 +1,45 @@
 #pragma once
 #include <chrono>
 #include <memory>
+#include <optional>
 #include <thread>
 
+#include "cache_model.hpp"
 #include "config.hpp"
+#include "console.hpp"
+#include "fault.hpp"
+#include "instruction.hpp"
 #include "iodevice.hpp"
+#include "line_coverage.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "log.hpp"
+#include "scheduler.hpp"
 
 namespace lc32sim {
-    class Simulator {
+    class Fuzzer;
+    class HLE;
+    class Recorder;
+    class SimPoint;
+
+    /*!
+     * \brief What each hart has its own copy of
+     *
+     * `Simulator` holds hart 0's, and `HartControl` those of extra harts,
+     * which `Simulator::step` runs over the same memory.
+     */
+    struct HartState {
+        uint32_t pc = 0;
+        uint32_t regs[8] = {};
+        uint8_t cond = 0b010;
+        // Cycles executed so far, under the cost model in the `perf` config
+        uint64_t cycles = 0;
+        bool halted = false;
+        // Set when execution stopped at a fault, see `Fault`
+        std::optional<Fault> fault;
+    };
+
+    class Simulator : public HartState {
         private:
             /*!
              * \brief Dumps the state of the machine to `cout`
@@ -18,26 +48,117 @@ namespace lc32sim {
              * the machine. It prints with four spaces in front of each entry.
              *
              * @param[in] log The log to dump to, like `logger.info`
+             * @param[in] hart The hart whose registers to dump
+             */
+            template<typename L> inline void dump_state(L &log, const HartState &hart);
+            inline void record_edge();
+            int read_input();
+            // Records a fault by the instruction at `pc`, puts the hart's PC
+            // back on it, and returns false
+            [[gnu::cold]] static bool raise_fault(HartState &hart, Fault fault);
+            // Raises the fault behind the memory access that just failed
+            [[gnu::cold]] static bool memory_fault(HartState &hart, uint32_t pc, uint16_t bits, bool fetching = false);
+            /*
+             * Executes an instruction for `hart`. Only hart 0, the primary,
+             * has devices, TRAPs other than HALT, BREAK, and CRASH,
+             * breakpoints, natively run routines, and instrumentation.
              */
-            inline void dump_state(Log &log);
-            inline void setcc(uint32_t val);
+            template<bool primary> bool execute(HartState &hart) noexcept;
 
             std::vector<std::unique_ptr<IODevice>> io_devices;
+            // Every registered device, owned or not
+            std::vector<IODevice*> devices;
+            Counter instructions_retired;
+            // Hash of the last branch target, shifted, as AFL does
+            uint16_t coverage_prev = 0;
+            // Cycles each type of instruction costs, from the `perf` config
+            uint32_t cycle_costs[NUM_INSTRUCTION_TYPES];
         public:
-            bool halted;
-            uint32_t pc;
-            uint32_t regs[8];
+            /*!
+             * \brief Id of the hart running on this thread
+             *
+             * This is 0, except on threads `HartControl` started for extra
+             * harts. Registers of devices not shared by harts can only be
+             * used from hart 0.
+             */
+            static thread_local uint32_t hart_id;
+            // Set when execution stopped at a breakpoint, before executing it
+            bool at_breakpoint = false;
+            // Set when execution stopped at a watchpoint, after the access
+            std::optional<WatchHit> watch_hit;
             Memory mem;
-            uint8_t cond;
+            Scheduler scheduler;
+            ConsoleOutput console;
+            ConsoleInput input;
+            // Set while execution is being recorded, see `Recorder`
+            Recorder *recorder = nullptr;
+            // Set while fuzzing, see `Fuzzer`
+            Fuzzer *fuzzer = nullptr;
+            /*!
+             * \brief Branch edge counters, in AFL's layout, or null
+             *
+             * If set, every `BR`, `JMP`, `JSR`, and `JSRR` counts the edge
+             * from the previous one to where it went, in an array of 65536
+             * bytes.
+             */
+            uint8_t *coverage = nullptr;
+            // Marks every instruction executed, if set
+            LineCoverage *line_coverage = nullptr;
+            // Sees every instruction fetch, load, and store, if set
+            CacheModel *cache_model = nullptr;
+            // Set while profiling basic blocks, see `SimPoint`
+            SimPoint *simpoint = nullptr;
+            // Runs intercepted libc routines natively, if set
+            HLE *hle = nullptr;
 
             Simulator(unsigned int seed);
-            ~Simulator();
             /*!
             * \brief Single-steps the program currently being executed
-            * \return Whether or not the program is still running
+            *
+            * Guest faults are not thrown. Memory accesses report them with a
+            * status, and the instruction stops there and records a `Fault`,
+            * which callers only need to look at once this returns false.
+            * Exceptions thrown by devices during the instruction are recorded
+            * the same way. A call that `hle` runs natively counts as a single
+            * instruction.
+            *
+            * \return Whether or not the program is still running, which is
+            *         false after a HALT or a fault, or without executing
+            *         anything when already halted or the instruction has a
+            *         breakpoint set on it
             */
             bool step() noexcept;
+            /*!
+             * \brief Single-steps an extra hart
+             *
+             * This is the same interpreter, for a hart with its own state,
+             * which can run on another thread. The hart faults if it uses a
+             * device register not shared by harts, or a TRAP other than
+             * HALT, BREAK, or CRASH. It does not stop at breakpoints, and
+             * routines are never run natively or instrumented for it.
+             *
+             * \return Whether the hart is still running
+             */
+            bool step(HartState &hart) noexcept;
+            /*!
+            * \brief Runs the program until it halts, hits a breakpoint or a
+            * stopping watchpoint, or an event asks to stop
+            *
+            * The inner loop only compares the instruction count against the
+            * scheduler's next deadline. All timed hardware is driven by
+            * scheduler events. Buffered console output is flushed on return.
+            * A stop request left over from a previous call is cleared first,
+            * so a stopped program can be continued by calling this again.
+            * A fault stops it like a HALT does, and leaves `fault` set until
+            * the next call. So does an event that throws, as a device error.
+            */
+            void run();
             void register_io_device(IODevice &dev);
             void register_io_device(IODevice *dev);
+            const std::vector<IODevice*> &get_devices() const { return this->devices; }
+            //! Logs a watchpoint hit, and stops if the watchpoint asks to
+            void report_watchpoint(const WatchHit &hit);
+            //! Whether recorded execution is being replayed, so output is not repeated
+            bool replaying() const;
     };
 }
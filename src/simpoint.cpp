@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "log.hpp"
+#include "simpoint.hpp"
+
+namespace lc32sim {
+    namespace {
+        // Seed for choosing initial cluster centres, so runs are repeatable
+        const uint32_t CLUSTER_SEED = 0x5eed;
+        const unsigned int MAX_ITERATIONS = 100;
+
+        // Where a basic block lands along each dimension, in [-1, 1)
+        double projection(uint32_t pc, size_t dimension) {
+            uint32_t h = (pc ^ (static_cast<uint32_t>(dimension) * 0x85ebca6bu)) * 0x9e3779b1u;
+            h ^= h >> 15;
+            h *= 0xc2b2ae35u;
+            h ^= h >> 13;
+            return h / 2147483648.0 - 1.0;
+        }
+
+        template<typename V> double distance(const V &a, const V &b) {
+            double sum = 0;
+            for (size_t i = 0; i < a.size(); i++) {
+                sum += (a[i] - b[i]) * (a[i] - b[i]);
+            }
+            return sum;
+        }
+
+        bool read_all(int fd, void *buf, size_t size) {
+            uint8_t *p = static_cast<uint8_t*>(buf);
+            while (size > 0) {
+                ssize_t n = ::read(fd, p, size);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                p += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        bool write_all(int fd, const void *buf, size_t size) {
+            const uint8_t *p = static_cast<const uint8_t*>(buf);
+            while (size > 0) {
+                ssize_t n = ::write(fd, p, size);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                p += n;
+                size -= n;
+            }
+            return true;
+        }
+    }
+
+    SimPoint::SimPoint(Simulator &sim, ELFFile &elf) : sim(sim), model(elf), block_pc(sim.pc) {
+        if (sim.simpoint) {
+            throw SimulatorException("Simulator is already being profiled");
+        }
+        if (Config.simpoint.interval == 0) {
+            throw SimulatorException("SimPoint interval must be positive");
+        }
+    }
+
+    SimPoint::~SimPoint() {
+        this->sim.simpoint = nullptr;
+    }
+
+    void SimPoint::end_interval() {
+        uint64_t now = this->sim.scheduler.now;
+        this->blocks[this->block_pc] += now - this->block_start;
+        this->block_start = now;
+
+        Interval interval;
+        interval.start = this->intervals.empty() ? this->first_start : this->intervals.back().start + this->intervals.back().instructions;
+        interval.instructions = now - interval.start;
+        interval.pc = this->interval_pc;
+        interval.vector.fill(0);
+        this->interval_pc = this->sim.pc;
+        if (interval.instructions == 0) {
+            return;
+        }
+        for (auto [pc, count] : this->blocks) {
+            for (size_t d = 0; d < DIMENSIONS; d++) {
+                interval.vector[d] += count * projection(pc, d);
+            }
+        }
+        for (double &x : interval.vector) {
+            x /= interval.instructions;
+        }
+        this->blocks.clear();
+        this->intervals.push_back(interval);
+    }
+
+    std::vector<std::pair<size_t, uint64_t>> SimPoint::choose() {
+        size_t n = this->intervals.size();
+        size_t k = std::min<size_t>(std::max(Config.simpoint.clusters, 1u), n);
+        std::mt19937 rng(CLUSTER_SEED);
+
+        // k-means++: each further centre is picked with probability
+        // proportional to its squared distance from the nearest one so far
+        std::vector<Vector> centres;
+        centres.push_back(this->intervals[rng() % n].vector);
+        std::vector<double> nearest(n, std::numeric_limits<double>::max());
+        while (centres.size() < k) {
+            double total = 0;
+            for (size_t i = 0; i < n; i++) {
+                nearest[i] = std::min(nearest[i], distance(this->intervals[i].vector, centres.back()));
+                total += nearest[i];
+            }
+            if (total == 0) {
+                break;
+            }
+            double pick = std::uniform_real_distribution<double>(0, total)(rng);
+            size_t i = 0;
+            for (; i < n - 1 && pick >= nearest[i]; i++) {
+                pick -= nearest[i];
+            }
+            centres.push_back(this->intervals[i].vector);
+        }
+
+        std::vector<size_t> cluster(n, 0);
+        for (unsigned int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+            bool changed = false;
+            for (size_t i = 0; i < n; i++) {
+                size_t best = 0;
+                for (size_t c = 1; c < centres.size(); c++) {
+                    if (distance(this->intervals[i].vector, centres[c]) < distance(this->intervals[i].vector, centres[best])) {
+                        best = c;
+                    }
+                }
+                changed = changed || cluster[i] != best;
+                cluster[i] = best;
+            }
+            if (!changed && iteration > 0) {
+                break;
+            }
+            std::vector<Vector> sums(centres.size(), Vector{});
+            std::vector<size_t> sizes(centres.size(), 0);
+            for (size_t i = 0; i < n; i++) {
+                for (size_t d = 0; d < DIMENSIONS; d++) {
+                    sums[cluster[i]][d] += this->intervals[i].vector[d];
+                }
+                sizes[cluster[i]]++;
+            }
+            for (size_t c = 0; c < centres.size(); c++) {
+                if (sizes[c] == 0) {
+                    continue;
+                }
+                for (size_t d = 0; d < DIMENSIONS; d++) {
+                    centres[c][d] = sums[c][d] / sizes[c];
+                }
+            }
+        }
+
+        // The interval closest to each centre stands in for its cluster. The
+        // last one is usually cut short, so it only does if nothing else can.
+        std::vector<std::pair<size_t, uint64_t>> chosen;
+        auto better = [&](size_t a, size_t b, const Vector &centre) {
+            bool a_full = this->intervals[a].instructions == Config.simpoint.interval;
+            bool b_full = this->intervals[b].instructions == Config.simpoint.interval;
+            if (a_full != b_full) {
+                return a_full;
+            }
+            return distance(this->intervals[a].vector, centre) < distance(this->intervals[b].vector, centre);
+        };
+        for (size_t c = 0; c < centres.size(); c++) {
+            size_t best = n;
+            uint64_t weight = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (cluster[i] != c) {
+                    continue;
+                }
+                weight += this->intervals[i].instructions;
+                if (best == n || better(i, best, centres[c])) {
+                    best = i;
+                }
+            }
+            if (best != n) {
+                chosen.emplace_back(best, weight);
+            }
+        }
+        std::sort(chosen.begin(), chosen.end());
+        return chosen;
+    }
+
+    void SimPoint::replay(int results_fd) {
+        unsigned int jobs = Config.simpoint.jobs ? Config.simpoint.jobs : std::max(std::thread::hardware_concurrency(), 1u);
+        unsigned int running = 0;
+        for (uint32_t index = 0; index < this->intervals.size(); index++) {
+            const Interval &interval = this->intervals[index];
+            uint64_t fork_at = interval.start - std::min(interval.start - this->first_start, Config.simpoint.warmup);
+            if (fork_at > this->sim.scheduler.now) {
+                this->sim.scheduler.schedule(fork_at - this->sim.scheduler.now, [this]() { this->sim.scheduler.stop(); });
+                try {
+                    this->sim.run();
+                } catch (const SimulatorException &e) {
+                    break;
+                }
+                if (this->sim.scheduler.now != fork_at) {
+                    break;
+                }
+            }
+
+            if (running == jobs) {
+                ::wait(nullptr);
+                running--;
+            }
+            pid_t child = fork();
+            if (child < 0) {
+                logger.error << "Could not fork: " << std::strerror(errno);
+                break;
+            }
+            if (child == 0) {
+                this->measure(interval, index, results_fd);
+            }
+            running++;
+        }
+        while (::wait(nullptr) > 0 || errno == EINTR) {}
+        _exit(0);
+    }
+
+    void SimPoint::measure(const Interval &interval, uint32_t index, int results_fd) {
+        Result result = {index, false, {}};
+        this->sim.cache_model = &this->model;
+        try {
+            if (interval.start > this->sim.scheduler.now) {
+                this->sim.scheduler.schedule(interval.start - this->sim.scheduler.now, [this]() { this->sim.scheduler.stop(); });
+                this->sim.run();
+            }
+            // Warming up only fills the caches
+            this->model.clear_counts();
+            result.diverged = this->sim.scheduler.now != interval.start || this->sim.pc != interval.pc;
+            this->sim.scheduler.schedule(interval.instructions, [this]() { this->sim.scheduler.stop(); });
+            this->sim.run();
+        } catch (const SimulatorException &e) {
+            // The interval ends where the program did
+        }
+        result.counts = this->model.get_totals();
+        _exit(write_all(results_fd, &result, sizeof(result)) ? 0 : 1);
+    }
+
+    void SimPoint::run(const std::string &report_path) {
+        // Only this thread survives a fork, so stop the others
+        this->sim.console.discard();
+        logger.stop_formatter();
+
+        int chosen_pipe[2], results_pipe[2];
+        if (pipe(chosen_pipe) != 0 || pipe(results_pipe) != 0) {
+            throw SimulatorException(std::string("Could not create pipe: ") + std::strerror(errno));
+        }
+        this->first_start = this->sim.scheduler.now;
+        this->interval_pc = this->sim.pc;
+
+        // This process replays the program from the start once the
+        // intervals to measure are known
+        pid_t replayer = fork();
+        if (replayer < 0) {
+            throw SimulatorException(std::string("Could not fork: ") + std::strerror(errno));
+        }
+        if (replayer == 0) {
+            ::close(chosen_pipe[1]);
+            ::close(results_pipe[0]);
+            // Only the chosen intervals are sent, in order
+            uint64_t count;
+            if (!read_all(chosen_pipe[0], &count, sizeof(count))) {
+                _exit(0);
+            }
+            this->intervals.resize(count);
+            if (!read_all(chosen_pipe[0], this->intervals.data(), count * sizeof(Interval))) {
+                _exit(1);
+            }
+            this->replay(results_pipe[1]);
+        }
+        ::close(chosen_pipe[0]);
+        ::close(results_pipe[1]);
+
+        // First pass: basic block vectors for every interval
+        this->block_pc = this->sim.pc;
+        this->block_start = this->sim.scheduler.now;
+        this->sim.simpoint = this;
+        Scheduler::event_id interval_event = this->sim.scheduler.schedule(Config.simpoint.interval, [this]() {
+            this->end_interval();
+        }, Config.simpoint.interval);
+        try {
+            this->sim.run();
+            if (this->sim.fault) {
+                logger.info << "Program stopped: " << this->sim.fault->describe();
+            }
+        } catch (const SimulatorException &e) {
+            logger.info << "Program stopped: " << e.what();
+        }
+        this->sim.scheduler.cancel(interval_event);
+        this->sim.simpoint = nullptr;
+        this->end_interval();
+
+        uint64_t total = this->sim.scheduler.now - this->first_start;
+        std::vector<std::pair<size_t, uint64_t>> chosen;
+        if (!this->intervals.empty()) {
+            chosen = this->choose();
+        }
+        logger.info << "Profiled " << total << " instructions in " << this->intervals.size() << " intervals, measuring " << chosen.size() << " of them";
+
+        uint64_t count = chosen.size();
+        bool sent = write_all(chosen_pipe[1], &count, sizeof(count));
+        for (size_t i = 0; sent && i < chosen.size(); i++) {
+            sent = write_all(chosen_pipe[1], &this->intervals[chosen[i].first], sizeof(Interval));
+        }
+        ::close(chosen_pipe[1]);
+
+        // Results arrive in whatever order the intervals finish
+        std::map<uint32_t, Result> results;
+        Result result;
+        while (read_all(results_pipe[0], &result, sizeof(result))) {
+            results[result.interval] = result;
+        }
+        ::close(results_pipe[0]);
+        waitpid(replayer, nullptr, 0);
+        if (results.size() != chosen.size()) {
+            logger.warn << "Only " << results.size() << " of " << chosen.size() << " intervals were measured";
+        }
+
+        CacheModel::Counts estimate;
+        std::ofstream out(report_path);
+        if (!out.is_open()) {
+            throw SimulatorException("Could not open SimPoint report " + report_path);
+        }
+        out << "{\n    \"instructions\": " << total
+            << ",\n    \"interval\": " << Config.simpoint.interval
+            << ",\n    \"intervals\": " << this->intervals.size()
+            << ",\n    \"simpoints\": [";
+        bool first = true;
+        for (size_t i = 0; i < chosen.size(); i++) {
+            auto [index, weight] = chosen[i];
+            const Interval &interval = this->intervals[index];
+            auto found = results.find(i);
+            if (found == results.end()) {
+                continue;
+            }
+            const Result &r = found->second;
+            if (r.diverged) {
+                logger.warn << "Interval " << index << " did not start the same way when replayed";
+            }
+            // Each interval stands in for every instruction in its cluster
+            double scale = static_cast<double>(weight) / interval.instructions;
+            for (size_t level = 0; level < CacheModel::LEVELS; level++) {
+                estimate.accesses[level] += std::llround(scale * r.counts.accesses[level]);
+                estimate.misses[level] += std::llround(scale * r.counts.misses[level]);
+            }
+            out << (first ? "\n" : ",\n") << "        {\"interval\": " << index << ", \"start\": " << interval.start
+                << ", \"pc\": \"0x" << int_to_hex(interval.pc) << "\", \"weight\": " << static_cast<double>(weight) / total
+                << ", \"diverged\": " << (r.diverged ? "true" : "false") << ", ";
+            this->model.write_counts(out, r.counts);
+            out << "}";
+            first = false;
+        }
+        out << "\n    ],\n    \"estimate\": {";
+        this->model.write_counts(out, estimate);
+        out << "}\n}\n";
+        if (!out) {
+            throw SimulatorException("Could not write SimPoint report " + report_path);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache_model.hpp"
+#include "elf_file.hpp"
+#include "sim.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Estimates cache behaviour for a whole run from a few intervals
+     *
+     * A first pass runs the program at close to full speed, splitting it
+     * into intervals of `simpoint.interval` instructions. For each, it
+     * counts how many instructions ran in each basic block, and projects
+     * that basic block vector down to a few dimensions. The intervals are
+     * clustered with k-means, and the interval closest to the middle of each
+     * cluster stands in for it, weighted by the instructions in the cluster.
+     *
+     * A process forked before the first pass then runs the program again,
+     * forking at the start of each chosen interval. Those processes are the
+     * checkpoints: each warms up a `CacheModel` for `simpoint.warmup`
+     * instructions, runs the interval through it, and sends back the counts,
+     * with up to `simpoint.jobs` at a time. The report has the counts for
+     * each interval, and the weighted estimate for the whole run.
+     *
+     * Replaying relies on the program doing the same thing both times, so
+     * its input has to come from a file, and devices like the RNG and the
+     * clocks make the estimate meaningless. Guest output is discarded.
+     */
+    class SimPoint {
+        private:
+            static constexpr size_t DIMENSIONS = 15;
+            using Vector = std::array<double, DIMENSIONS>;
+            struct Interval {
+                uint64_t start;
+                uint64_t instructions;
+                uint32_t pc;
+                Vector vector;
+            };
+            struct Result {
+                // Position among the chosen intervals
+                uint32_t interval;
+                // Whether the PC did not match the first pass at the start
+                bool diverged;
+                CacheModel::Counts counts;
+            };
+
+            Simulator &sim;
+            CacheModel model;
+
+            // Basic block being executed, and when it was entered
+            uint32_t block_pc;
+            uint64_t block_start = 0;
+            // Instructions run in each basic block during this interval
+            std::unordered_map<uint32_t, uint64_t> blocks;
+            uint64_t first_start = 0;
+            // PC at the start of the current interval
+            uint32_t interval_pc;
+            // Every interval in the first pass, only the chosen ones when replaying
+            std::vector<Interval> intervals;
+
+            void end_interval();
+            // Picks the interval standing in for each cluster, with weights
+            // in instructions
+            std::vector<std::pair<size_t, uint64_t>> choose();
+            // Runs the program again, forking a checkpoint at each interval
+            [[noreturn]] void replay(int results_fd);
+            [[noreturn]] void measure(const Interval &interval, uint32_t index, int results_fd);
+
+        public:
+            SimPoint(Simulator &sim, ELFFile &elf);
+            ~SimPoint();
+            SimPoint(SimPoint const&) = delete;
+            void operator=(SimPoint const&) = delete;
+
+            //! Ends the current basic block, with control having gone to `pc`
+            inline void branch(uint32_t pc) {
+                this->blocks[this->block_pc] += this->sim.scheduler.now - this->block_start;
+                this->block_pc = pc;
+                this->block_start = this->sim.scheduler.now;
+            }
+
+            /*!
+             * \brief Profiles and replays the program, and writes the report
+             * \throws SimulatorException if the report cannot be written
+             */
+            void run(const std::string &report_path);
+    };
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <bit>
 #include <cstdint>
+#include <cstdio>
+#include <string>
 
 #define forceinline __attribute__((always_inline)) inline
 
@@ -54,4 +56,22 @@ constexpr forceinline uint32_t from16(uint16_t first, uint16_t second) {
     } else {
         return (static_cast<uint32_t>(first) << 16) | second;
     }
-}
\ No newline at end of file
+}
+
+// Escapes a string for use between quotes in JSON
+inline std::string json_escape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[7];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+            out += code;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "iodevice.hpp"
+#include "scheduler.hpp"
+
+namespace lc32sim {
+    /*!
+     * \brief Drives scanline timing and exposes it through `REG_VCOUNT`
+     *
+     * A periodic scheduler event advances the scanline every
+     * `instructions_per_scanline` instructions. Other hardware subscribes to
+     * the HBlank, VBlank, and start-of-frame signals this generates.
+     *
+     * This is kept separate from the `Display` so that display timing can
+     * still be emulated when running headless. Guests that wait for VBlank
+     * would otherwise spin forever without a window.
+     */
+    class VideoTiming : public IODevice {
+        private:
+            unsigned int scanline_max;
+
+            void end_scanline() {
+                if (this->scanline < Config.display.height) {
+                    for (auto &handler : this->on_hblank) {
+                        handler();
+                    }
+                }
+                if (this->scanline == Config.display.height - 1) {
+                    for (auto &handler : this->on_vblank) {
+                        handler();
+                    }
+                }
+                if (++this->scanline == this->scanline_max) {
+                    this->scanline = 0;
+                    this->frame++;
+                    for (auto &handler : this->on_frame) {
+                        handler();
+                    }
+                }
+            }
+
+        public:
+            uint16_t scanline = 0;
+            uint64_t frame = 0;
+
+            // Fired at the end of each visible scanline
+            std::vector<event_handler> on_hblank;
+            // Fired once the last visible scanline is done
+            std::vector<event_handler> on_vblank;
+            // Fired when the scanline wraps back to zero
+            std::vector<event_handler> on_frame;
+
+            VideoTiming(Scheduler &scheduler) {
+                this->scanline_max = Config.display.height + Config.display.vblank_length;
+                if (this->scanline_max > std::numeric_limits<uint16_t>().max()) {
+                    throw SimulatorException("Display height + vblank length exceeds range of uint16_t");
+                }
+                if (Config.display.instructions_per_scanline == 0) {
+                    throw SimulatorException("Instructions per scanline must be positive");
+                }
+                scheduler.schedule(Config.display.instructions_per_scanline, [this]() {
+                    this->end_scanline();
+                }, Config.display.instructions_per_scanline);
+            }
+            VideoTiming(VideoTiming const&) = delete;
+            void operator=(VideoTiming const&) = delete;
+
+            std::string get_name() override { return "Video Timing"; };
+            bool replayable() override { return true; }
+            std::any save_state() override {
+                return std::pair{this->scanline, this->frame};
+            }
+            void restore_state(const std::any &state) override {
+                std::tie(this->scanline, this->frame) = std::any_cast<std::pair<uint16_t, uint64_t>>(state);
+            }
+            read_handlers get_read_handlers() override {
+                return {
+                    { REG_VCOUNT_ADDR, [this](uint32_t val) -> uint32_t {
+                        return this->scanline;
+                    }},
+                };
+            };
+    };
+}